@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "watcher.h"
+
+
+#define ARRAY_LEN(a)       (sizeof(a) / sizeof((a)[0]))
+#define MAX_SCAN_BYTES     (64UL * 1024UL * 1024UL)
+#define MIN_SCANNED_ENTRIES (2000000UL)
+#define MIN_ITERATIONS     5UL
+#define DEBOUNCE_DELAY     2UL
+
+
+typedef enum {
+    OUTPUT_CSV = 0,
+    OUTPUT_JSON,
+} output_format_t;
+
+
+typedef struct {
+    const char   *name;
+    unsigned long entries;
+    unsigned long entry_size;
+    double        change_ratio;
+    double        delayed_ratio;
+    unsigned long iterations;
+    double        ns_per_entry;
+    double        ns_per_call;
+} bench_result_t;
+
+
+static const unsigned long entry_counts[]   = {10, 100, 1000, 10000, 65535};
+static const unsigned long entry_sizes[]    = {1, 4, 8, 64, 1024, 4096};
+static const double        change_ratios[]  = {0.0, 0.01, 0.1, 1.0};
+static const double        delayed_ratios[] = {0.0, 0.5};
+
+static volatile unsigned long callback_sink = 0;
+static output_format_t        output_format = OUTPUT_CSV;
+static unsigned long          results_count = 0;
+
+
+static void callback(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr, void *arg) {
+    (void)old_value;
+    (void)new_value;
+    (void)size;
+    (void)user_ptr;
+    (void)arg;
+    callback_sink++;
+}
+
+
+static unsigned long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+
+static void print_header(void) {
+    if (output_format == OUTPUT_CSV) {
+        printf("benchmark,entries,entry_size,change_ratio,delayed_ratio,iterations,ns_per_entry,ns_per_call\n");
+    } else {
+        printf("[\n");
+    }
+}
+
+
+static void print_footer(void) {
+    if (output_format == OUTPUT_JSON) {
+        printf("\n]\n");
+    }
+}
+
+
+static void print_result(const bench_result_t *result) {
+    if (output_format == OUTPUT_CSV) {
+        printf("%s,%lu,%lu,%.4f,%.4f,%lu,%.3f,%.1f\n", result->name, result->entries, result->entry_size,
+               result->change_ratio, result->delayed_ratio, result->iterations, result->ns_per_entry,
+               result->ns_per_call);
+    } else {
+        printf("%s  {\"benchmark\": \"%s\", \"entries\": %lu, \"entry_size\": %lu, \"change_ratio\": %.4f, "
+               "\"delayed_ratio\": %.4f, \"iterations\": %lu, \"ns_per_entry\": %.3f, \"ns_per_call\": %.1f}",
+               results_count > 0 ? ",\n" : "", result->name, result->entries, result->entry_size,
+               result->change_ratio, result->delayed_ratio, result->iterations, result->ns_per_entry,
+               result->ns_per_call);
+    }
+    results_count++;
+    fflush(stdout);
+}
+
+
+/*
+ * Registers `entries` slices of `entry_size` bytes each carved from `memory`; every
+ * 1/delayed_ratio-th entry is registered as delayed.
+ */
+static int register_entries(watcher_t *watcher, uint8_t *memory, unsigned long entries, unsigned long entry_size,
+                            double delayed_ratio) {
+    unsigned long i              = 0;
+    unsigned long delayed_stride = delayed_ratio > 0 ? (unsigned long)(1.0 / delayed_ratio) : 0;
+
+    for (i = 0; i < entries; i++) {
+        uint8_t *slice = &memory[i * entry_size];
+        if (delayed_stride > 0 && i % delayed_stride == 0) {
+            watcher_add_entry_delayed(watcher, slice, (watcher_size_t)entry_size, callback, NULL, DEBOUNCE_DELAY);
+        } else {
+            watcher_add_entry(watcher, slice, (watcher_size_t)entry_size, callback, NULL);
+        }
+    }
+
+    return watcher->entries.num == entries ? 0 : -1;
+}
+
+
+static void bench_registration(unsigned long entries) {
+    watcher_t watcher;
+    uint8_t  *memory = calloc(entries, sizeof(uint32_t));
+    if (memory == NULL) {
+        return;
+    }
+
+    WATCHER_INIT_STD(&watcher, NULL);
+
+    unsigned long long start = now_ns();
+    int                res   = register_entries(&watcher, memory, entries, sizeof(uint32_t), 0);
+    unsigned long long end   = now_ns();
+
+    if (res == 0) {
+        bench_result_t result = {
+            .name          = "add_entry",
+            .entries       = entries,
+            .entry_size    = sizeof(uint32_t),
+            .change_ratio  = 0,
+            .delayed_ratio = 0,
+            .iterations    = 1,
+            .ns_per_entry  = (double)(end - start) / (double)entries,
+            .ns_per_call   = (double)(end - start),
+        };
+        print_result(&result);
+    }
+
+    watcher_destroy(&watcher);
+    free(memory);
+}
+
+
+static void bench_batch_registration(unsigned long entries) {
+    watcher_t                   watcher;
+    unsigned long               i           = 0;
+    uint8_t                    *memory      = calloc(entries, sizeof(uint32_t));
+    watcher_entry_descriptor_t *descriptors = calloc(entries, sizeof(watcher_entry_descriptor_t));
+    if (memory == NULL || descriptors == NULL) {
+        free(memory);
+        free(descriptors);
+        return;
+    }
+
+    for (i = 0; i < entries; i++) {
+        descriptors[i].pointer  = &memory[i * sizeof(uint32_t)];
+        descriptors[i].size     = sizeof(uint32_t);
+        descriptors[i].callback = callback;
+    }
+
+    WATCHER_INIT_STD(&watcher, NULL);
+
+    unsigned long long start = now_ns();
+    watcher_result_t   res   = watcher_add_entries(&watcher, descriptors, entries);
+    unsigned long long end   = now_ns();
+
+    if (res == WATCHER_RESULT_OK) {
+        bench_result_t result = {
+            .name          = "add_entries",
+            .entries       = entries,
+            .entry_size    = sizeof(uint32_t),
+            .change_ratio  = 0,
+            .delayed_ratio = 0,
+            .iterations    = 1,
+            .ns_per_entry  = (double)(end - start) / (double)entries,
+            .ns_per_call   = (double)(end - start),
+        };
+        print_result(&result);
+    }
+
+    watcher_destroy(&watcher);
+    free(descriptors);
+    free(memory);
+}
+
+
+// With dirty tracking the changed entries are marked, as a cooperating producer would; with a pool entries are
+// compared by watcher_watch_parallel
+static void bench_scan(unsigned long entries, unsigned long entry_size, double delayed_ratio, uint8_t dirty,
+                       const watcher_pool_t *pool) {
+    watcher_t     watcher;
+    unsigned long timestamp = 0;
+    size_t        i         = 0;
+    uint8_t      *memory    = calloc(entries, entry_size);
+    if (memory == NULL) {
+        return;
+    }
+
+    WATCHER_INIT_STD(&watcher, NULL);
+    if (register_entries(&watcher, memory, entries, entry_size, delayed_ratio)) {
+        fprintf(stderr, "Unable to register %lu entries of size %lu\n", entries, entry_size);
+        watcher_destroy(&watcher);
+        free(memory);
+        return;
+    }
+    if (dirty && watcher_set_dirty_tracking(&watcher, 1) != WATCHER_RESULT_OK) {
+        fprintf(stderr, "Unable to enable dirty tracking for %lu entries\n", entries);
+        watcher_destroy(&watcher);
+        free(memory);
+        return;
+    }
+
+    for (i = 0; i < ARRAY_LEN(change_ratios); i++) {
+        double        change_ratio  = change_ratios[i];
+        unsigned long change_stride = change_ratio > 0 ? (unsigned long)(1.0 / change_ratio) : 0;
+        unsigned long iterations    = MIN_SCANNED_ENTRIES / entries;
+        unsigned long long elapsed  = 0;
+        unsigned long iteration     = 0;
+
+        if (iterations < MIN_ITERATIONS) {
+            iterations = MIN_ITERATIONS;
+        }
+
+        // Settle every pending change and debounce before measuring
+        watcher_watch_parallel(&watcher, timestamp, pool);
+        timestamp += DEBOUNCE_DELAY;
+        watcher_watch_parallel(&watcher, timestamp, pool);
+
+        for (iteration = 0; iteration < iterations; iteration++) {
+            unsigned long j = 0;
+            if (change_stride > 0) {
+                for (j = 0; j < entries; j += change_stride) {
+                    memory[j * entry_size] ^= 1;
+                    if (dirty) {
+                        watcher_mark_dirty(&watcher, (watcher_size_t)j);
+                    }
+                }
+            }
+
+            unsigned long long start = now_ns();
+            watcher_watch_parallel(&watcher, timestamp++, pool);
+            elapsed += now_ns() - start;
+        }
+
+        bench_result_t result = {
+            .name          = pool != NULL ? "watch_parallel" : dirty ? "watch_dirty" : "watch",
+            .entries       = entries,
+            .entry_size    = entry_size,
+            .change_ratio  = change_ratio,
+            .delayed_ratio = delayed_ratio,
+            .iterations    = iterations,
+            .ns_per_entry  = (double)elapsed / (double)(iterations * entries),
+            .ns_per_call   = (double)elapsed / (double)iterations,
+        };
+        print_result(&result);
+    }
+
+    watcher_destroy(&watcher);
+    free(memory);
+}
+
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [--csv|--json]\n", program);
+}
+
+
+int main(int argc, char *argv[]) {
+    int            i = 0;
+    size_t         c = 0, s = 0, d = 0;
+    watcher_pool_t pool;
+    long           cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--json") == 0) {
+            output_format = OUTPUT_JSON;
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            output_format = OUTPUT_CSV;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (watcher_pool_init_pthread(&pool, cpus > 0 ? (size_t)cpus : 1) != WATCHER_RESULT_OK) {
+        fprintf(stderr, "Unable to start the thread pool\n");
+        return 1;
+    }
+
+    print_header();
+
+    for (c = 0; c < ARRAY_LEN(entry_counts); c++) {
+        bench_registration(entry_counts[c]);
+        bench_batch_registration(entry_counts[c]);
+    }
+
+    for (c = 0; c < ARRAY_LEN(entry_counts); c++) {
+        for (s = 0; s < ARRAY_LEN(entry_sizes); s++) {
+            if (entry_counts[c] * entry_sizes[s] > MAX_SCAN_BYTES) {
+                continue;
+            }
+            for (d = 0; d < ARRAY_LEN(delayed_ratios); d++) {
+                bench_scan(entry_counts[c], entry_sizes[s], delayed_ratios[d], 0, NULL);
+                bench_scan(entry_counts[c], entry_sizes[s], delayed_ratios[d], 1, NULL);
+                if (entry_counts[c] >= C_WATCHER_PARALLEL_MIN_ENTRIES) {
+                    bench_scan(entry_counts[c], entry_sizes[s], delayed_ratios[d], 0, &pool);
+                }
+            }
+        }
+    }
+
+    print_footer();
+    watcher_pool_destroy_pthread(&pool);
+
+    return 0;
+}
@@ -0,0 +1,96 @@
+#ifndef C_WATCHER_COMPARE_H_INCLUDED
+#define C_WATCHER_COMPARE_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+
+// Kernel comparing regions of at least 16 bytes, selected at runtime according to the CPU features; only accessed
+// atomically, as it may be replaced while other threads scan
+extern uint8_t (*compare_kernel)(const uint8_t *a, const uint8_t *b, size_t size);
+
+/**
+ * @brief Selects the fastest compare kernel supported by the CPU
+ */
+void compare_init(void);
+
+/**
+ * @brief 64 bit non cryptographic hash of a memory region (XXH64 algorithm)
+ */
+uint64_t region_hash(const void *data, size_t size);
+
+
+// Fixed size loads; memcpy is lowered to a single (possibly unaligned) load
+static inline __attribute__((always_inline)) uint16_t load16(const uint8_t *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline __attribute__((always_inline)) uint32_t load32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline __attribute__((always_inline)) uint64_t load64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+
+/**
+ * @brief Checks whether two memory regions differ. Up to 16 bytes are compared inline with two (overlapping) integer
+ * loads per side; larger regions go through the SIMD kernel.
+ */
+static inline __attribute__((always_inline)) uint8_t region_differs(const void *a, const void *b, size_t size) {
+    const uint8_t *pa = a;
+    const uint8_t *pb = b;
+
+    if (size >= 8) {
+        if (size > 16) {
+            return __atomic_load_n(&compare_kernel, __ATOMIC_RELAXED)(pa, pb, size);
+        }
+        return ((load64(pa) ^ load64(pb)) | (load64(pa + size - 8) ^ load64(pb + size - 8))) != 0;
+    } else if (size >= 4) {
+        return ((load32(pa) ^ load32(pb)) | (load32(pa + size - 4) ^ load32(pb + size - 4))) != 0;
+    } else if (size >= 2) {
+        return ((load16(pa) ^ load16(pb)) | (load16(pa + size - 2) ^ load16(pb + size - 2))) != 0;
+    } else if (size == 1) {
+        return *pa != *pb;
+    } else {
+        return 0;
+    }
+}
+
+
+/**
+ * @brief Copies a memory region, inlining the copy of up to 16 bytes
+ */
+static inline __attribute__((always_inline)) void region_copy(void *destination, const void *source, size_t size) {
+    uint8_t       *pd = destination;
+    const uint8_t *ps = source;
+
+    if (size > 16) {
+        memcpy(pd, ps, size);
+    } else if (size >= 8) {
+        uint64_t head = load64(ps), tail = load64(ps + size - 8);
+        memcpy(pd, &head, 8);
+        memcpy(pd + size - 8, &tail, 8);
+    } else if (size >= 4) {
+        uint32_t head = load32(ps), tail = load32(ps + size - 4);
+        memcpy(pd, &head, 4);
+        memcpy(pd + size - 4, &tail, 4);
+    } else if (size >= 2) {
+        uint16_t head = load16(ps), tail = load16(ps + size - 2);
+        memcpy(pd, &head, 2);
+        memcpy(pd + size - 2, &tail, 2);
+    } else if (size == 1) {
+        *pd = *ps;
+    }
+}
+
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef C_WATCHER_SOFTDIRTY_H_INCLUDED
+#define C_WATCHER_SOFTDIRTY_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include "watcher.h"
+
+
+// Number of pages spanned by a region
+#define SOFTDIRTY_PAGES(page_size, start, size)                                                                        \
+    ((((uintptr_t)(start) + (size)-1) / (page_size)) - ((uintptr_t)(start) / (page_size)) + 1)
+
+
+/**
+ * @brief Opens the kernel interfaces and checks that soft-dirty bits are actually maintained. The backend has a single
+ * owner per process, until softdirty_close.
+ *
+ * @return watcher_result_t WATCHER_RESULT_OK if the backend is available, WATCHER_RESULT_INVALID_ARGS otherwise or
+ * if it is already owned
+ */
+watcher_result_t softdirty_open(watcher_soft_dirty_t *soft_dirty);
+
+/**
+ * @brief Closes the kernel interfaces
+ */
+void softdirty_close(watcher_soft_dirty_t *soft_dirty);
+
+/**
+ * @brief Sets bits `offset` onwards of `bits` for every page of a region written since the last softdirty_clear.
+ * Pages that are not mapped are reported as written, since they may have been dropped.
+ *
+ * @return uint8_t 1 if successful
+ */
+uint8_t softdirty_read(const watcher_soft_dirty_t *soft_dirty, const void *start, size_t size, uint8_t *bits,
+                       size_t offset);
+
+/**
+ * @brief Clears the soft-dirty bits of the whole process
+ *
+ * @return uint8_t 1 if successful
+ */
+uint8_t softdirty_clear(const watcher_soft_dirty_t *soft_dirty);
+
+
+#endif
@@ -5,6 +5,7 @@
 
 
 #define time_after_or_equal(a, b) (((long)((b) - (a)) <= 0))
+#define time_before(a, b)         (((long)((a) - (b)) < 0))
 
 static inline __attribute__((always_inline)) uint8_t is_expired(unsigned long start, unsigned long current,
                                                                 unsigned long delay) {
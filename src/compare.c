@@ -0,0 +1,247 @@
+#include <stdint.h>
+#include <stddef.h>
+#include "_compare.h"
+
+#if !defined(C_WATCHER_DISABLE_SIMD) && defined(__GNUC__) &&                                                         \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define COMPARE_X86
+#include <immintrin.h>
+#elif !defined(C_WATCHER_DISABLE_SIMD) && defined(__aarch64__)
+#define COMPARE_NEON
+#include <arm_neon.h>
+#endif
+
+
+#ifdef COMPARE_X86
+static uint8_t compare_sse2(const uint8_t *a, const uint8_t *b, size_t size);
+static uint8_t compare_avx2(const uint8_t *a, const uint8_t *b, size_t size);
+#endif
+#ifdef COMPARE_NEON
+static uint8_t compare_neon(const uint8_t *a, const uint8_t *b, size_t size);
+#endif
+#if !defined(COMPARE_X86) && !defined(COMPARE_NEON)
+static uint8_t compare_portable(const uint8_t *a, const uint8_t *b, size_t size);
+#endif
+
+
+#if defined(COMPARE_X86)
+uint8_t (*compare_kernel)(const uint8_t *a, const uint8_t *b, size_t size) = compare_sse2;
+#elif defined(COMPARE_NEON)
+uint8_t (*compare_kernel)(const uint8_t *a, const uint8_t *b, size_t size) = compare_neon;
+#else
+uint8_t (*compare_kernel)(const uint8_t *a, const uint8_t *b, size_t size) = compare_portable;
+#endif
+
+
+#ifdef COMPARE_X86
+static uint8_t kernel_selected = 0;
+#endif
+
+
+void compare_init(void) {
+#ifdef COMPARE_X86
+    // Watchers may be initialized from several threads while others scan: only the first call selects the kernel, and
+    // it is published with an atomic store. Until then the others keep using the default one, which is just as correct
+    uint8_t unselected = 0;
+    if (!__atomic_compare_exchange_n(&kernel_selected, &unselected, 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return;
+    }
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        __atomic_store_n(&compare_kernel, compare_avx2, __ATOMIC_RELAXED);
+    }
+#endif
+    // SSE2 and NEON are part of the baseline of their architectures, so the default kernel already uses them
+}
+
+
+#define HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME3 0x165667B19E3779F9ULL
+#define HASH_PRIME4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+
+static inline uint64_t hash_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * HASH_PRIME2;
+    accumulator = ROTL64(accumulator, 31);
+    return accumulator * HASH_PRIME1;
+}
+
+
+static inline uint64_t hash_merge(uint64_t accumulator, uint64_t value) {
+    accumulator ^= hash_round(0, value);
+    return accumulator * HASH_PRIME1 + HASH_PRIME4;
+}
+
+
+uint64_t region_hash(const void *data, size_t size) {
+    const uint8_t *p   = data;
+    const uint8_t *end = p + size;
+    uint64_t       hash;
+
+    if (size >= 32) {
+        // Four independent lanes keep the multipliers busy
+        uint64_t v1 = HASH_PRIME1 + HASH_PRIME2;
+        uint64_t v2 = HASH_PRIME2;
+        uint64_t v3 = 0;
+        uint64_t v4 = -HASH_PRIME1;
+
+        do {
+            v1 = hash_round(v1, load64(p));
+            v2 = hash_round(v2, load64(p + 8));
+            v3 = hash_round(v3, load64(p + 16));
+            v4 = hash_round(v4, load64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        hash = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        hash = hash_merge(hash, v1);
+        hash = hash_merge(hash, v2);
+        hash = hash_merge(hash, v3);
+        hash = hash_merge(hash, v4);
+    } else {
+        hash = HASH_PRIME5;
+    }
+
+    hash += (uint64_t)size;
+
+    for (; p + 8 <= end; p += 8) {
+        hash ^= hash_round(0, load64(p));
+        hash = ROTL64(hash, 27) * HASH_PRIME1 + HASH_PRIME4;
+    }
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)load32(p) * HASH_PRIME1;
+        hash = ROTL64(hash, 23) * HASH_PRIME2 + HASH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= (*p) * HASH_PRIME5;
+        hash = ROTL64(hash, 11) * HASH_PRIME1;
+    }
+
+    // Final avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+
+#if !defined(COMPARE_X86) && !defined(COMPARE_NEON)
+// Word at a time compare, used when no SIMD instruction set is available
+static uint8_t compare_portable(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+
+    for (i = 0; i + 32 <= size; i += 32) {
+        uint64_t diff = (load64(&a[i]) ^ load64(&b[i])) | (load64(&a[i + 8]) ^ load64(&b[i + 8])) |
+                        (load64(&a[i + 16]) ^ load64(&b[i + 16])) | (load64(&a[i + 24]) ^ load64(&b[i + 24]));
+        if (diff) {
+            return 1;
+        }
+    }
+    for (; i + 8 <= size; i += 8) {
+        if (load64(&a[i]) != load64(&b[i])) {
+            return 1;
+        }
+    }
+    // The last word overlaps with the previous ones; size is at least 16
+    return load64(&a[size - 8]) != load64(&b[size - 8]);
+}
+#endif
+
+
+#ifdef COMPARE_X86
+static uint8_t compare_sse2(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+
+    for (i = 0; i + 64 <= size; i += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[i]), _mm_loadu_si128((const __m128i *)&b[i]));
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[i + 16]),
+                                     _mm_loadu_si128((const __m128i *)&b[i + 16]));
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[i + 32]),
+                                     _mm_loadu_si128((const __m128i *)&b[i + 32]));
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[i + 48]),
+                                     _mm_loadu_si128((const __m128i *)&b[i + 48]));
+        __m128i eq  = _mm_and_si128(_mm_and_si128(eq0, eq1), _mm_and_si128(eq2, eq3));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            return 1;
+        }
+    }
+    for (; i + 16 <= size; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[i]), _mm_loadu_si128((const __m128i *)&b[i]));
+        if (_mm_movemask_epi8(eq) != 0xFFFF) {
+            return 1;
+        }
+    }
+    if (i < size) {
+        // Overlapping tail; size is at least 16
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&a[size - 16]),
+                                    _mm_loadu_si128((const __m128i *)&b[size - 16]));
+        return _mm_movemask_epi8(eq) != 0xFFFF;
+    }
+    return 0;
+}
+
+
+__attribute__((target("avx2"))) static uint8_t compare_avx2(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+
+    if (size < 32) {
+        return compare_sse2(a, b, size);
+    }
+
+    for (i = 0; i + 64 <= size; i += 64) {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&a[i]),
+                                        _mm256_loadu_si256((const __m256i *)&b[i]));
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&a[i + 32]),
+                                        _mm256_loadu_si256((const __m256i *)&b[i + 32]));
+        if ((uint32_t)_mm256_movemask_epi8(_mm256_and_si256(eq0, eq1)) != 0xFFFFFFFFU) {
+            return 1;
+        }
+    }
+    for (; i + 32 <= size; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&a[i]),
+                                       _mm256_loadu_si256((const __m256i *)&b[i]));
+        if ((uint32_t)_mm256_movemask_epi8(eq) != 0xFFFFFFFFU) {
+            return 1;
+        }
+    }
+    if (i < size) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&a[size - 32]),
+                                       _mm256_loadu_si256((const __m256i *)&b[size - 32]));
+        return (uint32_t)_mm256_movemask_epi8(eq) != 0xFFFFFFFFU;
+    }
+    return 0;
+}
+#endif
+
+
+#ifdef COMPARE_NEON
+static uint8_t compare_neon(const uint8_t *a, const uint8_t *b, size_t size) {
+    size_t i = 0;
+
+    for (i = 0; i + 64 <= size; i += 64) {
+        uint8x16_t eq = vandq_u8(vandq_u8(vceqq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i])),
+                                          vceqq_u8(vld1q_u8(&a[i + 16]), vld1q_u8(&b[i + 16]))),
+                                 vandq_u8(vceqq_u8(vld1q_u8(&a[i + 32]), vld1q_u8(&b[i + 32])),
+                                          vceqq_u8(vld1q_u8(&a[i + 48]), vld1q_u8(&b[i + 48]))));
+        if (vminvq_u8(eq) != 0xFF) {
+            return 1;
+        }
+    }
+    for (; i + 16 <= size; i += 16) {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i]))) != 0xFF) {
+            return 1;
+        }
+    }
+    if (i < size) {
+        return vminvq_u8(vceqq_u8(vld1q_u8(&a[size - 16]), vld1q_u8(&b[size - 16]))) != 0xFF;
+    }
+    return 0;
+}
+#endif
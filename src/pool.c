@@ -0,0 +1,149 @@
+#include "watcher.h"
+
+#ifndef C_WATCHER_NO_PTHREAD
+#include <pthread.h>
+
+
+struct watcher_pthread_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t  start;     // Signaled when a batch of tasks is available
+    pthread_cond_t  done;      // Signaled when the last task of a batch completes
+
+    watcher_task_t task;
+    void          *context;
+    size_t         tasks;       // Tasks in the current batch, 0 when idle
+    size_t         next;        // Next task to hand out
+    size_t         pending;     // Tasks handed out or not, that did not complete yet
+    uint8_t        stop;
+
+    size_t    threads;
+    pthread_t workers[];
+};
+
+
+static void  pool_run(void *pool, watcher_task_t task, void *context, size_t tasks);
+static void *pool_worker(void *arg);
+static void  pool_stop(struct watcher_pthread_pool *pool, size_t started);
+
+
+watcher_result_t watcher_pool_init_pthread(watcher_pool_t *pool, size_t threads) {
+    if (pool == NULL || threads == 0) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    struct watcher_pthread_pool *pthread_pool =
+        malloc(sizeof(struct watcher_pthread_pool) + (threads - 1) * sizeof(pthread_t));
+    if (pthread_pool == NULL) {
+        return WATCHER_RESULT_ALLOC_ERROR;
+    }
+
+    pthread_mutex_init(&pthread_pool->lock, NULL);
+    pthread_cond_init(&pthread_pool->start, NULL);
+    pthread_cond_init(&pthread_pool->done, NULL);
+    pthread_pool->task    = NULL;
+    pthread_pool->context = NULL;
+    pthread_pool->tasks   = 0;
+    pthread_pool->next    = 0;
+    pthread_pool->pending = 0;
+    pthread_pool->stop    = 0;
+    pthread_pool->threads = threads - 1;
+
+    size_t i = 0;
+    for (i = 0; i < pthread_pool->threads; i++) {
+        if (pthread_create(&pthread_pool->workers[i], NULL, pool_worker, pthread_pool) != 0) {
+            pool_stop(pthread_pool, i);
+            return WATCHER_RESULT_ALLOC_ERROR;
+        }
+    }
+
+    pool->run     = pool_run;
+    pool->pool    = pthread_pool;
+    pool->workers = threads;
+    return WATCHER_RESULT_OK;
+}
+
+
+void watcher_pool_destroy_pthread(watcher_pool_t *pool) {
+    struct watcher_pthread_pool *pthread_pool = pool->pool;
+    if (pthread_pool != NULL) {
+        pool_stop(pthread_pool, pthread_pool->threads);
+    }
+    pool->pool = NULL;
+}
+
+
+static void pool_run(void *pool, watcher_task_t task, void *context, size_t tasks) {
+    struct watcher_pthread_pool *pthread_pool = pool;
+
+    pthread_mutex_lock(&pthread_pool->lock);
+    pthread_pool->task    = task;
+    pthread_pool->context = context;
+    pthread_pool->tasks   = tasks;
+    pthread_pool->next    = 0;
+    pthread_pool->pending = tasks;
+    pthread_cond_broadcast(&pthread_pool->start);
+
+    // The calling thread takes tasks too instead of just waiting
+    while (pthread_pool->next < pthread_pool->tasks) {
+        size_t task_index = pthread_pool->next++;
+        pthread_mutex_unlock(&pthread_pool->lock);
+        task(context, task_index);
+        pthread_mutex_lock(&pthread_pool->lock);
+        pthread_pool->pending--;
+    }
+    while (pthread_pool->pending > 0) {
+        pthread_cond_wait(&pthread_pool->done, &pthread_pool->lock);
+    }
+
+    pthread_pool->tasks = 0;
+    pthread_pool->next  = 0;
+    pthread_mutex_unlock(&pthread_pool->lock);
+}
+
+
+static void *pool_worker(void *arg) {
+    struct watcher_pthread_pool *pthread_pool = arg;
+
+    pthread_mutex_lock(&pthread_pool->lock);
+    for (;;) {
+        while (!pthread_pool->stop && pthread_pool->next >= pthread_pool->tasks) {
+            pthread_cond_wait(&pthread_pool->start, &pthread_pool->lock);
+        }
+        if (pthread_pool->stop) {
+            break;
+        }
+
+        size_t task_index = pthread_pool->next++;
+        pthread_mutex_unlock(&pthread_pool->lock);
+        pthread_pool->task(pthread_pool->context, task_index);
+        pthread_mutex_lock(&pthread_pool->lock);
+
+        if (--pthread_pool->pending == 0) {
+            pthread_cond_signal(&pthread_pool->done);
+        }
+    }
+    pthread_mutex_unlock(&pthread_pool->lock);
+
+    return NULL;
+}
+
+
+static void pool_stop(struct watcher_pthread_pool *pool, size_t started) {
+    size_t i = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < started; i++) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+#endif
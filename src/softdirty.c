@@ -0,0 +1,144 @@
+// pread and O_CLOEXEC
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stddef.h>
+#include "_softdirty.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+
+#define PAGEMAP_SOFT_DIRTY (1ULL << 55)
+#define PAGEMAP_SWAPPED    (1ULL << 62)
+#define PAGEMAP_PRESENT    (1ULL << 63)
+
+// Pagemap entries read per system call
+#define PAGEMAP_CHUNK 512
+
+
+// Written by the availability check
+static volatile uint8_t probe = 0;
+
+// Soft-dirty bits are cleared for the whole process, so only one watcher at a time may rely on them
+static uint8_t owned = 0;
+
+
+watcher_result_t softdirty_open(watcher_soft_dirty_t *soft_dirty) {
+    long    page_size = sysconf(_SC_PAGESIZE);
+    uint8_t unowned   = 0;
+
+    soft_dirty->pagemap    = -1;
+    soft_dirty->clear_refs = -1;
+    if (!__atomic_compare_exchange_n(&owned, &unowned, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    soft_dirty->owner = 1;
+
+    soft_dirty->pagemap    = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    soft_dirty->clear_refs = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    soft_dirty->page_size  = page_size > 0 ? (size_t)page_size : 4096;
+    if (soft_dirty->pagemap < 0 || soft_dirty->clear_refs < 0) {
+        softdirty_close(soft_dirty);
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    // Kernels built without CONFIG_MEM_SOFT_DIRTY accept the interfaces but never set the bit
+    uint8_t bit = 0;
+    probe       = 1;
+    if (!softdirty_clear(soft_dirty)) {
+        softdirty_close(soft_dirty);
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    probe = 2;
+    if (!softdirty_read(soft_dirty, (const void *)&probe, 1, &bit, 0) || bit == 0) {
+        softdirty_close(soft_dirty);
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    return WATCHER_RESULT_OK;
+}
+
+
+void softdirty_close(watcher_soft_dirty_t *soft_dirty) {
+    if (soft_dirty->pagemap >= 0) {
+        close(soft_dirty->pagemap);
+    }
+    if (soft_dirty->clear_refs >= 0) {
+        close(soft_dirty->clear_refs);
+    }
+    soft_dirty->pagemap    = -1;
+    soft_dirty->clear_refs = -1;
+    if (soft_dirty->owner) {
+        soft_dirty->owner = 0;
+        __atomic_store_n(&owned, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+uint8_t softdirty_read(const watcher_soft_dirty_t *soft_dirty, const void *start, size_t size, uint8_t *bits,
+                       size_t offset) {
+    uint64_t entries[PAGEMAP_CHUNK];
+    size_t   first = (uintptr_t)start / soft_dirty->page_size;
+    size_t   pages = SOFTDIRTY_PAGES(soft_dirty->page_size, start, size);
+    size_t   done  = 0;
+
+    while (done < pages) {
+        size_t  chunk = pages - done < PAGEMAP_CHUNK ? pages - done : PAGEMAP_CHUNK;
+        ssize_t read  = pread(soft_dirty->pagemap, entries, chunk * sizeof(uint64_t),
+                              (off_t)((first + done) * sizeof(uint64_t)));
+        if (read != (ssize_t)(chunk * sizeof(uint64_t))) {
+            return 0;
+        }
+
+        size_t i = 0;
+        for (i = 0; i < chunk; i++) {
+            uint64_t entry = entries[i];
+            if ((entry & PAGEMAP_SOFT_DIRTY) || !(entry & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED))) {
+                size_t bit = offset + done + i;
+                bits[bit / 8] |= (uint8_t)(1 << (bit % 8));
+            }
+        }
+        done += chunk;
+    }
+
+    return 1;
+}
+
+
+uint8_t softdirty_clear(const watcher_soft_dirty_t *soft_dirty) {
+    // 4 clears the soft-dirty bits of every page of the process
+    return write(soft_dirty->clear_refs, "4", 1) == 1;
+}
+
+#else
+
+watcher_result_t softdirty_open(watcher_soft_dirty_t *soft_dirty) {
+    soft_dirty->pagemap    = -1;
+    soft_dirty->clear_refs = -1;
+    return WATCHER_RESULT_INVALID_ARGS;
+}
+
+
+void softdirty_close(watcher_soft_dirty_t *soft_dirty) {
+    (void)soft_dirty;
+}
+
+
+uint8_t softdirty_read(const watcher_soft_dirty_t *soft_dirty, const void *start, size_t size, uint8_t *bits,
+                       size_t offset) {
+    (void)soft_dirty;
+    (void)start;
+    (void)size;
+    (void)bits;
+    (void)offset;
+    return 0;
+}
+
+
+uint8_t softdirty_clear(const watcher_soft_dirty_t *soft_dirty) {
+    (void)soft_dirty;
+    return 0;
+}
+
+#endif
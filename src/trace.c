@@ -0,0 +1,203 @@
+#include "watcher.h"
+
+#ifdef C_WATCHER_TRACE
+#include <stdio.h>
+#include <string.h>
+
+
+// Longest JSON object written for a single record
+#define RECORD_TEXT_SIZE 192
+
+
+static unsigned long recorder_scan_begin(void *context, unsigned long timestamp);
+static void          recorder_scan_end(void *context, unsigned long timestamp, watcher_size_t count,
+                                       unsigned long token);
+static unsigned long recorder_dispatch_begin(void *context, const watcher_trace_dispatch_t *dispatch);
+static void          recorder_dispatch_end(void *context, const watcher_trace_dispatch_t *dispatch,
+                                           unsigned long token);
+static void          recorder_push(watcher_trace_recorder_t *recorder, const watcher_trace_record_t *record);
+static void          histogram_add(watcher_histogram_t *histogram, unsigned long value);
+static size_t        emit(void (*write)(void *arg, const char *text, size_t length), void *arg, const char *text,
+                          size_t length);
+
+
+void watcher_trace_recorder_init(watcher_trace_recorder_t *recorder, watcher_histogram_t *histograms,
+                                 watcher_size_t num_histograms, watcher_trace_record_t *records, size_t capacity,
+                                 unsigned long (*clock)(void *arg), void *clock_arg) {
+    recorder->clock         = clock;
+    recorder->clock_arg     = clock_arg;
+    recorder->callbacks     = histograms;
+    recorder->num_callbacks = histograms != NULL ? num_histograms : 0;
+    recorder->records       = records;
+    recorder->capacity      = records != NULL ? capacity : 0;
+    recorder->head          = 0;
+
+    if (recorder->num_callbacks > 0) {
+        memset(histograms, 0, recorder->num_callbacks * sizeof(watcher_histogram_t));
+    }
+    memset(&recorder->scans, 0, sizeof(recorder->scans));
+    memset(&recorder->debounce, 0, sizeof(recorder->debounce));
+}
+
+
+void watcher_trace_recorder_hooks(watcher_trace_recorder_t *recorder, watcher_trace_hooks_t *hooks) {
+    hooks->scan_begin     = recorder_scan_begin;
+    hooks->scan_end       = recorder_scan_end;
+    hooks->dispatch_begin = recorder_dispatch_begin;
+    hooks->dispatch_end   = recorder_dispatch_end;
+    hooks->context        = recorder;
+}
+
+
+unsigned long watcher_histogram_percentile(const watcher_histogram_t *histogram, unsigned percent) {
+    size_t b = 0;
+
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    // Rank of the value, counted from 1
+    unsigned long long rank = ((unsigned long long)histogram->count * (percent > 100 ? 100 : percent) + 99) / 100;
+    unsigned long long seen = 0;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (b = 0; b < WATCHER_HISTOGRAM_BUCKETS; b++) {
+        seen += histogram->buckets[b];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    // The top of the bucket, but never more than was actually seen
+    unsigned long top = b == 0 ? 0 : (unsigned long)((2UL << (b - 1)) - 1);
+    if (b == WATCHER_HISTOGRAM_BUCKETS - 1 || top > histogram->max) {
+        top = histogram->max;
+    }
+    return top;
+}
+
+
+size_t watcher_trace_export_chrome(const watcher_trace_recorder_t *recorder,
+                                   void (*write)(void *arg, const char *text, size_t length), void *arg) {
+    static const char header[] = "{\"traceEvents\":[";
+    static const char footer[] = "]}\n";
+    char              text[RECORD_TEXT_SIZE];
+    size_t            written = 0;
+    size_t            i       = 0;
+
+    // Once the ring wrapped around the oldest record is the one about to be overwritten
+    size_t num   = recorder->head < recorder->capacity ? recorder->head : recorder->capacity;
+    size_t first = recorder->head - num;
+
+    written += emit(write, arg, header, sizeof(header) - 1);
+    for (i = 0; i < num; i++) {
+        const watcher_trace_record_t *record = &recorder->records[(first + i) % recorder->capacity];
+        const char                   *comma  = i > 0 ? "," : "";
+        int                           length = 0;
+
+        if (record->callback == WATCHER_TRACE_SCAN) {
+            length = snprintf(text, sizeof(text),
+                              "%s{\"name\":\"scan\",\"cat\":\"scan\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,"
+                              "\"tid\":1,\"args\":{\"callbacks\":%u}}",
+                              comma, record->start, record->duration, (unsigned)record->index);
+        } else {
+            length = snprintf(text, sizeof(text),
+                              "%s{\"name\":\"callback %u\",\"cat\":\"callback\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+                              "\"pid\":1,\"tid\":1,\"args\":{\"entry\":%u,\"delay\":%lu}}",
+                              comma, (unsigned)record->callback, record->start, record->duration,
+                              (unsigned)record->index, record->delay);
+        }
+        if (length > 0) {
+            written += emit(write, arg, text, (size_t)length < sizeof(text) ? (size_t)length : sizeof(text) - 1);
+        }
+    }
+    written += emit(write, arg, footer, sizeof(footer) - 1);
+
+    return written;
+}
+
+
+static unsigned long recorder_scan_begin(void *context, unsigned long timestamp) {
+    watcher_trace_recorder_t *recorder = context;
+    (void)timestamp;
+    return recorder->clock(recorder->clock_arg);
+}
+
+
+static void recorder_scan_end(void *context, unsigned long timestamp, watcher_size_t count, unsigned long token) {
+    watcher_trace_recorder_t *recorder = context;
+    watcher_trace_record_t    record   = {
+        .start    = token,
+        .duration = recorder->clock(recorder->clock_arg) - token,
+        .delay    = 0,
+        .index    = count,
+        .callback = WATCHER_TRACE_SCAN,
+    };
+    (void)timestamp;
+
+    histogram_add(&recorder->scans, record.duration);
+    recorder_push(recorder, &record);
+}
+
+
+static unsigned long recorder_dispatch_begin(void *context, const watcher_trace_dispatch_t *dispatch) {
+    watcher_trace_recorder_t *recorder = context;
+    (void)dispatch;
+    return recorder->clock(recorder->clock_arg);
+}
+
+
+static void recorder_dispatch_end(void *context, const watcher_trace_dispatch_t *dispatch, unsigned long token) {
+    watcher_trace_recorder_t *recorder = context;
+    watcher_trace_record_t    record   = {
+        .start    = token,
+        .duration = recorder->clock(recorder->clock_arg) - token,
+        .delay    = dispatch->timestamp - dispatch->changed,
+        .index    = dispatch->entry_index,
+        .callback = dispatch->callback_index,
+    };
+
+    if (dispatch->callback_index < recorder->num_callbacks) {
+        histogram_add(&recorder->callbacks[dispatch->callback_index], record.duration);
+    }
+    if (dispatch->debounced) {
+        histogram_add(&recorder->debounce, record.delay);
+    }
+    recorder_push(recorder, &record);
+}
+
+
+static void recorder_push(watcher_trace_recorder_t *recorder, const watcher_trace_record_t *record) {
+    if (recorder->capacity > 0) {
+        recorder->records[recorder->head % recorder->capacity] = *record;
+        recorder->head++;
+    }
+}
+
+
+static void histogram_add(watcher_histogram_t *histogram, unsigned long value) {
+    size_t        bucket = 0;
+    unsigned long rest   = value;
+
+    // One more than the position of the highest set bit
+    while (rest != 0) {
+        rest >>= 1;
+        bucket++;
+    }
+
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+
+static size_t emit(void (*write)(void *arg, const char *text, size_t length), void *arg, const char *text,
+                   size_t length) {
+    write(arg, text, length);
+    return length;
+}
+#endif
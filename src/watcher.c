@@ -1,6 +1,11 @@
 #include <string.h>
 #include "watcher.h"
 #include "_timecheck.h"
+#include "_compare.h"
+#include "_softdirty.h"
+#ifdef C_WATCHER_STATS
+#include <time.h>
+#endif
 
 
 #define VECTOR_INIT(name)                                                                                              \
@@ -17,17 +22,20 @@
         name.capacity = cap;                                                                                           \
     }
 
-#define VECTOR_GROW(name)                                                                                              \
+#define VECTOR_GROW_TO(name, new_capacity)                                                                             \
     {                                                                                                                  \
-        void *new_entries = watcher->fn_realloc(name.items, (name.capacity + 1) * sizeof(name.items[0]));              \
+        watcher_size_t target_capacity = new_capacity;                                                                 \
+        void *new_entries = reallocate(watcher, name.items, (size_t)target_capacity * sizeof(name.items[0]));          \
         if (new_entries != NULL) {                                                                                     \
-            name.items = new_entries;                                                                                  \
-            name.capacity++;                                                                                           \
+            name.items    = new_entries;                                                                               \
+            name.capacity = target_capacity;                                                                           \
         } else {                                                                                                       \
             return WATCHER_RESULT_ALLOC_ERROR;                                                                         \
         }                                                                                                              \
     }
 
+#define VECTOR_GROW(name) VECTOR_GROW_TO(name, next_capacity(name.capacity))
+
 #define VECTOR_APPEND(name, item)                                                                                      \
     {                                                                                                                  \
         if (!VECTOR_FULL(name)) {                                                                                      \
@@ -45,10 +53,225 @@
         }                                                                                                              \
     }
 
+#define RESERVE_OR_FAIL(field, required)                                                                               \
+    if (watcher->field.capacity < (required)) {                                                                        \
+        if (watcher->fn_realloc != NULL && (required) <= C_WATCHER_MAX_ENTRIES) {                                      \
+            VECTOR_GROW_TO(watcher->field, (watcher_size_t)(required));                                                \
+        } else {                                                                                                       \
+            return WATCHER_RESULT_STATIC_OVERFLOW;                                                                     \
+        }                                                                                                              \
+    }
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+#define INDEX_INIT(index)                                                                                              \
+    {                                                                                                                  \
+        index.slots    = NULL;                                                                                         \
+        index.capacity = 0;                                                                                            \
+    }
+
+// Empty index slots hold 0, occupied ones the position of the item in its vector plus one
+#define INDEX_EMPTY_SLOT 0
+
+#define WATCHER_INDEX(field) (&watcher->field)
+#else
+#define WATCHER_INDEX(field) ((watcher_index_t *)NULL)
+#endif
+
+#define ALIGN_UP(value, alignment) (((value) + (alignment)-1) / (alignment) * (alignment))
+
+#define ARENA_INIT(arena)                                                                                              \
+    {                                                                                                                  \
+        arena.slabs    = NULL;                                                                                         \
+        arena.memory   = NULL;                                                                                         \
+        arena.used     = 0;                                                                                            \
+        arena.capacity = 0;                                                                                            \
+    }
+
+#define SOFT_DIRTY_INIT(soft_dirty)                                                                                    \
+    {                                                                                                                  \
+        soft_dirty.pagemap    = -1;                                                                                    \
+        soft_dirty.clear_refs = -1;                                                                                    \
+        soft_dirty.page_size  = 0;                                                                                     \
+        soft_dirty.pages      = NULL;                                                                                  \
+        soft_dirty.capacity   = 0;                                                                                     \
+        soft_dirty.entries    = 0;                                                                                     \
+        soft_dirty.resync     = 0;                                                                                     \
+        soft_dirty.owner      = 0;                                                                                     \
+    }
+
+#define EVENT_QUEUE_INIT(queue)                                                                                        \
+    {                                                                                                                  \
+        queue.events    = NULL;                                                                                        \
+        queue.slots     = NULL;                                                                                        \
+        queue.capacity  = 0;                                                                                           \
+        queue.slot_size = 0;                                                                                           \
+        queue.head      = 0;                                                                                           \
+        queue.tail      = 0;                                                                                           \
+    }
+
 #define VECTOR_FULL(name)               (name.num == name.capacity)
-#define VECTOR_AT_MAX_CAPACITY(name)    (name.capacity == C_WATCHER_MAX_ENTRIES)
-#define FITS_IN_POINTER(size)           ((size) < sizeof(void *))
-#define ENTRY_GET_OLD_BUFFER_POINTER(e) (FITS_IN_POINTER((e).size) ? &(e).old_buffer : (e).old_buffer)
+#define VECTOR_AT_MAX_CAPACITY(name)    (name.capacity >= C_WATCHER_MAX_ENTRIES)
+#define FITS_INLINE(size)               ((size) <= WATCHER_INLINE_SIZE)
+#define ENTRY_GET_OLD_BUFFER_POINTER(w, e)                                                                             \
+    (FITS_INLINE((e).size) ? (void *)&(e).old_buffer : ENTRY_OLD_BUFFER(w, e))
+#define ENTRY_IS_DEBOUNCED(e)           ((e).debouncer_index != WATCHER_NO_DEBOUNCER)
+#define ENTRY_IS_BATCHED(e)             ((e).flags & ENTRY_FLAG_BATCHED)
+#define ENTRY_IS_REMOVED(e)             ((e).flags & ENTRY_FLAG_REMOVED)
+#define ENTRY_IS_DIFF(e)                ((e).flags & ENTRY_FLAG_DIFF)
+// A pending batched change keeps the old value until the batched callback is done with it, and an entry removed by a
+// callback is only dropped once it returns; neither is reported again meanwhile
+#define ENTRY_IS_SKIPPED(e) ((e).flags & (ENTRY_FLAG_QUEUED | ENTRY_FLAG_REMOVED))
+#ifdef C_WATCHER_CONCURRENT
+#define ENTRY_IS_SEQLOCKED(e) ((e).seqlock != NULL)
+#else
+#define ENTRY_IS_SEQLOCKED(e) 0
+#endif
+// Large entries are left to the soft-dirty pass while watcher_watch holds a snapshot of the written pages; entries
+// written concurrently are always polled, as pages could be read halfway through a write
+#define ENTRY_IS_LARGE(e) ((e).size >= C_WATCHER_SOFT_DIRTY_MIN_SIZE && !ENTRY_IS_SEQLOCKED(e))
+#define ENTRY_IS_SOFT_DIRTY(w, index, e) ((index) < (w)->soft_dirty.entries && ENTRY_IS_LARGE(e))
+#define PAGE_IS_WRITTEN(w, page) ((w)->soft_dirty.pages[(page) / 8] & (1 << ((page) % 8)))
+
+// Watched memory and old value buffers, which compact entries hold as offsets
+#ifdef C_WATCHER_COMPACT_ENTRIES
+#define ENTRY_WATCHED(w, e)             ((const void *)((w)->base + (e).watched))
+#define ENTRY_OLD_BUFFER(w, e)          ((void *)((w)->shadow.memory + (e).old_buffer))
+#define ENTRY_SET_OLD_BUFFER(w, e, buf)                                                                                \
+    ((e).old_buffer = (buf) != NULL ? (uint32_t)((uint8_t *)(buf) - (w)->shadow.memory) : 0)
+// The old value buffers are offsets into a single region, which is moved as a whole when it grows
+#define SHADOW_SINGLE_REGION 1
+#define SHADOW_OWNS(w, buf)                                                                                            \
+    ((w)->shadow.memory != NULL && (uint8_t *)(buf) >= (w)->shadow.memory &&                                           \
+     (uint8_t *)(buf) < (w)->shadow.memory + (w)->shadow.capacity)
+#else
+#define ENTRY_WATCHED(w, e)             ((void)(w), (e).watched)
+#define ENTRY_OLD_BUFFER(w, e)          ((void)(w), (e).old_buffer)
+#define ENTRY_SET_OLD_BUFFER(w, e, buf) ((e).old_buffer = (buf))
+#define SHADOW_SINGLE_REGION            0
+#endif
+
+// Value of the watched field for some memory, which the pointers index hashes
+#ifdef C_WATCHER_COMPACT_ENTRIES
+typedef uint32_t watched_key_t;
+#define WATCHED_KEY(w, pointer) ((uint32_t)((const uint8_t *)(pointer) - (w)->base))
+// Whether size bytes from pointer lie in the base region
+#define WATCHED_IN_BASE(w, pointer, size)                                                                              \
+    ((w)->base != NULL && (const uint8_t *)(pointer) >= (w)->base &&                                                   \
+     (size_t)((const uint8_t *)(pointer) - (w)->base) <= (w)->base_size &&                                             \
+     (w)->base_size - (size_t)((const uint8_t *)(pointer) - (w)->base) >= (size))
+#else
+typedef const void *watched_key_t;
+#define WATCHED_KEY(w, pointer)           (pointer)
+#define WATCHED_IN_BASE(w, pointer, size) 1
+#endif
+#define WATCHED_KEY_SIZE sizeof(watched_key_t)
+
+// Highest callback and arg index an entry can hold
+#define CALLBACK_INDEX_MAX ((size_t)(watcher_callback_index_t)~(watcher_callback_index_t)0)
+
+// Whether a vector of num callbacks or args has no index left for another one
+static inline uint8_t callback_index_full(size_t num) {
+    return num > CALLBACK_INDEX_MAX;
+}
+
+#define ENTRY_FLAG_BATCHED 0x01
+#define ENTRY_FLAG_QUEUED  0x02
+#define ENTRY_FLAG_REMOVED 0x04
+#define ENTRY_FLAG_SHADOW  0x08     // The old value buffer was carved from the shadow arena
+#define ENTRY_FLAG_DIFF    0x10
+
+#define HANDLE_INDEX_BITS             16
+#define HANDLE_MAKE(slot, generation) (((watcher_handle_t)(generation) << HANDLE_INDEX_BITS) | (watcher_handle_t)(slot))
+#define HANDLE_SLOT(handle)           ((size_t)((handle) & (((watcher_handle_t)1 << HANDLE_INDEX_BITS) - 1)))
+#define HANDLE_GENERATION(handle)     ((uint16_t)((handle) >> HANDLE_INDEX_BITS))
+
+// Shrinks a dynamically allocated vector to its content
+#define VECTOR_SHRINK(name)                                                                                            \
+    if (name.num > 0 && name.num < name.capacity) {                                                                    \
+        VECTOR_GROW_TO(name, name.num);                                                                                \
+    }
+
+// Items no reference points to are marked in the remap array
+#define RECLAIM_UNUSED ((watcher_size_t)~(watcher_size_t)0)
+
+// Batched callbacks are stored among the others; going through void (*)(void) marks the conversion as intended
+#define AS_CALLBACK(batch_callback) ((watcher_callback_t)(void (*)(void))(batch_callback))
+#define AS_BATCH_CALLBACK(callback) ((watcher_batch_callback_t)(void (*)(void))(callback))
+#define AS_DIFF_CALLBACK(callback)  ((watcher_diff_callback_t)(void (*)(void))(callback))
+
+// Bytes of a diff entry compared at once (rounded to whole elements) before looking for the changed elements
+#define DIFF_BLOCK 64
+
+#define TIER_BIT(tier) ((uint32_t)1 << (tier))
+// First entry of a tier; past the last tier, first entry waiting to be placed
+#define TIER_START(tier) ((tier) > 0 ? watcher->tiers[(tier)-1].end : 0)
+
+// Entries compared by watcher_watch_budget between two readings of the clock
+#define BUDGET_CLOCK_INTERVAL 32
+
+// Consecutive batched events delivered by a single call of watcher_drain_events
+#define DRAIN_BATCH 16
+
+#define HASH_SIZE            sizeof(uint64_t)
+#define HASH_FITS_INLINE     (WATCHER_INLINE_SIZE >= HASH_SIZE)
+
+#ifdef C_WATCHER_STATS
+#define STATS_ADD(counter, value) ((counter) += (value))
+// Runs a callback invocation, adding the time it took to counter (evaluated afterwards, as entries may have moved)
+#define STATS_TIMED(counter, call)                                                                                     \
+    {                                                                                                                  \
+        unsigned long stats_start = C_WATCHER_STATS_CLOCK();                                                           \
+        call;                                                                                                          \
+        STATS_ADD(counter, C_WATCHER_STATS_CLOCK() - stats_start);                                                     \
+    }
+#else
+#define STATS_ADD(counter, value) ((void)0)
+#define STATS_TIMED(counter, call)                                                                                     \
+    { call; }
+#endif
+
+#ifdef C_WATCHER_TRACE
+// Runs a callback invocation between the dispatch trace hooks
+#define TRACED(entry_index, changes, call)                                                                             \
+    {                                                                                                                  \
+        watcher_trace_dispatch_t trace_dispatch;                                                                       \
+        unsigned long            trace_token = trace_dispatch_begin(watcher, &trace_dispatch, entry_index, changes);   \
+        call;                                                                                                          \
+        if (watcher->trace.dispatch_end != NULL) {                                                                     \
+            watcher->trace.dispatch_end(watcher->trace.context, &trace_dispatch, trace_token);                         \
+        }                                                                                                              \
+    }
+#else
+#define TRACED(entry_index, changes, call)                                                                             \
+    { call; }
+#endif
+
+#define DIRTY_WORD(index) ((index) / 32)
+#define DIRTY_BIT(index)  ((uint32_t)1 << ((index) % 32))
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOWEST_SET_BIT(word) ((unsigned)__builtin_ctz(word))
+#else
+#define LOWEST_SET_BIT(word) lowest_set_bit(word)
+#endif
+
+// The event queue counters are shared by the watching thread and the consumer
+#if defined(__GNUC__) || defined(__clang__)
+#define LOAD_ACQUIRE(value)         __atomic_load_n(&(value), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(value, store) __atomic_store_n(&(value), store, __ATOMIC_RELEASE)
+#else
+// Without atomics the queue can only be drained by the watching thread
+#define LOAD_ACQUIRE(value)         (value)
+#define STORE_RELEASE(value, store) ((value) = (store))
+#endif
+
+
+// Dynamically allocated block of shadow memory; slabs are chained so they can be released together
+struct watcher_shadow_slab {
+    struct watcher_shadow_slab *next;
+    size_t                      capacity;     // Usable bytes of memory, past the alignment padding
+    uint8_t                     memory[];
+};
 
 
 typedef enum {
@@ -58,14 +281,123 @@ typedef enum {
 } trigger_state_t;
 
 
+typedef enum {
+    DISPATCH_FAILED = 0,     // The change could not be reported, the entry has to be checked again
+    DISPATCH_DONE,           // The old value can be updated
+    DISPATCH_DEFERRED,       // Batched change, the old value is updated once the batched callback returns
+    DISPATCH_UPDATED,        // Diff change, the changed spans of the old value were updated already
+} dispatch_result_t;
+
+
+// Entries compared by each task of watcher_watch_parallel
+typedef struct {
+    watcher_t *watcher;
+    size_t     chunk;
+    uint32_t   due;     // Tiers to compare
+} compare_context_t;
+
+
 static watcher_result_t add_callback(watcher_t *watcher, watcher_callback_t callback, watcher_size_t *callback_index);
 static watcher_result_t add_arg(watcher_t *watcher, void *arg, watcher_size_t *arg_index);
-static watcher_result_t add_entry_static(watcher_t *watcher, const void *pointer, watcher_size_t size,
-                                         watcher_callback_t callback, void *arg, void *old_buffer, unsigned long delay);
-static void debouncer_callback(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr, void *arg);
-static uint8_t is_debounced(watcher_t *watcher, watcher_size_t entry_index);
-static void    trigger_debouncer_entry(watcher_t *watcher, watcher_size_t entry_index, watcher_debouncer_t *pdebouncer);
-static void    trigger_entry(watcher_t *watcher, int16_t entry_index);
+static watcher_result_t add_delay(watcher_t *watcher, unsigned long delay, watcher_size_t *delay_index);
+static uint8_t          lookup(const watcher_index_t *index, const void *items, watcher_size_t num, size_t item_size,
+                               const void *key, watcher_size_t *position);
+static void             index_insert(watcher_t *watcher, watcher_index_t *index, const void *items, watcher_size_t num,
+                                     size_t item_size, watcher_size_t position);
+#ifndef C_WATCHER_LINEAR_LOOKUP
+static size_t hash_key(const void *key, size_t size);
+#endif
+static watcher_result_t add_entry_static(watcher_t *watcher, const watcher_entry_descriptor_t *descriptor,
+                                         void *old_buffer, void *snapshot, watcher_size_t *entry_index);
+static watcher_result_t add_entry(watcher_t *watcher, const watcher_entry_descriptor_t *descriptor,
+                                  watcher_size_t *entry_index);
+static watcher_size_t   next_capacity(watcher_size_t capacity);
+static void            *reallocate(watcher_t *watcher, void *pointer, size_t size);
+static void            *shadow_alloc(watcher_t *watcher, size_t size);
+static uint8_t          shadow_grow(watcher_t *watcher, size_t size);
+#ifdef C_WATCHER_COMPACT_ENTRIES
+static void             shadow_release_retired(watcher_t *watcher);
+#endif
+static inline uint8_t   entry_mode(const watcher_entry_descriptor_t *descriptor);
+static inline size_t    shadow_size(uint8_t mode, watcher_size_t size);
+static inline uint8_t   entry_changed(const watcher_t *watcher, const watcher_entry_t *entry);
+static inline void      entry_update(const watcher_t *watcher, watcher_entry_t *entry);
+static inline void     *entry_old_value(const watcher_t *watcher, watcher_entry_t *entry);
+static inline void      entry_refresh(watcher_entry_t *entry);
+
+static inline const void *entry_value(const watcher_t *watcher, const watcher_entry_t *entry);
+#ifdef C_WATCHER_CONCURRENT
+static uint8_t entry_snapshot(watcher_entry_t *entry, unsigned retries);
+static void    merge_staged(watcher_t *watcher);
+#endif
+
+static uint8_t          trigger_debouncer_entry(watcher_t *watcher, watcher_size_t debouncer_index);
+static void             arm_debouncer(watcher_t *watcher, watcher_size_t debouncer_index, unsigned long timestamp);
+static void             deadlines_push(watcher_t *watcher, watcher_size_t debouncer_index);
+static watcher_size_t   deadlines_pop(watcher_t *watcher);
+static void             deadlines_remove(watcher_t *watcher, size_t position);
+static void             debouncer_remove(watcher_t *watcher, watcher_size_t debouncer_index);
+static void             debouncer_suppressed(watcher_t *watcher, watcher_entry_t *entry);
+static watcher_result_t handles_enable(watcher_t *watcher);
+static watcher_size_t   handle_take(watcher_t *watcher, watcher_size_t entry_index);
+static void             handle_release(watcher_t *watcher, size_t slot);
+static uint8_t          handle_lookup(const watcher_t *watcher, watcher_handle_t handle, watcher_size_t *entry_index);
+static void             entry_release(watcher_t *watcher, watcher_size_t entry_index);
+static void             entry_move(watcher_t *watcher, watcher_size_t from, watcher_size_t to);
+static void             entry_swap(watcher_t *watcher, watcher_size_t a, watcher_size_t b);
+static void             entry_relink(watcher_t *watcher, watcher_size_t entry_index);
+static void             tiers_init(watcher_t *watcher);
+static uint32_t         tiers_due(watcher_t *watcher, unsigned long timestamp);
+static watcher_size_t   tier_place(watcher_t *watcher);
+static void             purge_removed(watcher_t *watcher);
+static void             busy_leave(watcher_t *watcher);
+static watcher_size_t   reclaim(void *items, watcher_size_t num, size_t item_size, void *references, size_t ref_size,
+                                size_t stride, size_t count, watcher_size_t *remap);
+static watcher_result_t shadow_repack(watcher_t *watcher);
+static size_t           shadow_total(const watcher_t *watcher);
+static uint8_t          trigger_entry(watcher_t *watcher, watcher_size_t entry_index, uint8_t defer);
+static uint8_t          dispatch(watcher_t *watcher, watcher_size_t entry_index, uint8_t defer);
+static void             flush_changes(watcher_t *watcher);
+static watcher_size_t   diff_spans(const uint8_t *old_value, const uint8_t *value, size_t size, size_t stride,
+                                   watcher_span_t *spans);
+static void             struct_dispatch(const watcher_span_t *spans, watcher_size_t num, void *old_value,
+                                        const void *new_value, watcher_size_t size, void *user_ptr, void *arg);
+static uint8_t          event_push(watcher_t *watcher, const watcher_entry_t *entry, watcher_size_t entry_index);
+static inline uint8_t   check_entry(watcher_t *watcher, watcher_size_t entry_index, unsigned long timestamp,
+                                    watcher_size_t *count);
+static void             scan_dirty(watcher_t *watcher, unsigned long timestamp, watcher_size_t *count);
+static watcher_result_t dirty_reserve(watcher_t *watcher, size_t entries);
+static watcher_size_t   watch(watcher_t *watcher, unsigned long timestamp, const watcher_pool_t *pool);
+static void             watch_begin(watcher_t *watcher, unsigned long timestamp);
+static void             fire_expired(watcher_t *watcher, unsigned long timestamp, watcher_size_t *count);
+static uint8_t          scan_budget(watcher_t *watcher, unsigned long timestamp, const watcher_budget_t *budget,
+                                    watcher_size_t *count);
+static uint8_t          compare_parallel(watcher_t *watcher, const watcher_pool_t *pool, uint32_t due);
+static void             compare_task(void *context, size_t task_index);
+static void             soft_dirty_snapshot(watcher_t *watcher);
+static void             scan_soft_dirty(watcher_t *watcher, unsigned long timestamp, watcher_size_t *count);
+static uint8_t          soft_dirty_next_run(const watcher_t *watcher, const watcher_entry_t *entry, size_t offset,
+                                            size_t *page, size_t *run_start, size_t *run_size);
+static uint8_t          soft_dirty_entry_changed(const watcher_t *watcher, watcher_entry_t *entry, size_t offset);
+static void             soft_dirty_entry_update(const watcher_t *watcher, watcher_entry_t *entry, size_t offset);
+#ifdef C_WATCHER_STATS
+static void stats_scan_end(watcher_t *watcher, unsigned long start);
+#endif
+#ifdef C_WATCHER_TRACE
+static unsigned long trace_dispatch_begin(watcher_t *watcher, watcher_trace_dispatch_t *dispatch,
+                                          watcher_size_t entry_index, watcher_size_t changes);
+#endif
+#ifndef C_WATCHER_LINEAR_LOOKUP
+static void pointers_index_insert(watcher_t *watcher, watcher_size_t position);
+static void pointers_index_remove(watcher_t *watcher, watcher_size_t position);
+static size_t pointers_index_find(const watcher_t *watcher, watcher_size_t position);
+static void pointers_index_rename(watcher_t *watcher, watcher_size_t from, watcher_size_t to);
+static void index_rebuild(watcher_t *watcher, watcher_index_t *index, const void *items, watcher_size_t num,
+                          size_t item_size);
+#endif
+#if !defined(__GNUC__) && !defined(__clang__)
+static unsigned lowest_set_bit(uint32_t word);
+#endif
 
 
 watcher_result_t watcher_init(watcher_t *watcher, void *user_ptr, void *(*fn_realloc)(void *, size_t),
@@ -77,13 +409,57 @@ watcher_result_t watcher_init(watcher_t *watcher, void *user_ptr, void *(*fn_rea
     watcher->fn_realloc = fn_realloc;
     watcher->fn_free    = fn_free;
 
+    compare_init();
+
     VECTOR_INIT(watcher->entries);
     VECTOR_INIT(watcher->callbacks);
     VECTOR_INIT(watcher->args);
     VECTOR_INIT(watcher->delays);
     VECTOR_INIT(watcher->debouncers);
-
-    watcher->user_ptr = user_ptr;
+    VECTOR_INIT(watcher->changes);
+    watcher->batched_entries = 0;
+    VECTOR_INIT(watcher->handles);
+    watcher->free_handles = WATCHER_NO_HANDLE;
+    tiers_init(watcher);
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    INDEX_INIT(watcher->callbacks_index);
+    INDEX_INIT(watcher->args_index);
+    INDEX_INIT(watcher->delays_index);
+    INDEX_INIT(watcher->pointers_index);
+#endif
+
+    ARENA_INIT(watcher->shadow);
+
+    watcher->dirty          = NULL;
+    watcher->dirty_words    = 0;
+    watcher->dirty_tracking = 0;
+
+    watcher->backend = WATCHER_BACKEND_POLL;
+    SOFT_DIRTY_INIT(watcher->soft_dirty);
+    EVENT_QUEUE_INIT(watcher->events);
+
+#ifdef C_WATCHER_CONCURRENT
+    atomic_init(&watcher->staged, NULL);
+#endif
+#ifdef C_WATCHER_STATS
+    memset(&watcher->stats, 0, sizeof(watcher->stats));
+#endif
+#ifdef C_WATCHER_TRACE
+    memset(&watcher->trace, 0, sizeof(watcher->trace));
+#endif
+
+    watcher->deadlines          = 0;
+    watcher->pending_debouncers = 0;
+    watcher->timestamp          = 0;
+    watcher->cursor             = 0;
+    watcher->busy               = 0;
+    watcher->removed            = 0;
+    watcher->user_ptr           = user_ptr;
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    watcher->base      = NULL;
+    watcher->base_size = 0;
+#endif
 
     return WATCHER_RESULT_OK;
 }
@@ -93,348 +469,3049 @@ void watcher_init_static(watcher_t *watcher, watcher_entry_t *entries, watcher_s
                          watcher_callback_t *callbacks, watcher_size_t callbacks_capacity, void **args,
                          watcher_size_t args_capacity, unsigned long *delays, watcher_size_t delays_capacity,
                          watcher_debouncer_t *debouncers, watcher_size_t debouncers_capacity, void *user_ptr) {
+    compare_init();
+
     VECTOR_INIT_STATIC(watcher->entries, entries, entries_capacity);
     VECTOR_INIT_STATIC(watcher->callbacks, callbacks, callbacks_capacity);
     VECTOR_INIT_STATIC(watcher->args, args, args_capacity);
     VECTOR_INIT_STATIC(watcher->delays, delays, delays_capacity);
     VECTOR_INIT_STATIC(watcher->debouncers, debouncers, debouncers_capacity);
-
-    watcher->user_ptr   = user_ptr;
-    watcher->fn_realloc = NULL;
-    watcher->fn_free    = NULL;
+    // Batched entries can only be added once memory for their changes is provided
+    VECTOR_INIT(watcher->changes);
+    watcher->batched_entries = 0;
+    VECTOR_INIT(watcher->handles);
+    watcher->free_handles = WATCHER_NO_HANDLE;
+    tiers_init(watcher);
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    // Static watchers fall back to linear lookups until an index buffer is provided
+    INDEX_INIT(watcher->callbacks_index);
+    INDEX_INIT(watcher->args_index);
+    INDEX_INIT(watcher->delays_index);
+    INDEX_INIT(watcher->pointers_index);
+#endif
+
+    // Entries need caller provided old value buffers until a shadow pool is provided
+    ARENA_INIT(watcher->shadow);
+
+    // Dirty tracking is only available once a bitmap is provided
+    watcher->dirty          = NULL;
+    watcher->dirty_words    = 0;
+    watcher->dirty_tracking = 0;
+
+    watcher->backend = WATCHER_BACKEND_POLL;
+    SOFT_DIRTY_INIT(watcher->soft_dirty);
+    EVENT_QUEUE_INIT(watcher->events);
+
+#ifdef C_WATCHER_CONCURRENT
+    atomic_init(&watcher->staged, NULL);
+#endif
+#ifdef C_WATCHER_STATS
+    memset(&watcher->stats, 0, sizeof(watcher->stats));
+#endif
+#ifdef C_WATCHER_TRACE
+    memset(&watcher->trace, 0, sizeof(watcher->trace));
+#endif
+
+    watcher->deadlines          = 0;
+    watcher->pending_debouncers = 0;
+    watcher->timestamp          = 0;
+    watcher->cursor             = 0;
+    watcher->busy               = 0;
+    watcher->removed            = 0;
+    watcher->user_ptr           = user_ptr;
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    watcher->base      = NULL;
+    watcher->base_size = 0;
+#endif
+    watcher->fn_realloc         = NULL;
+    watcher->fn_free            = NULL;
 }
 
 
-void watcher_destroy(watcher_t *watcher) {
-    if (watcher->fn_free != NULL) {
-        watcher->fn_free(watcher->entries.items);
-        watcher->fn_free(watcher->callbacks.items);
-        watcher->fn_free(watcher->args.items);
-        watcher->fn_free(watcher->delays.items);
-        watcher->fn_free(watcher->debouncers.items);
-    }
+watcher_result_t watcher_init_static_config(watcher_t *watcher, const watcher_static_config_t *config) {
+    watcher_result_t result = WATCHER_RESULT_OK;
 
-    watcher->changed = 1;
-}
+    if (config == NULL) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
 
+    watcher_init_static(watcher, config->entries, config->entries_capacity, config->callbacks,
+                        config->callbacks_capacity, config->args, config->args_capacity, config->delays,
+                        config->delays_capacity, config->debouncers, config->debouncers_capacity, config->user_ptr);
 
-watcher_result_t watcher_add_entry(watcher_t *watcher, const void *pointer, watcher_size_t size,
-                                   watcher_callback_t callback, void *arg) {
-    void *old_buffer = NULL;
-    if (FITS_IN_POINTER(size)) {
-        // If the watched region fits in a pointer we can use the old_buffer field itself
-    } else {
-        old_buffer = watcher->fn_realloc(NULL, size);
-        if (old_buffer == NULL) {
-            return WATCHER_RESULT_ALLOC_ERROR;
-        }
+    if (result == WATCHER_RESULT_OK && config->index != NULL) {
+        result = watcher_init_static_index(watcher, config->index, config->index_len);
     }
-    return add_entry_static(watcher, pointer, size, callback, arg, old_buffer, 0);
+    if (result == WATCHER_RESULT_OK && config->shadow != NULL) {
+        result = watcher_init_static_shadow(watcher, config->shadow, config->shadow_size);
+    }
+    if (result == WATCHER_RESULT_OK && config->dirty != NULL) {
+        result = watcher_init_static_dirty(watcher, config->dirty, config->dirty_words);
+    }
+    if (result == WATCHER_RESULT_OK && config->changes != NULL) {
+        result = watcher_init_static_changes(watcher, config->changes, config->changes_capacity);
+    }
+    if (result == WATCHER_RESULT_OK && config->handles != NULL) {
+        result = watcher_init_static_handles(watcher, config->handles, config->handles_capacity);
+    }
+
+    return result;
 }
 
-watcher_result_t watcher_add_entry_delayed(watcher_t *watcher, const void *pointer, watcher_size_t size,
-                                           watcher_callback_t callback, void *arg, unsigned long delay) {
-    void *old_buffer = NULL;
-    if (FITS_IN_POINTER(size)) {
-        // If the watched region fits in a pointer we can use the old_buffer field itself
-    } else {
-        old_buffer = watcher->fn_realloc(NULL, size);
-        if (old_buffer == NULL) {
-            return WATCHER_RESULT_ALLOC_ERROR;
-        }
+
+watcher_result_t watcher_init_static_shadow(watcher_t *watcher, void *pool, size_t pool_size) {
+    if (pool == NULL || watcher->fn_realloc != NULL) {
+        return WATCHER_RESULT_INVALID_ARGS;
     }
-    return watcher_add_entry_delayed_static(watcher, pointer, size, callback, arg, delay, old_buffer);
-}
 
+    size_t padding = ALIGN_UP((uintptr_t)pool, C_WATCHER_SHADOW_ALIGNMENT) - (uintptr_t)pool;
+    if (padding > pool_size) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
+    }
 
-watcher_result_t watcher_add_entry_delayed_static(watcher_t *watcher, const void *pointer, watcher_size_t size,
-                                                  watcher_callback_t callback, void *arg, unsigned long delay,
-                                                  void *old_buffer) {
-    return add_entry_static(watcher, pointer, size, callback, arg, old_buffer, delay);
+    watcher->shadow.memory   = (uint8_t *)pool + padding;
+    watcher->shadow.used     = 0;
+    watcher->shadow.capacity = pool_size - padding;
+    return WATCHER_RESULT_OK;
 }
 
 
-watcher_size_t watcher_watch(watcher_t *watcher, unsigned long timestamp) {
-    watcher_size_t count = 0;
-    watcher_size_t i     = 0;
+watcher_result_t watcher_init_static_index(watcher_t *watcher, watcher_size_t *buffer, size_t buffer_len) {
+    size_t callbacks_slots = 2 * (size_t)watcher->callbacks.capacity;
+    size_t args_slots      = 2 * (size_t)watcher->args.capacity;
+    size_t delays_slots    = 2 * (size_t)watcher->delays.capacity;
 
-    do {
-        watcher->changed = 0;
+    if (buffer == NULL || watcher->fn_realloc != NULL) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    if (buffer_len < callbacks_slots + args_slots + delays_slots) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
+    }
 
-        for (i = 0; i < watcher->entries.num; i++) {
-            watcher_entry_t *pentry             = &watcher->entries.items[i];
-            void            *old_buffer         = ENTRY_GET_OLD_BUFFER_POINTER(*pentry);
-            uint8_t          is_entry_debounced = is_debounced(watcher, i);
-
-            if (memcmp(pentry->watched, old_buffer, pentry->size)) {
-                // Immediate logic
-                trigger_entry(watcher, (int16_t)i);
-
-                // A debounced entry is considered triggered after the delay
-                if (!is_entry_debounced) {
-                    count++;
-                    memcpy(old_buffer, pentry->watched, pentry->size);
-                }
+#ifndef C_WATCHER_LINEAR_LOOKUP
 
-                if (watcher->changed) {
-                    break;
-                }
-            }
+    watcher->callbacks_index.slots    = buffer;
+    watcher->callbacks_index.capacity = callbacks_slots;
+    watcher->args_index.slots         = &buffer[callbacks_slots];
+    watcher->args_index.capacity      = args_slots;
+    watcher->delays_index.slots       = &buffer[callbacks_slots + args_slots];
+    watcher->delays_index.capacity    = delays_slots;
 
-            if (is_entry_debounced) {
-                watcher_debouncer_t *pdebouncer =
-                    &watcher->debouncers.items[(size_t)(uintptr_t)watcher->args.items[pentry->arg_index]];
+    // Index whatever was registered before the buffer was provided
+    memset(buffer, INDEX_EMPTY_SLOT, (callbacks_slots + args_slots + delays_slots) * sizeof(watcher_size_t));
+    watcher_size_t i = 0;
+    for (i = 0; i < watcher->callbacks.num; i++) {
+        index_insert(watcher, &watcher->callbacks_index, watcher->callbacks.items, watcher->callbacks.num,
+                     sizeof(watcher->callbacks.items[0]), i);
+    }
+    for (i = 0; i < watcher->args.num; i++) {
+        index_insert(watcher, &watcher->args_index, watcher->args.items, watcher->args.num,
+                     sizeof(watcher->args.items[0]), i);
+    }
+    for (i = 0; i < watcher->delays.num; i++) {
+        index_insert(watcher, &watcher->delays_index, watcher->delays.items, watcher->delays.num,
+                     sizeof(watcher->delays.items[0]), i);
+    }
+#endif
 
-                if (pdebouncer->triggered == TRIGGER_STATE_RESET) {
-                    pdebouncer->triggered = TRIGGER_STATE_ACTIVE;
-                    pdebouncer->timestamp = timestamp;
-                }
+    return WATCHER_RESULT_OK;
+}
 
-                if (pdebouncer->triggered == TRIGGER_STATE_ACTIVE &&
-                    is_expired(pdebouncer->timestamp, timestamp, watcher->delays.items[pdebouncer->delay_index])) {
-                    trigger_debouncer_entry(watcher, i, pdebouncer);
-                    count++;
-                }
 
-                if (watcher->changed) {
-                    break;
-                }
-            }
-        }
-    } while (watcher->changed);
+watcher_result_t watcher_init_static_dirty(watcher_t *watcher, uint32_t *bitmap, size_t words) {
+    if (bitmap == NULL || watcher->fn_realloc != NULL) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    if (words < WATCHER_DIRTY_BITMAP_WORDS(watcher->entries.capacity)) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
+    }
 
-    return count;
+    watcher->dirty       = bitmap;
+    watcher->dirty_words = words;
+    return watcher_set_dirty_tracking(watcher, 1);
 }
 
 
-void watcher_trigger_entry(watcher_t *watcher, int16_t entry_index) {
-    watcher_entry_t *entry      = &watcher->entries.items[entry_index];
-    void            *old_buffer = ENTRY_GET_OLD_BUFFER_POINTER(*entry);
-    trigger_entry(watcher, entry_index);
-    memcpy(old_buffer, entry->watched, entry->size);
+watcher_result_t watcher_init_static_event_queue(watcher_t *watcher, watcher_event_t *events, void *slots,
+                                                 size_t capacity, size_t slot_size) {
+    if (events == NULL || capacity == 0 || (slots == NULL && slot_size > 0) || watcher->fn_realloc != NULL ||
+        watcher->events.head != watcher->events.tail) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    watcher->events.events    = events;
+    watcher->events.slots     = slots;
+    watcher->events.capacity  = capacity;
+    watcher->events.slot_size = slot_size;
+    return WATCHER_RESULT_OK;
 }
 
 
-void watcher_trigger_all(watcher_t *watcher) {
-    watcher_size_t i = 0;
-    for (i = 0; i < watcher->entries.num; i++) {
-        watcher_trigger_entry(watcher, (int16_t)i);
+watcher_result_t watcher_init_static_changes(watcher_t *watcher, watcher_change_t *changes, watcher_size_t capacity) {
+    if (changes == NULL || watcher->fn_realloc != NULL) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    if (capacity < watcher->batched_entries) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
     }
-}
 
+    VECTOR_INIT_STATIC(watcher->changes, changes, capacity);
+    return WATCHER_RESULT_OK;
+}
 
-void watcher_reset_all(watcher_t *watcher) {
-    watcher_size_t i = 0;
 
-    for (i = 0; i < watcher->entries.num; i++) {
-        watcher_entry_t *entry      = &watcher->entries.items[i];
-        void            *old_buffer = ENTRY_GET_OLD_BUFFER_POINTER(*entry);
-        memcpy(old_buffer, entry->watched, entry->size);
+watcher_result_t watcher_init_static_handles(watcher_t *watcher, watcher_handle_slot_t *slots,
+                                             watcher_size_t capacity) {
+    if (slots == NULL || watcher->fn_realloc != NULL || watcher->handles.capacity > 0) {
+        return WATCHER_RESULT_INVALID_ARGS;
     }
-
-    for (i = 0; i < watcher->debouncers.num; i++) {
-        watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[i];
-        pdebouncer->triggered           = TRIGGER_STATE_INACTIVE;
+    // Every entry may hold a handle at the same time
+    if (capacity < watcher->entries.capacity) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
     }
-}
 
+    VECTOR_INIT_STATIC(watcher->handles, slots, capacity);
+    return handles_enable(watcher);
+}
 
-static watcher_result_t add_callback(watcher_t *watcher, watcher_callback_t callback, watcher_size_t *callback_index) {
-    watcher_size_t i              = 0;
-    uint8_t        callback_found = 0;
-    for (i = 0; i < watcher->callbacks.num; i++) {
-        if (watcher->callbacks.items[i] == callback) {
-            callback_found  = 1;
-            *callback_index = i;
-            break;
-        }
-    }
 
-    if (!callback_found) {
-        GROW_OR_FAIL(callbacks);
-        *callback_index = watcher->callbacks.num;
-        VECTOR_APPEND(watcher->callbacks, callback);
+#ifdef C_WATCHER_COMPACT_ENTRIES
+watcher_result_t watcher_set_base(watcher_t *watcher, const void *base, size_t size) {
+    // Offsets of the entries would be left dangling
+    if (base == NULL || (uint64_t)size > (uint64_t)UINT32_MAX + 1 || watcher->entries.num > 0) {
+        return WATCHER_RESULT_INVALID_ARGS;
     }
 
+    watcher->base      = base;
+    watcher->base_size = size;
     return WATCHER_RESULT_OK;
 }
+#endif
 
 
-static watcher_result_t add_arg(watcher_t *watcher, void *arg, watcher_size_t *arg_index) {
-    watcher_size_t i = 0;
-
-    uint8_t arg_found = 0;
-    for (i = 0; i < watcher->args.num; i++) {
-        if (watcher->args.items[i] == arg) {
-            arg_found  = 1;
-            *arg_index = i;
-            break;
+void watcher_destroy(watcher_t *watcher) {
+    if (watcher->fn_free != NULL) {
+        watcher->fn_free(watcher->entries.items);
+        watcher->fn_free(watcher->callbacks.items);
+        watcher->fn_free(watcher->args.items);
+        watcher->fn_free(watcher->delays.items);
+        watcher->fn_free(watcher->debouncers.items);
+        watcher->fn_free(watcher->changes.items);
+        watcher->fn_free(watcher->handles.items);
+#ifndef C_WATCHER_LINEAR_LOOKUP
+        watcher->fn_free(watcher->callbacks_index.slots);
+        watcher->fn_free(watcher->args_index.slots);
+        watcher->fn_free(watcher->delays_index.slots);
+        watcher->fn_free(watcher->pointers_index.slots);
+#endif
+        watcher->fn_free(watcher->dirty);
+        watcher->fn_free(watcher->soft_dirty.pages);
+        watcher->fn_free(watcher->events.events);
+        watcher->fn_free(watcher->events.slots);
+
+        struct watcher_shadow_slab *slab = watcher->shadow.slabs;
+        while (slab != NULL) {
+            struct watcher_shadow_slab *next = slab->next;
+            watcher->fn_free(slab);
+            slab = next;
         }
+        ARENA_INIT(watcher->shadow);
     }
 
-    if (!arg_found) {
-        GROW_OR_FAIL(args);
-        *arg_index = watcher->args.num;
-        VECTOR_APPEND(watcher->args, arg);
-    }
+    softdirty_close(&watcher->soft_dirty);
+    SOFT_DIRTY_INIT(watcher->soft_dirty);
+    watcher->backend = WATCHER_BACKEND_POLL;
+    EVENT_QUEUE_INIT(watcher->events);
+    watcher->cursor  = 0;
+    watcher->removed = 0;
+    // Nothing is left to purge or place if a callback destroys the watcher
+    watcher->entries.num = 0;
+    tiers_init(watcher);
+
+    watcher->changed = 1;
+}
+
+
+watcher_result_t watcher_reserve(watcher_t *watcher, size_t entries, size_t callbacks, size_t args, size_t delays,
+                                 size_t debouncers) {
+    RESERVE_OR_FAIL(entries, entries);
+    RESERVE_OR_FAIL(callbacks, callbacks);
+    RESERVE_OR_FAIL(args, args);
+    RESERVE_OR_FAIL(delays, delays);
+    RESERVE_OR_FAIL(debouncers, debouncers);
 
     return WATCHER_RESULT_OK;
 }
 
 
-static watcher_result_t add_entry_static(watcher_t *watcher, const void *pointer, watcher_size_t size,
-                                         watcher_callback_t callback, void *arg, void *old_buffer,
-                                         unsigned long delay) {
-    GROW_OR_FAIL(entries);
+watcher_result_t watcher_reserve_shadow(watcher_t *watcher, size_t bytes) {
+    size_t offset = ALIGN_UP(watcher->shadow.used, C_WATCHER_SHADOW_ALIGNMENT);
 
-    watcher_size_t   callback_index = 0;
-    watcher_result_t result         = WATCHER_RESULT_OK;
-    if ((result = add_callback(watcher, callback, &callback_index)) != WATCHER_RESULT_OK) {
-        return result;
+    if (bytes == 0 || (watcher->shadow.memory != NULL && offset <= watcher->shadow.capacity &&
+                       watcher->shadow.capacity - offset >= bytes)) {
+        return WATCHER_RESULT_OK;
+    } else if (watcher->fn_realloc == NULL) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
+    } else {
+        return shadow_grow(watcher, bytes) ? WATCHER_RESULT_OK : WATCHER_RESULT_ALLOC_ERROR;
     }
+}
 
-    watcher_size_t arg_index = 0;
-    if ((result = add_arg(watcher, arg, &arg_index)) != WATCHER_RESULT_OK) {
-        return result;
-    }
 
-    watcher_entry_t entry = {
-        .watched        = pointer,
-        .old_buffer     = old_buffer,
-        .size           = size,
-        .callback_index = callback_index,
-        .arg_index      = arg_index,
-    };
-    // If the watched region fits in a pointer just use the corresponding field
-    old_buffer = ENTRY_GET_OLD_BUFFER_POINTER(entry);
-    if (old_buffer == NULL) {
-        return WATCHER_RESULT_ALLOC_ERROR;
+void watcher_get_memory_info(const watcher_t *watcher, watcher_memory_info_t *info) {
+    watcher_footprint_t *used      = &info->used;
+    watcher_footprint_t *allocated = &info->allocated;
+
+    memset(info, 0, sizeof(*info));
+
+    used->entries    = watcher->entries.num;
+    used->callbacks  = watcher->callbacks.num;
+    used->args       = watcher->args.num;
+    used->delays     = watcher->delays.num;
+    used->debouncers = watcher->debouncers.num;
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    // A static index is sized on the capacities, which here are the items in use
+    used->index = WATCHER_STATIC_INDEX_SIZE(used->callbacks, used->args, used->delays);
+#endif
+    used->shadow  = shadow_total(watcher);
+    used->dirty   = watcher->dirty != NULL ? WATCHER_DIRTY_BITMAP_WORDS(used->entries) : 0;
+    used->changes = watcher->batched_entries;
+    // Static handle tables cover every entry
+    used->handles = watcher->handles.capacity > 0 ? used->entries : 0;
+
+    allocated->entries    = watcher->entries.capacity;
+    allocated->callbacks  = watcher->callbacks.capacity;
+    allocated->args       = watcher->args.capacity;
+    allocated->delays     = watcher->delays.capacity;
+    allocated->debouncers = watcher->debouncers.capacity;
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    allocated->index = watcher->callbacks_index.capacity + watcher->args_index.capacity +
+                       watcher->delays_index.capacity + watcher->pointers_index.capacity;
+#endif
+    allocated->dirty   = watcher->dirty_words;
+    allocated->changes = watcher->changes.capacity;
+    allocated->handles = watcher->handles.capacity;
+
+    info->used_bytes      = watcher_footprint_bytes(used);
+    info->allocated_bytes = 0;
+
+    if (watcher->shadow.slabs != NULL) {
+        const struct watcher_shadow_slab *slab = watcher->shadow.slabs;
+        while (slab != NULL) {
+            allocated->shadow += slab->capacity;
+            info->allocated_bytes += sizeof(struct watcher_shadow_slab) + C_WATCHER_SHADOW_ALIGNMENT;
+            slab = slab->next;
+        }
+    } else if (watcher->shadow.memory != NULL) {
+        allocated->shadow = watcher->shadow.capacity;
     }
-    memcpy(old_buffer, pointer, size);
 
-    GROW_OR_FAIL(entries);
-    int16_t entry_index = (int16_t)watcher->entries.num;
-    VECTOR_APPEND(watcher->entries, entry);
+    info->allocated_bytes += watcher_footprint_bytes(allocated);
+    info->allocated_bytes += watcher->events.capacity * (sizeof(watcher_event_t) + watcher->events.slot_size);
+    info->allocated_bytes += watcher->soft_dirty.capacity;
+}
 
-    if (delay > 0) {
-        watcher_entry_t *pentry = &watcher->entries.items[entry_index];
 
-        // Entry is already debounced
-        if (is_debounced(watcher, (watcher_size_t)entry_index)) {
-            return (watcher_size_t)entry_index;
-        }
+size_t watcher_footprint_bytes(const watcher_footprint_t *footprint) {
+    return (size_t)footprint->entries * sizeof(watcher_entry_t) +
+           (size_t)footprint->callbacks * sizeof(watcher_callback_t) + (size_t)footprint->args * sizeof(void *) +
+           (size_t)footprint->delays * sizeof(unsigned long) +
+           (size_t)footprint->debouncers * sizeof(watcher_debouncer_t) + footprint->index * sizeof(watcher_size_t) +
+           footprint->shadow + footprint->dirty * sizeof(uint32_t) +
+           (size_t)footprint->changes * sizeof(watcher_change_t) +
+           (size_t)footprint->handles * sizeof(watcher_handle_slot_t);
+}
 
-        // Look for or add a new debouncer
-        watcher_size_t i           = 0;
-        uint8_t        delay_found = 0;
-        int16_t        delay_index = 0;
-
-        for (i = 0; i < watcher->delays.num; i++) {
-            if (watcher->delays.items[i] == delay) {
-                delay_found = 1;
-                delay_index = (int16_t)i;
-                break;
-            }
-        }
 
-        if (!delay_found) {
-            if (VECTOR_FULL(watcher->delays)) {
-                if (watcher->fn_realloc != NULL && !VECTOR_AT_MAX_CAPACITY(watcher->delays)) {
-                    VECTOR_GROW(watcher->delays);
-                } else {
-                    return WATCHER_RESULT_STATIC_OVERFLOW;
-                }
-            }
-            delay_index = (int16_t)watcher->delays.num;
-            VECTOR_APPEND(watcher->delays, delay);
-        }
+watcher_result_t watcher_add_entry(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                   watcher_callback_t callback, void *arg) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer    = pointer,
+        .size       = size,
+        .callback   = callback,
+        .arg        = arg,
+        .delay      = 0,
+        .old_buffer = NULL,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry(watcher, &descriptor, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
+}
 
-        GROW_OR_FAIL(debouncers);
-        int16_t debouncer_index = (int16_t)watcher->debouncers.num;
+watcher_result_t watcher_add_entry_delayed(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                           watcher_callback_t callback, void *arg, unsigned long delay) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer    = pointer,
+        .size       = size,
+        .callback   = callback,
+        .arg        = arg,
+        .delay      = delay,
+        .old_buffer = NULL,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry(watcher, &descriptor, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
+}
 
-        watcher_size_t debouncer_callback_index = 0;
-        result                                  = WATCHER_RESULT_OK;
-        if ((result = add_callback(watcher, debouncer_callback, &debouncer_callback_index)) != WATCHER_RESULT_OK) {
-            return result;
-        }
 
-        watcher_size_t debouncer_arg_index = 0;
-        if ((result = add_arg(watcher, (void *)(uintptr_t)debouncer_index, &debouncer_arg_index)) !=
-            WATCHER_RESULT_OK) {
-            return result;
-        }
+watcher_result_t watcher_add_entry_hashed(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                          watcher_callback_t callback, void *arg) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer    = pointer,
+        .size       = size,
+        .callback   = callback,
+        .arg        = arg,
+        .delay      = 0,
+        .old_buffer = NULL,
+        .mode       = WATCHER_ENTRY_MODE_HASH,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry(watcher, &descriptor, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
+}
 
-        watcher_debouncer_t debounce_data = {
-            .timestamp      = 0,
-            .delay_index    = (watcher_size_t)delay_index,
-            .callback_index = pentry->callback_index,
-            .arg_index      = pentry->arg_index,
-            .triggered      = TRIGGER_STATE_INACTIVE,
-        };
 
-        // Fix the callback index
-        pentry->callback_index = debouncer_callback_index;
-        pentry->arg_index      = debouncer_arg_index;
+watcher_result_t watcher_add_entry_diff(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                        watcher_size_t stride, watcher_diff_callback_t callback, void *arg) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer       = pointer,
+        .size          = size,
+        .callback      = NULL,
+        .arg           = arg,
+        .delay         = 0,
+        .old_buffer    = NULL,
+        .diff_callback = callback,
+        .stride        = stride,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry(watcher, &descriptor, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
+}
 
-        VECTOR_APPEND(watcher->debouncers, debounce_data);
+
+watcher_result_t watcher_add_struct(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                    const watcher_field_table_t *table) {
+    watcher_size_t i = 0;
+
+    if (table == NULL || table->fields == NULL || table->num == 0) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    for (i = 0; i < table->num; i++) {
+        const watcher_field_t *field = &table->fields[i];
+        if (field->callback == NULL || field->size == 0 || field->offset > size || field->size > size - field->offset ||
+            (i > 0 && field->offset < table->fields[i - 1].offset)) {
+            return WATCHER_RESULT_INVALID_ARGS;
+        }
     }
 
-    watcher->changed = 1;
+    // A byte granular diff entry, whose spans are matched against the fields
+    return watcher_add_entry_diff(watcher, pointer, size, 1, struct_dispatch, (void *)table);
+}
+
 
-    return (watcher_size_t)entry_index;
+watcher_result_t watcher_add_entry_tiered(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                          watcher_callback_t callback, void *arg, uint8_t tier) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer    = pointer,
+        .size       = size,
+        .callback   = callback,
+        .arg        = arg,
+        .delay      = 0,
+        .old_buffer = NULL,
+        .tier       = tier,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry(watcher, &descriptor, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
 }
 
 
-static void debouncer_callback(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr, void *arg) {
-    (void)old_value;
-    (void)new_value;
-    (void)size;
+watcher_result_t watcher_add_entry_batched(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                           watcher_batch_callback_t callback, void *arg) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer        = pointer,
+        .size           = size,
+        .callback       = NULL,
+        .arg            = arg,
+        .delay          = 0,
+        .old_buffer     = NULL,
+        .batch_callback = callback,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry(watcher, &descriptor, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
+}
 
-    watcher_t           *watcher    = user_ptr;
-    watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[(size_t)(uintptr_t)arg];
-    // Debounce was triggered
-    if (pdebouncer->triggered == TRIGGER_STATE_INACTIVE) {
-        pdebouncer->triggered = TRIGGER_STATE_RESET;
-    }
+
+watcher_result_t watcher_add_entry_static(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                          watcher_callback_t callback, void *arg, void *old_buffer) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer    = pointer,
+        .size       = size,
+        .callback   = callback,
+        .arg        = arg,
+        .delay      = 0,
+        .old_buffer = old_buffer,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry_static(watcher, &descriptor, old_buffer, NULL, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
 }
 
 
-static uint8_t is_debounced(watcher_t *watcher, watcher_size_t entry_index) {
-    return watcher->callbacks.items[watcher->entries.items[entry_index].callback_index] == debouncer_callback;
+watcher_result_t watcher_add_entry_delayed_static(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                                  watcher_callback_t callback, void *arg, unsigned long delay,
+                                                  void *old_buffer) {
+    watcher_entry_descriptor_t descriptor = {
+        .pointer    = pointer,
+        .size       = size,
+        .callback   = callback,
+        .arg        = arg,
+        .delay      = delay,
+        .old_buffer = old_buffer,
+    };
+    watcher_size_t   entry_index = 0;
+    watcher_result_t result      = add_entry_static(watcher, &descriptor, old_buffer, NULL, &entry_index);
+    return result == WATCHER_RESULT_OK ? (watcher_result_t)entry_index : result;
 }
 
 
-static void trigger_debouncer_entry(watcher_t *watcher, watcher_size_t entry_index, watcher_debouncer_t *pdebouncer) {
-    watcher_entry_t *pentry = &watcher->entries.items[entry_index];
-    void            *arg    = watcher->args.items[pdebouncer->arg_index];
+watcher_result_t watcher_add_entries(watcher_t *watcher, const watcher_entry_descriptor_t *descriptors, size_t num) {
+    size_t         i          = 0;
+    watcher_size_t debouncers = 0;
 
-    void *old_buffer = ENTRY_GET_OLD_BUFFER_POINTER(*pentry);
+    if (descriptors == NULL && num > 0) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
 
-    watcher->callbacks.items[pdebouncer->callback_index](old_buffer, pentry->watched, pentry->size, watcher->user_ptr,
-                                                         arg);
-    pdebouncer->triggered = TRIGGER_STATE_INACTIVE;
-}
+    size_t shadow_bytes = 0;
+    for (i = 0; i < num; i++) {
+        if (descriptors[i].delay > 0) {
+            debouncers++;
+        }
+        if (descriptors[i].old_buffer == NULL) {
+            shadow_bytes +=
+                ALIGN_UP(shadow_size(entry_mode(&descriptors[i]), descriptors[i].size), C_WATCHER_SHADOW_ALIGNMENT);
+        }
+#ifdef C_WATCHER_CONCURRENT
+        if (descriptors[i].seqlock != NULL) {
+            shadow_bytes += ALIGN_UP(descriptors[i].size, C_WATCHER_SHADOW_ALIGNMENT);
+        }
+#endif
+    }
 
+    // Size the vectors once for the whole batch instead of growing them entry by entry, and keep the batch's old
+    // value buffers in a single slab
+    RESERVE_OR_FAIL(entries, (size_t)watcher->entries.num + num);
+    RESERVE_OR_FAIL(debouncers, (size_t)watcher->debouncers.num + debouncers);
+    watcher_result_t result = watcher_reserve_shadow(watcher, shadow_bytes);
+    if (result != WATCHER_RESULT_OK) {
+        return result;
+    }
 
-static void trigger_entry(watcher_t *watcher, int16_t entry_index) {
-    // Invalid index
-    if (entry_index >= watcher->entries.num || entry_index < 0) {
-        return;
+    for (i = 0; i < num; i++) {
+        watcher_size_t entry_index = 0;
+        if ((result = add_entry(watcher, &descriptors[i], &entry_index)) != WATCHER_RESULT_OK) {
+            return result;
+        }
     }
-    watcher_entry_t *entry      = &watcher->entries.items[entry_index];
-    void            *old_buffer = ENTRY_GET_OLD_BUFFER_POINTER(*entry);
 
-    void *arg      = watcher->args.items[entry->arg_index];
-    void *user_ptr = is_debounced(watcher, (watcher_size_t)entry_index) ? watcher : watcher->user_ptr;
+    return WATCHER_RESULT_OK;
+}
+
 
-    watcher->callbacks.items[entry->callback_index](old_buffer, entry->watched, entry->size, user_ptr, arg);
-    // The callback modified the watcher list, either stop or update the entry to make sure we retain the correct
-    // pointers
-    if (watcher->changed) {
-        if (entry_index >= watcher->entries.num) {
-            return;
+watcher_result_t watcher_add_entry_descriptor(watcher_t *watcher, const watcher_entry_descriptor_t *descriptor,
+                                              watcher_size_t *entry_index) {
+    if (descriptor == NULL || entry_index == NULL) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    return add_entry(watcher, descriptor, entry_index);
+}
+
+
+#ifdef C_WATCHER_CONCURRENT
+void watcher_stage_entry(watcher_t *watcher, watcher_staged_entry_t *node) {
+    watcher_staged_entry_t *head = atomic_load_explicit(&watcher->staged, memory_order_relaxed);
+
+    atomic_store_explicit(&node->done, 0, memory_order_relaxed);
+    do {
+        node->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&watcher->staged, &head, node, memory_order_release,
+                                                    memory_order_relaxed));
+}
+#endif
+
+
+watcher_size_t watcher_watch(watcher_t *watcher, unsigned long timestamp) {
+    return watch(watcher, timestamp, NULL);
+}
+
+
+watcher_size_t watcher_watch_parallel(watcher_t *watcher, unsigned long timestamp, const watcher_pool_t *pool) {
+    return watch(watcher, timestamp, pool);
+}
+
+
+watcher_size_t watcher_drain_events(watcher_t *watcher, watcher_size_t max) {
+    watcher_event_queue_t *queue = &watcher->events;
+    watcher_size_t         count = 0;
+
+    if (queue->capacity == 0) {
+        return 0;
+    }
+
+    size_t tail = queue->tail;
+    size_t head = LOAD_ACQUIRE(queue->head);
+    while (tail != head && count < max) {
+        watcher_event_t *event = &queue->events[tail % queue->capacity];
+        watcher_size_t   num   = 1;
+
+        if (event->batched) {
+            // Consecutive events of the same batched callback are delivered together
+            watcher_change_t changes[DRAIN_BATCH];
+            for (num = 0; num < DRAIN_BATCH && tail + num != head && count + num < max; num++) {
+                watcher_event_t *batched = &queue->events[(tail + num) % queue->capacity];
+                if (!batched->batched || batched->callback != event->callback) {
+                    break;
+                }
+                changes[num].old_value   = batched->old_value;
+                changes[num].new_value   = batched->watched;
+                changes[num].arg         = batched->arg;
+                changes[num].size        = batched->size;
+                changes[num].entry_index = batched->entry_index;
+            }
+            AS_BATCH_CALLBACK(event->callback)(changes, num, watcher->user_ptr);
+        } else if (event->stride > 0) {
+            // The memory may have been written again since, the spans are up to date
+            watcher_span_t spans[C_WATCHER_MAX_DIFF_SPANS] = {{.offset = 0, .length = event->size}};
+            watcher_size_t spans_num                       = 1;
+            if (event->old_value != NULL) {
+                spans_num = diff_spans(event->old_value, event->watched, event->size, event->stride, spans);
+            }
+            AS_DIFF_CALLBACK(event->callback)(spans, spans_num, event->old_value, event->watched, event->size,
+                                              watcher->user_ptr, event->arg);
+        } else {
+            event->callback(event->old_value, event->watched, event->size, watcher->user_ptr, event->arg);
+        }
+        count += num;
+
+        // The slots are handed back only once the callback is done with the old values
+        tail += num;
+        STORE_RELEASE(queue->tail, tail);
+    }
+
+    return count;
+}
+
+
+watcher_size_t watcher_watch_budget(watcher_t *watcher, unsigned long timestamp, const watcher_budget_t *budget,
+                                    uint8_t *swept) {
+    watcher_size_t count = 0;
+    uint8_t        done  = 0;
+#ifdef C_WATCHER_STATS
+    unsigned long start = C_WATCHER_STATS_CLOCK();
+#endif
+#ifdef C_WATCHER_TRACE
+    unsigned long trace_token =
+        watcher->trace.scan_begin != NULL ? watcher->trace.scan_begin(watcher->trace.context, timestamp) : 0;
+#endif
+
+    watcher->busy++;
+    watch_begin(watcher, timestamp);
+
+    watcher->changed = 0;
+    done             = scan_budget(watcher, timestamp, budget, &count);
+
+    if (!watcher->changed) {
+        fire_expired(watcher, timestamp, &count);
+    }
+    if (!watcher->changed && watcher->changes.num > 0) {
+        flush_changes(watcher);
+    }
+
+    if (swept != NULL) {
+        *swept = done;
+    }
+    busy_leave(watcher);
+#ifdef C_WATCHER_STATS
+    stats_scan_end(watcher, start);
+#endif
+#ifdef C_WATCHER_TRACE
+    if (watcher->trace.scan_end != NULL) {
+        watcher->trace.scan_end(watcher->trace.context, timestamp, count, trace_token);
+    }
+#endif
+    return count;
+}
+
+
+static watcher_size_t watch(watcher_t *watcher, unsigned long timestamp, const watcher_pool_t *pool) {
+    watcher_size_t count = 0;
+    watcher_size_t i     = 0;
+    size_t         t     = 0;
+#ifdef C_WATCHER_STATS
+    unsigned long start = C_WATCHER_STATS_CLOCK();
+#endif
+#ifdef C_WATCHER_TRACE
+    unsigned long trace_token =
+        watcher->trace.scan_begin != NULL ? watcher->trace.scan_begin(watcher->trace.context, timestamp) : 0;
+#endif
+
+    watcher->busy++;
+    watch_begin(watcher, timestamp);
+
+    if (watcher->backend == WATCHER_BACKEND_SOFT_DIRTY) {
+        soft_dirty_snapshot(watcher);
+    }
+
+    // Marked entries are compared whatever their tier
+    uint32_t due = watcher->dirty_tracking ? 0 : tiers_due(watcher, timestamp);
+
+    // Pool threads flag the changed entries in the dirty bitmap, which is then dispatched like marked entries
+    uint8_t parallel = pool != NULL && compare_parallel(watcher, pool, due);
+
+    // Entries added by callbacks are appended and everything is accessed by index, so the scan carries on from where
+    // it was; it only stops if the watcher is destroyed
+    watcher->changed = 0;
+
+    if (watcher->dirty_tracking || parallel) {
+        scan_dirty(watcher, timestamp, &count);
+    } else {
+        // Tiers that are not due are skipped as a whole; entries registered by callbacks follow the last tier and are
+        // compared as they come
+        for (t = 0; t <= C_WATCHER_TIERS && !watcher->changed; t++) {
+            const watcher_size_t *end = t < C_WATCHER_TIERS ? &watcher->tiers[t].end : &watcher->entries.num;
+            if (t < C_WATCHER_TIERS && !(due & TIER_BIT(t))) {
+                continue;
+            }
+
+            // Hot loop: the entry kind is only looked at once a change has been found
+            for (i = TIER_START(t); i < *end; i++) {
+                check_entry(watcher, i, timestamp, &count);
+                if (watcher->changed) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (!watcher->changed && watcher->soft_dirty.entries > 0) {
+        scan_soft_dirty(watcher, timestamp, &count);
+    }
+    if (!watcher->changed) {
+        fire_expired(watcher, timestamp, &count);
+    }
+    if (!watcher->changed && watcher->changes.num > 0) {
+        flush_changes(watcher);
+    }
+
+    watcher->soft_dirty.entries = 0;
+    busy_leave(watcher);
+#ifdef C_WATCHER_STATS
+    stats_scan_end(watcher, start);
+#endif
+#ifdef C_WATCHER_TRACE
+    if (watcher->trace.scan_end != NULL) {
+        watcher->trace.scan_end(watcher->trace.context, timestamp, count, trace_token);
+    }
+#endif
+
+    return count;
+}
+
+
+static void watch_begin(watcher_t *watcher, unsigned long timestamp) {
+    watcher_size_t i = 0;
+
+    watcher->timestamp = timestamp;
+
+#ifdef C_WATCHER_CONCURRENT
+    if (atomic_load_explicit(&watcher->staged, memory_order_relaxed) != NULL) {
+        merge_staged(watcher);
+    }
+#endif
+
+    // Rare path: debouncers triggered since the last call start their delay now
+    if (watcher->pending_debouncers > 0) {
+        for (i = 0; i < watcher->debouncers.num; i++) {
+            if (watcher->debouncers.items[i].triggered == TRIGGER_STATE_RESET) {
+                arm_debouncer(watcher, i, timestamp);
+            }
+        }
+        watcher->pending_debouncers = 0;
+    }
+}
+
+
+#ifdef C_WATCHER_STATS
+static void stats_scan_end(watcher_t *watcher, unsigned long start) {
+    unsigned long elapsed = C_WATCHER_STATS_CLOCK() - start;
+
+    watcher->stats.scans++;
+    watcher->stats.scan_time += elapsed;
+    watcher->stats.last_scan_time = elapsed;
+    if (elapsed > watcher->stats.max_scan_time) {
+        watcher->stats.max_scan_time = elapsed;
+    }
+    watcher->stats.interrupted += watcher->changed;
+}
+#endif
+
+
+#ifdef C_WATCHER_TRACE
+// Describes a callback invocation and calls the dispatch_begin hook
+static unsigned long trace_dispatch_begin(watcher_t *watcher, watcher_trace_dispatch_t *dispatch,
+                                          watcher_size_t entry_index, watcher_size_t changes) {
+    const watcher_entry_t *entry = &watcher->entries.items[entry_index];
+
+    dispatch->entry_index    = entry_index;
+    dispatch->callback_index = entry->callback_index;
+    dispatch->changes        = changes;
+    dispatch->timestamp      = watcher->timestamp;
+    dispatch->changed        = watcher->timestamp;
+    dispatch->debounced      = ENTRY_IS_DEBOUNCED(*entry);
+    if (dispatch->debounced) {
+        // Debounced entries are only dispatched once their delay expired
+        dispatch->changed = watcher->debouncers.items[entry->debouncer_index].changed;
+    }
+
+    return watcher->trace.dispatch_begin != NULL ? watcher->trace.dispatch_begin(watcher->trace.context, dispatch) : 0;
+}
+#endif
+
+
+static void fire_expired(watcher_t *watcher, unsigned long timestamp, watcher_size_t *count) {
+    // Only the expired debouncers are touched, in deadline order
+    while (watcher->deadlines > 0 &&
+           time_after_or_equal(timestamp, watcher->debouncers.items[watcher->debouncers.items[0].heap].deadline)) {
+        if (trigger_debouncer_entry(watcher, deadlines_pop(watcher))) {
+            (*count)++;
+        }
+
+        if (watcher->changed) {
+            return;
+        }
+    }
+}
+
+
+static uint8_t scan_budget(watcher_t *watcher, unsigned long timestamp, const watcher_budget_t *budget,
+                           watcher_size_t *count) {
+    size_t checked = 0;
+
+    while (watcher->cursor < watcher->entries.num) {
+        size_t entry_index = watcher->cursor;
+        if (watcher->dirty_tracking) {
+            // Jumps to the next marked entry, skipping clean ones 32 at a time
+            size_t   word = DIRTY_WORD(entry_index);
+            uint32_t bits = watcher->dirty[word] & ~(DIRTY_BIT(entry_index) - 1);
+            if (bits == 0) {
+                watcher->cursor = (word + 1) * 32;
+                continue;
+            }
+            entry_index = word * 32 + LOWEST_SET_BIT(bits);
+            if (entry_index >= watcher->entries.num) {
+                break;
+            }
+        }
+
+        if (budget->entries > 0 && checked >= budget->entries) {
+            watcher->cursor = entry_index;
+            return 0;
+        }
+        // Reading the clock for every entry would cost more than comparing it
+        if (budget->clock != NULL && checked % BUDGET_CLOCK_INTERVAL == 0 &&
+            time_after_or_equal(budget->clock(budget->clock_arg), budget->deadline)) {
+            watcher->cursor = entry_index;
+            return 0;
+        }
+
+        // The cursor moves on first, so an entry that has to be checked again can be marked right away
+        watcher->cursor = entry_index + 1;
+        if (watcher->dirty_tracking) {
+            watcher->dirty[DIRTY_WORD(entry_index)] &= ~DIRTY_BIT(entry_index);
+        }
+        if (!check_entry(watcher, (watcher_size_t)entry_index, timestamp, count)) {
+            watcher_mark_dirty(watcher, (watcher_size_t)entry_index);
+        }
+        checked++;
+
+        if (watcher->changed) {
+            return 0;
+        }
+    }
+
+    watcher->cursor = 0;
+    return 1;
+}
+
+
+uint8_t watcher_next_deadline(watcher_t *watcher, unsigned long *deadline) {
+    if (watcher->pending_debouncers > 0) {
+        *deadline = watcher->timestamp;
+        return 1;
+    } else if (watcher->deadlines > 0) {
+        *deadline = watcher->debouncers.items[watcher->debouncers.items[0].heap].deadline;
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+
+watcher_result_t watcher_set_backend(watcher_t *watcher, watcher_backend_t backend) {
+    if (backend == watcher->backend) {
+        return WATCHER_RESULT_OK;
+    } else if (backend == WATCHER_BACKEND_POLL) {
+        softdirty_close(&watcher->soft_dirty);
+        watcher->backend = WATCHER_BACKEND_POLL;
+        return WATCHER_RESULT_OK;
+    } else if (backend == WATCHER_BACKEND_SOFT_DIRTY && watcher->fn_realloc != NULL) {
+        watcher_result_t result = softdirty_open(&watcher->soft_dirty);
+        if (result == WATCHER_RESULT_OK) {
+            // Nothing is known about the writes made before the backend was selected
+            watcher->soft_dirty.resync = 1;
+            watcher->backend           = WATCHER_BACKEND_SOFT_DIRTY;
+        }
+        return result;
+    } else {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+}
+
+
+watcher_result_t watcher_set_event_queue(watcher_t *watcher, size_t capacity, size_t slot_size) {
+    watcher_event_queue_t *queue  = &watcher->events;
+    watcher_event_t       *events = NULL;
+    uint8_t               *slots  = NULL;
+
+    if (watcher->fn_realloc == NULL || queue->head != LOAD_ACQUIRE(queue->tail)) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    slot_size = ALIGN_UP(slot_size, C_WATCHER_SHADOW_ALIGNMENT);
+    if (capacity > 0) {
+        if (capacity > SIZE_MAX / sizeof(watcher_event_t) || (slot_size > 0 && capacity > SIZE_MAX / slot_size)) {
+            return WATCHER_RESULT_ALLOC_ERROR;
+        }
+        events = reallocate(watcher, NULL, capacity * sizeof(watcher_event_t));
+        if (events == NULL) {
+            return WATCHER_RESULT_ALLOC_ERROR;
+        }
+        if (slot_size > 0) {
+            slots = reallocate(watcher, NULL, capacity * slot_size);
+            if (slots == NULL) {
+                watcher->fn_free(events);
+                return WATCHER_RESULT_ALLOC_ERROR;
+            }
+        }
+    }
+
+    watcher->fn_free(queue->events);
+    watcher->fn_free(queue->slots);
+    queue->events    = events;
+    queue->slots     = slots;
+    queue->capacity  = capacity;
+    queue->slot_size = slot_size;
+    queue->head      = 0;
+    STORE_RELEASE(queue->tail, 0);
+    return WATCHER_RESULT_OK;
+}
+
+
+watcher_result_t watcher_set_tier(watcher_t *watcher, uint8_t tier, unsigned calls, unsigned long period) {
+    if (tier == 0 || tier >= C_WATCHER_TIERS || (calls == 0 && period == 0)) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    watcher->tiers[tier].calls     = calls;
+    watcher->tiers[tier].countdown = calls;
+    watcher->tiers[tier].period    = period;
+    watcher->tiers[tier].last      = watcher->timestamp;
+    return WATCHER_RESULT_OK;
+}
+
+
+watcher_result_t watcher_set_dirty_tracking(watcher_t *watcher, uint8_t enabled) {
+    if (!enabled) {
+        watcher->dirty_tracking = 0;
+        return WATCHER_RESULT_OK;
+    }
+
+    watcher_result_t result = dirty_reserve(watcher, watcher->entries.num);
+    if (result != WATCHER_RESULT_OK) {
+        return result;
+    }
+
+    // Nothing is known about changes made while tracking was off
+    size_t         words = WATCHER_DIRTY_BITMAP_WORDS(watcher->entries.num);
+    watcher_size_t i     = 0;
+    if (watcher->dirty_words > 0) {
+        memset(watcher->dirty, 0, watcher->dirty_words * sizeof(uint32_t));
+    }
+    if (words > 0) {
+        memset(watcher->dirty, 0xFF, words * sizeof(uint32_t));
+        if (watcher->entries.num % 32 != 0) {
+            watcher->dirty[words - 1] = DIRTY_BIT(watcher->entries.num) - 1;
+        }
+    }
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    // The pointers index is not maintained while tracking is off, so it is rebuilt from scratch
+    if (watcher->fn_realloc != NULL) {
+        watcher->fn_free(watcher->pointers_index.slots);
+        INDEX_INIT(watcher->pointers_index);
+        for (i = 0; i < watcher->entries.num; i++) {
+            pointers_index_insert(watcher, i);
+        }
+    }
+#else
+    (void)i;
+#endif
+
+    watcher->dirty_tracking = 1;
+    return WATCHER_RESULT_OK;
+}
+
+
+void watcher_mark_dirty(watcher_t *watcher, watcher_size_t entry_index) {
+    if (watcher->dirty_tracking && entry_index < watcher->entries.num) {
+        watcher->dirty[DIRTY_WORD(entry_index)] |= DIRTY_BIT(entry_index);
+    }
+}
+
+
+uint8_t watcher_mark_dirty_ptr(watcher_t *watcher, const void *pointer) {
+    uint8_t found = 0;
+
+    if (!watcher->dirty_tracking || !WATCHED_IN_BASE(watcher, pointer, 1)) {
+        return 0;
+    }
+    watched_key_t key = WATCHED_KEY(watcher, pointer);
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    const watcher_index_t *index = &watcher->pointers_index;
+    if (index->slots != NULL) {
+        // Several entries may watch the same pointer, so the whole probe sequence is visited
+        size_t slot = hash_key(&key, sizeof(key)) % index->capacity;
+        while (index->slots[slot] != INDEX_EMPTY_SLOT) {
+            watcher_size_t candidate = (watcher_size_t)(index->slots[slot] - 1);
+            if (watcher->entries.items[candidate].watched == key) {
+                watcher->dirty[DIRTY_WORD(candidate)] |= DIRTY_BIT(candidate);
+                found = 1;
+            }
+            slot = (slot + 1) % index->capacity;
+        }
+        return found;
+    }
+#endif
+
+    watcher_size_t i = 0;
+    for (i = 0; i < watcher->entries.num; i++) {
+        if (watcher->entries.items[i].watched == key) {
+            watcher->dirty[DIRTY_WORD(i)] |= DIRTY_BIT(i);
+            found = 1;
+        }
+    }
+    return found;
+}
+
+
+void watcher_trigger_entry(watcher_t *watcher, int16_t entry_index) {
+    // Invalid index
+    if (entry_index < 0 || entry_index >= watcher->entries.num ||
+        ENTRY_IS_REMOVED(watcher->entries.items[entry_index])) {
+        return;
+    }
+
+    watcher->busy++;
+    entry_refresh(&watcher->entries.items[entry_index]);
+    if (trigger_entry(watcher, (watcher_size_t)entry_index, 0) == DISPATCH_DONE &&
+        !ENTRY_IS_REMOVED(watcher->entries.items[entry_index])) {
+        // The callback may have moved the entries around
+        entry_update(watcher, &watcher->entries.items[entry_index]);
+    }
+    busy_leave(watcher);
+}
+
+
+void watcher_trigger_all(watcher_t *watcher) {
+    watcher_size_t i = 0;
+
+    watcher->busy++;
+    for (i = 0; i < watcher->entries.num; i++) {
+        if (ENTRY_IS_REMOVED(watcher->entries.items[i])) {
+            continue;
+        }
+        entry_refresh(&watcher->entries.items[i]);
+        if (trigger_entry(watcher, i, 0) == DISPATCH_DONE && !ENTRY_IS_REMOVED(watcher->entries.items[i])) {
+            entry_update(watcher, &watcher->entries.items[i]);
+        }
+    }
+    busy_leave(watcher);
+}
+
+
+void watcher_reset_all(watcher_t *watcher) {
+    watcher_size_t i = 0;
+
+    for (i = 0; i < watcher->entries.num; i++) {
+        if (!ENTRY_IS_REMOVED(watcher->entries.items[i])) {
+            entry_refresh(&watcher->entries.items[i]);
+            entry_update(watcher, &watcher->entries.items[i]);
+        }
+    }
+
+    for (i = 0; i < watcher->debouncers.num; i++) {
+        watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[i];
+        pdebouncer->triggered           = TRIGGER_STATE_INACTIVE;
+    }
+    watcher->deadlines          = 0;
+    watcher->pending_debouncers = 0;
+}
+
+
+#ifdef C_WATCHER_TRACE
+void watcher_set_trace_hooks(watcher_t *watcher, const watcher_trace_hooks_t *hooks) {
+    if (hooks != NULL) {
+        watcher->trace = *hooks;
+    } else {
+        memset(&watcher->trace, 0, sizeof(watcher->trace));
+    }
+}
+#endif
+
+
+#ifdef C_WATCHER_STATS
+void watcher_get_stats(const watcher_t *watcher, watcher_stats_t *stats) {
+    *stats = watcher->stats;
+}
+
+
+watcher_result_t watcher_get_entry_stats(const watcher_t *watcher, watcher_size_t entry_index,
+                                         watcher_entry_stats_t *stats) {
+    if (entry_index >= watcher->entries.num || ENTRY_IS_REMOVED(watcher->entries.items[entry_index])) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    *stats = watcher->entries.items[entry_index].stats;
+    return WATCHER_RESULT_OK;
+}
+
+
+void watcher_reset_stats(watcher_t *watcher) {
+    watcher_size_t i = 0;
+
+    memset(&watcher->stats, 0, sizeof(watcher->stats));
+    for (i = 0; i < watcher->entries.num; i++) {
+        memset(&watcher->entries.items[i].stats, 0, sizeof(watcher_entry_stats_t));
+    }
+}
+#endif
+
+
+watcher_handle_t watcher_get_handle(watcher_t *watcher, watcher_size_t entry_index) {
+    if (entry_index >= watcher->entries.num || ENTRY_IS_REMOVED(watcher->entries.items[entry_index])) {
+        return WATCHER_INVALID_HANDLE;
+    }
+    if (watcher->handles.capacity == 0 &&
+        (watcher->fn_realloc == NULL || handles_enable(watcher) != WATCHER_RESULT_OK)) {
+        return WATCHER_INVALID_HANDLE;
+    }
+
+    size_t slot = watcher->entries.items[entry_index].handle_index;
+    if (slot >> HANDLE_INDEX_BITS) {
+        // Does not fit in a handle
+        return WATCHER_INVALID_HANDLE;
+    }
+    return HANDLE_MAKE(slot, watcher->handles.items[slot].generation);
+}
+
+
+watcher_result_t watcher_get_entry_index(watcher_t *watcher, watcher_handle_t handle, watcher_size_t *entry_index) {
+    return handle_lookup(watcher, handle, entry_index) ? WATCHER_RESULT_OK : WATCHER_RESULT_INVALID_ARGS;
+}
+
+
+watcher_result_t watcher_remove_entry(watcher_t *watcher, watcher_handle_t handle) {
+    watcher_size_t entry_index = 0;
+
+    if (!handle_lookup(watcher, handle, &entry_index)) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    handle_release(watcher, HANDLE_SLOT(handle));
+
+    if (watcher->busy > 0) {
+        // Callbacks are running and the scan goes by index: the entry is dropped once they are done
+        watcher->entries.items[entry_index].flags |= ENTRY_FLAG_REMOVED;
+        watcher->removed++;
+    } else {
+        // The hole is filled by the last entry of the tier, the one this leaves by the last entry of the next tier
+        // and so on, keeping tiers dense
+        watcher_size_t hole = entry_index;
+        size_t         t    = 0;
+        entry_release(watcher, entry_index);
+        for (t = watcher->entries.items[entry_index].tier; t < C_WATCHER_TIERS; t++) {
+            watcher_size_t last = (watcher_size_t)(watcher->tiers[t].end - 1);
+            if (last != hole) {
+                entry_move(watcher, last, hole);
+            }
+            hole = last;
+            watcher->tiers[t].end--;
+        }
+        watcher->entries.num--;
+    }
+
+    return WATCHER_RESULT_OK;
+}
+
+
+watcher_result_t watcher_compact(watcher_t *watcher) {
+    if (watcher->fn_realloc == NULL || watcher->busy > 0) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+
+    size_t most = watcher->callbacks.num;
+    if (watcher->args.num > most) {
+        most = watcher->args.num;
+    }
+    if (watcher->delays.num > most) {
+        most = watcher->delays.num;
+    }
+
+    if (most > 0) {
+        watcher_size_t *remap = reallocate(watcher, NULL, most * sizeof(watcher_size_t));
+        if (remap == NULL) {
+            return WATCHER_RESULT_ALLOC_ERROR;
+        }
+
+        watcher_entry_t     *entries    = watcher->entries.items;
+        watcher_debouncer_t *debouncers = watcher->debouncers.items;
+        size_t               count      = watcher->entries.num;
+        watcher->callbacks.num =
+            reclaim(watcher->callbacks.items, watcher->callbacks.num, sizeof(watcher_callback_t),
+                    count > 0 ? &entries[0].callback_index : NULL, sizeof(watcher_callback_index_t),
+                    sizeof(watcher_entry_t), count, remap);
+        watcher->args.num =
+            reclaim(watcher->args.items, watcher->args.num, sizeof(void *), count > 0 ? &entries[0].arg_index : NULL,
+                    sizeof(watcher_callback_index_t), sizeof(watcher_entry_t), count, remap);
+        count             = watcher->debouncers.num;
+        watcher->delays.num =
+            reclaim(watcher->delays.items, watcher->delays.num, sizeof(unsigned long),
+                    count > 0 ? &debouncers[0].delay_index : NULL, sizeof(watcher_size_t), sizeof(watcher_debouncer_t),
+                    count, remap);
+        watcher->fn_free(remap);
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+        index_rebuild(watcher, &watcher->callbacks_index, watcher->callbacks.items, watcher->callbacks.num,
+                      sizeof(watcher_callback_t));
+        index_rebuild(watcher, &watcher->args_index, watcher->args.items, watcher->args.num, sizeof(void *));
+        index_rebuild(watcher, &watcher->delays_index, watcher->delays.items, watcher->delays.num,
+                      sizeof(unsigned long));
+#endif
+    }
+
+    watcher_result_t result = shadow_repack(watcher);
+    if (result != WATCHER_RESULT_OK) {
+        return result;
+    }
+
+    VECTOR_SHRINK(watcher->entries);
+    VECTOR_SHRINK(watcher->callbacks);
+    VECTOR_SHRINK(watcher->args);
+    VECTOR_SHRINK(watcher->delays);
+    VECTOR_SHRINK(watcher->debouncers);
+    return WATCHER_RESULT_OK;
+}
+
+
+static watcher_result_t add_callback(watcher_t *watcher, watcher_callback_t callback, watcher_size_t *callback_index) {
+    if (!lookup(WATCHER_INDEX(callbacks_index), watcher->callbacks.items, watcher->callbacks.num,
+                sizeof(watcher->callbacks.items[0]), &callback, callback_index)) {
+        if (callback_index_full(watcher->callbacks.num)) {
+            return WATCHER_RESULT_STATIC_OVERFLOW;
+        }
+        GROW_OR_FAIL(callbacks);
+        *callback_index = watcher->callbacks.num;
+        VECTOR_APPEND(watcher->callbacks, callback);
+        index_insert(watcher, WATCHER_INDEX(callbacks_index), watcher->callbacks.items, watcher->callbacks.num,
+                     sizeof(watcher->callbacks.items[0]), *callback_index);
+    }
+
+    return WATCHER_RESULT_OK;
+}
+
+
+static watcher_result_t add_arg(watcher_t *watcher, void *arg, watcher_size_t *arg_index) {
+    if (!lookup(WATCHER_INDEX(args_index), watcher->args.items, watcher->args.num,
+                sizeof(watcher->args.items[0]), &arg, arg_index)) {
+        if (callback_index_full(watcher->args.num)) {
+            return WATCHER_RESULT_STATIC_OVERFLOW;
+        }
+        GROW_OR_FAIL(args);
+        *arg_index = watcher->args.num;
+        VECTOR_APPEND(watcher->args, arg);
+        index_insert(watcher, WATCHER_INDEX(args_index), watcher->args.items, watcher->args.num,
+                     sizeof(watcher->args.items[0]), *arg_index);
+    }
+
+    return WATCHER_RESULT_OK;
+}
+
+
+static watcher_result_t add_delay(watcher_t *watcher, unsigned long delay, watcher_size_t *delay_index) {
+    if (!lookup(WATCHER_INDEX(delays_index), watcher->delays.items, watcher->delays.num,
+                sizeof(watcher->delays.items[0]), &delay, delay_index)) {
+        GROW_OR_FAIL(delays);
+        *delay_index = watcher->delays.num;
+        VECTOR_APPEND(watcher->delays, delay);
+        index_insert(watcher, WATCHER_INDEX(delays_index), watcher->delays.items, watcher->delays.num,
+                     sizeof(watcher->delays.items[0]), *delay_index);
+    }
+
+    return WATCHER_RESULT_OK;
+}
+
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+static size_t hash_key(const void *key, size_t size) {
+    // Keys are pointers or integers: pad them to 64 bits and mix them with the murmur3 finalizer
+    uint64_t value = 0;
+    memcpy(&value, key, size < sizeof(value) ? size : sizeof(value));
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return (size_t)value;
+}
+
+
+static void index_place(watcher_index_t *index, const void *items, size_t item_size, watcher_size_t position) {
+    size_t slot = hash_key((const uint8_t *)items + (size_t)position * item_size, item_size) % index->capacity;
+    while (index->slots[slot] != INDEX_EMPTY_SLOT) {
+        slot = (slot + 1) % index->capacity;
+    }
+    index->slots[slot] = (watcher_size_t)(position + 1);
+}
+
+
+static void pointers_index_place(watcher_t *watcher, watcher_size_t position) {
+    watcher_index_t *index = &watcher->pointers_index;
+    size_t           slot  = hash_key(&watcher->entries.items[position].watched, WATCHED_KEY_SIZE) % index->capacity;
+    while (index->slots[slot] != INDEX_EMPTY_SLOT) {
+        slot = (slot + 1) % index->capacity;
+    }
+    index->slots[slot] = (watcher_size_t)(position + 1);
+}
+
+
+static void pointers_index_insert(watcher_t *watcher, watcher_size_t position) {
+    watcher_index_t *index = &watcher->pointers_index;
+    watcher_size_t   num   = (watcher_size_t)(position + 1);
+
+    if (index->capacity < 2 * (size_t)num && watcher->fn_realloc != NULL) {
+        size_t capacity = index->capacity > 0 ? index->capacity : 2 * C_WATCHER_MIN_CAPACITY;
+        while (capacity < 2 * (size_t)num) {
+            capacity *= 2;
+        }
+
+        watcher->fn_free(index->slots);
+        index->slots    = reallocate(watcher, NULL, capacity * sizeof(watcher_size_t));
+        index->capacity = index->slots != NULL ? capacity : 0;
+        if (index->slots == NULL) {
+            return;
+        }
+
+        memset(index->slots, INDEX_EMPTY_SLOT, capacity * sizeof(watcher_size_t));
+        watcher_size_t i = 0;
+        for (i = 0; i < position; i++) {
+            pointers_index_place(watcher, i);
+        }
+    }
+
+    if (index->slots != NULL) {
+        pointers_index_place(watcher, position);
+    }
+}
+
+
+// Returns the slot holding an entry, the capacity if it is not there
+static size_t pointers_index_find(const watcher_t *watcher, watcher_size_t position) {
+    const watcher_index_t *index = &watcher->pointers_index;
+    size_t slot = hash_key(&watcher->entries.items[position].watched, WATCHED_KEY_SIZE) % index->capacity;
+    while (index->slots[slot] != INDEX_EMPTY_SLOT) {
+        if (index->slots[slot] == (watcher_size_t)(position + 1)) {
+            return slot;
+        }
+        slot = (slot + 1) % index->capacity;
+    }
+    return index->capacity;
+}
+
+
+static void pointers_index_remove(watcher_t *watcher, watcher_size_t position) {
+    watcher_index_t *index = &watcher->pointers_index;
+    size_t           hole  = pointers_index_find(watcher, position);
+    size_t           slot  = hole;
+
+    if (hole == index->capacity) {
+        return;
+    }
+
+    // Backward shift: the items further along the probe sequence that may fill the hole are moved into it, so that
+    // lookups still reach them without tombstones
+    for (;;) {
+        slot = (slot + 1) % index->capacity;
+        if (index->slots[slot] == INDEX_EMPTY_SLOT) {
+            break;
+        }
+
+        const void *watched = &watcher->entries.items[index->slots[slot] - 1].watched;
+        size_t      home    = hash_key(watched, WATCHED_KEY_SIZE) % index->capacity;
+        // Cyclic distances from where the item hashes to
+        if ((slot + index->capacity - home) % index->capacity >= (slot + index->capacity - hole) % index->capacity) {
+            index->slots[hole] = index->slots[slot];
+            hole               = slot;
+        }
+    }
+    index->slots[hole] = INDEX_EMPTY_SLOT;
+}
+
+
+static void pointers_index_rename(watcher_t *watcher, watcher_size_t from, watcher_size_t to) {
+    watcher_index_t *index = &watcher->pointers_index;
+    size_t           slot  = pointers_index_find(watcher, from);
+    if (slot < index->capacity) {
+        index->slots[slot] = (watcher_size_t)(to + 1);
+    }
+}
+
+
+// Drops an index and builds it anew for the items left
+static void index_rebuild(watcher_t *watcher, watcher_index_t *index, const void *items, watcher_size_t num,
+                          size_t item_size) {
+    watcher->fn_free(index->slots);
+    INDEX_INIT((*index));
+    if (num > 0) {
+        index_insert(watcher, index, items, num, item_size, (watcher_size_t)(num - 1));
+    }
+}
+#endif
+
+
+static uint8_t lookup(const watcher_index_t *index, const void *items, watcher_size_t num, size_t item_size,
+                      const void *key, watcher_size_t *position) {
+    const uint8_t *bytes = items;
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    if (index->slots != NULL) {
+        size_t slot = hash_key(key, item_size) % index->capacity;
+        while (index->slots[slot] != INDEX_EMPTY_SLOT) {
+            watcher_size_t candidate = (watcher_size_t)(index->slots[slot] - 1);
+            if (memcmp(&bytes[(size_t)candidate * item_size], key, item_size) == 0) {
+                *position = candidate;
+                return 1;
+            }
+            slot = (slot + 1) % index->capacity;
+        }
+        return 0;
+    }
+#else
+    (void)index;
+#endif
+
+    watcher_size_t i = 0;
+    for (i = 0; i < num; i++) {
+        if (memcmp(&bytes[(size_t)i * item_size], key, item_size) == 0) {
+            *position = i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static void index_insert(watcher_t *watcher, watcher_index_t *index, const void *items, watcher_size_t num,
+                         size_t item_size, watcher_size_t position) {
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    // Keep the load factor at or below 50%
+    if (index->capacity < 2 * (size_t)num) {
+        if (watcher->fn_realloc == NULL) {
+            // A static index that is too small is dropped in favour of linear lookups
+            index->slots    = NULL;
+            index->capacity = 0;
+            return;
+        }
+
+        size_t          capacity = index->capacity > 0 ? index->capacity : 2 * C_WATCHER_MIN_CAPACITY;
+        watcher_size_t *slots    = NULL;
+        while (capacity < 2 * (size_t)num) {
+            capacity *= 2;
+        }
+
+        // Rehash everything into a fresh table; if memory is not available lookups degrade to linear scans
+        watcher->fn_free(index->slots);
+        slots           = reallocate(watcher, NULL, capacity * sizeof(watcher_size_t));
+        index->slots    = slots;
+        index->capacity = slots != NULL ? capacity : 0;
+        if (slots == NULL) {
+            return;
+        }
+
+        memset(slots, INDEX_EMPTY_SLOT, capacity * sizeof(watcher_size_t));
+        watcher_size_t i = 0;
+        for (i = 0; i < num; i++) {
+            index_place(index, items, item_size, i);
+        }
+    } else if (index->slots != NULL) {
+        index_place(index, items, item_size, position);
+    }
+#else
+    (void)watcher;
+    (void)index;
+    (void)items;
+    (void)num;
+    (void)item_size;
+    (void)position;
+#endif
+}
+
+
+static watcher_size_t next_capacity(watcher_size_t capacity) {
+    size_t new_capacity = capacity < C_WATCHER_MIN_CAPACITY ? C_WATCHER_MIN_CAPACITY : (size_t)capacity * 2;
+    return new_capacity > C_WATCHER_MAX_ENTRIES ? C_WATCHER_MAX_ENTRIES : (watcher_size_t)new_capacity;
+}
+
+
+// Every allocation of a dynamically allocated watcher goes through here
+static void *reallocate(watcher_t *watcher, void *pointer, size_t size) {
+    void *memory = watcher->fn_realloc(pointer, size);
+#ifdef C_WATCHER_STATS
+    if (memory != NULL) {
+        watcher->stats.allocations++;
+        watcher->stats.allocated_bytes += size;
+    }
+#endif
+    return memory;
+}
+
+
+static watcher_result_t add_entry(watcher_t *watcher, const watcher_entry_descriptor_t *descriptor,
+                                  watcher_size_t *entry_index) {
+    void    *old_buffer  = descriptor->old_buffer;
+    uint8_t *shadow      = watcher->shadow.memory;
+    size_t   shadow_used = watcher->shadow.used;
+    size_t   size        = shadow_size(entry_mode(descriptor), descriptor->size);
+
+    if (old_buffer != NULL || size == 0) {
+        // Either the caller provided the buffer or the old value fits in the old_buffer field itself
+    } else {
+        old_buffer = shadow_alloc(watcher, size);
+        if (old_buffer == NULL) {
+            return watcher->fn_realloc == NULL ? WATCHER_RESULT_STATIC_OVERFLOW : WATCHER_RESULT_ALLOC_ERROR;
+        }
+    }
+
+    void *snapshot = NULL;
+#ifdef C_WATCHER_CONCURRENT
+    if (descriptor->seqlock != NULL) {
+        snapshot = shadow_alloc(watcher, descriptor->size);
+        if (snapshot == NULL) {
+            return watcher->fn_realloc == NULL ? WATCHER_RESULT_STATIC_OVERFLOW : WATCHER_RESULT_ALLOC_ERROR;
+        }
+    }
+#endif
+
+    watcher_result_t result = add_entry_static(watcher, descriptor, old_buffer, snapshot, entry_index);
+    if (result != WATCHER_RESULT_OK && (SHADOW_SINGLE_REGION || watcher->shadow.memory == shadow)) {
+        // Give the old value buffer back if it was carved from the same region
+        watcher->shadow.used = shadow_used;
+    } else if (result == WATCHER_RESULT_OK && old_buffer != descriptor->old_buffer) {
+        // watcher_compact may move it
+        watcher->entries.items[*entry_index].flags |= ENTRY_FLAG_SHADOW;
+    }
+    return result;
+}
+
+
+static void *shadow_alloc(watcher_t *watcher, size_t size) {
+    size_t offset = ALIGN_UP(watcher->shadow.used, C_WATCHER_SHADOW_ALIGNMENT);
+
+    if (watcher->shadow.memory == NULL || offset > watcher->shadow.capacity ||
+        watcher->shadow.capacity - offset < size) {
+        if (watcher->fn_realloc == NULL || !shadow_grow(watcher, size)) {
+            return NULL;
+        }
+        // A new slab is carved from its start, while a single region keeps what it held
+        offset = SHADOW_SINGLE_REGION ? offset : 0;
+    }
+
+    watcher->shadow.used = offset + size;
+    return &watcher->shadow.memory[offset];
+}
+
+
+static uint8_t shadow_grow(watcher_t *watcher, size_t size) {
+    // Slabs double in size so the number of allocations stays logarithmic in the total shadow memory
+    size_t capacity = watcher->shadow.capacity * 2;
+    if (capacity < C_WATCHER_SHADOW_SLAB_SIZE) {
+        capacity = C_WATCHER_SHADOW_SLAB_SIZE;
+    }
+    if (capacity < size) {
+        capacity = size;
+    }
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    // The region keeps what it holds, so it must fit that too, and stay within reach of the offsets
+    size_t used = ALIGN_UP(watcher->shadow.used, C_WATCHER_SHADOW_ALIGNMENT);
+    if (capacity < used + size) {
+        capacity = used + size;
+    }
+    if ((uint64_t)capacity > UINT32_MAX) {
+        return 0;
+    }
+#endif
+
+    struct watcher_shadow_slab *slab =
+        reallocate(watcher, NULL, sizeof(struct watcher_shadow_slab) + C_WATCHER_SHADOW_ALIGNMENT + capacity);
+    if (slab == NULL) {
+        return 0;
+    }
+
+    uint8_t *memory = (uint8_t *)ALIGN_UP((uintptr_t)slab->memory, C_WATCHER_SHADOW_ALIGNMENT);
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    // Entries hold offsets into the region, so it moves as a whole
+    if (watcher->shadow.memory != NULL) {
+        memcpy(memory, watcher->shadow.memory, watcher->shadow.used);
+    }
+#else
+    watcher->shadow.used = 0;
+#endif
+
+    slab->next               = watcher->shadow.slabs;
+    slab->capacity           = capacity;
+    watcher->shadow.slabs    = slab;
+    watcher->shadow.memory   = memory;
+    watcher->shadow.capacity = capacity;
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    shadow_release_retired(watcher);
+#endif
+    return 1;
+}
+
+
+#ifdef C_WATCHER_COMPACT_ENTRIES
+// Frees the regions the shadow moved out of, unless a running callback may still be reading an old value from them
+static void shadow_release_retired(watcher_t *watcher) {
+    if (watcher->busy > 0 || watcher->shadow.slabs == NULL) {
+        return;
+    }
+
+    struct watcher_shadow_slab *slab = watcher->shadow.slabs->next;
+    while (slab != NULL) {
+        struct watcher_shadow_slab *next = slab->next;
+        watcher->fn_free(slab);
+        slab = next;
+    }
+    watcher->shadow.slabs->next = NULL;
+}
+#endif
+
+
+// Moves the old value buffers and snapshots of the entries, in entry order, to a single slab that fits them exactly
+static watcher_result_t shadow_repack(watcher_t *watcher) {
+    size_t                      total  = shadow_total(watcher);
+    size_t                      used   = 0;
+    uint8_t                    *memory = NULL;
+    struct watcher_shadow_slab *slab   = NULL;
+    watcher_size_t              i      = 0;
+
+    if (total > 0) {
+        slab = reallocate(watcher, NULL, sizeof(struct watcher_shadow_slab) + C_WATCHER_SHADOW_ALIGNMENT + total);
+        if (slab == NULL) {
+            return WATCHER_RESULT_ALLOC_ERROR;
+        }
+        slab->next     = NULL;
+        slab->capacity = total;
+        memory         = (uint8_t *)ALIGN_UP((uintptr_t)slab->memory, C_WATCHER_SHADOW_ALIGNMENT);
+    }
+
+    for (i = 0; i < watcher->entries.num; i++) {
+        watcher_entry_t *entry = &watcher->entries.items[i];
+        if (entry->flags & ENTRY_FLAG_SHADOW) {
+            // Hashed copies point past the hash
+            size_t   offset = entry->mode == WATCHER_ENTRY_MODE_HASH_COPY ? HASH_SIZE : 0;
+            uint8_t *buffer = (uint8_t *)ENTRY_OLD_BUFFER(watcher, *entry) - offset;
+            size_t   size   = shadow_size(entry->mode, entry->size);
+
+            used = ALIGN_UP(used, C_WATCHER_SHADOW_ALIGNMENT);
+            memcpy(&memory[used], buffer, size);
+#ifdef C_WATCHER_COMPACT_ENTRIES
+            // Relative to the new region, which replaces the current one below
+            entry->old_buffer = (uint32_t)(used + offset);
+#else
+            entry->old_buffer = &memory[used + offset];
+#endif
+            used += size;
+        }
+#ifdef C_WATCHER_CONCURRENT
+        if (ENTRY_IS_SEQLOCKED(*entry)) {
+            used = ALIGN_UP(used, C_WATCHER_SHADOW_ALIGNMENT);
+            memcpy(&memory[used], entry->snapshot, entry->size);
+            entry->snapshot = &memory[used];
+            used += entry->size;
+        }
+#endif
+    }
+
+    struct watcher_shadow_slab *old = watcher->shadow.slabs;
+    while (old != NULL) {
+        struct watcher_shadow_slab *next = old->next;
+        watcher->fn_free(old);
+        old = next;
+    }
+
+    watcher->shadow.slabs    = slab;
+    watcher->shadow.memory   = memory;
+    watcher->shadow.used     = used;
+    watcher->shadow.capacity = total;
+    return WATCHER_RESULT_OK;
+}
+
+
+// Bytes of shadow memory taken by the old value buffers and snapshots of the entries, carved in entry order from a
+// single aligned region
+static size_t shadow_total(const watcher_t *watcher) {
+    size_t         total = 0;
+    watcher_size_t i     = 0;
+
+    for (i = 0; i < watcher->entries.num; i++) {
+        const watcher_entry_t *entry = &watcher->entries.items[i];
+        if (entry->flags & ENTRY_FLAG_SHADOW) {
+            total = ALIGN_UP(total, C_WATCHER_SHADOW_ALIGNMENT) + shadow_size(entry->mode, entry->size);
+        }
+        if (ENTRY_IS_SEQLOCKED(*entry)) {
+            total = ALIGN_UP(total, C_WATCHER_SHADOW_ALIGNMENT) + entry->size;
+        }
+    }
+    return total;
+}
+
+
+// Reads an index field of ref_size bytes
+static inline size_t reference_get(const uint8_t *reference, size_t ref_size) {
+    if (ref_size == sizeof(uint8_t)) {
+        return *reference;
+    } else if (ref_size == sizeof(uint16_t)) {
+        return *(const uint16_t *)(const void *)reference;
+    } else {
+        return *(const uint32_t *)(const void *)reference;
+    }
+}
+
+
+static inline void reference_set(uint8_t *reference, size_t ref_size, size_t value) {
+    if (ref_size == sizeof(uint8_t)) {
+        *reference = (uint8_t)value;
+    } else if (ref_size == sizeof(uint16_t)) {
+        *(uint16_t *)(void *)reference = (uint16_t)value;
+    } else {
+        *(uint32_t *)(void *)reference = (uint32_t)value;
+    }
+}
+
+
+// Compacts the items of a vector to the ones referenced by the index fields of ref_size bytes found every stride bytes
+// from references, rewriting them; returns the items left
+static watcher_size_t reclaim(void *items, watcher_size_t num, size_t item_size, void *references, size_t ref_size,
+                              size_t stride, size_t count, watcher_size_t *remap) {
+    uint8_t       *bytes = items;
+    uint8_t       *refs  = references;
+    watcher_size_t kept  = 0;
+    size_t         i     = 0;
+
+    for (i = 0; i < num; i++) {
+        remap[i] = RECLAIM_UNUSED;
+    }
+    for (i = 0; i < count; i++) {
+        remap[reference_get(&refs[i * stride], ref_size)] = 0;
+    }
+
+    for (i = 0; i < num; i++) {
+        if (remap[i] != RECLAIM_UNUSED) {
+            if (kept != i) {
+                memcpy(&bytes[(size_t)kept * item_size], &bytes[i * item_size], item_size);
+            }
+            remap[i] = kept++;
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        reference_set(&refs[i * stride], ref_size, remap[reference_get(&refs[i * stride], ref_size)]);
+    }
+    return kept;
+}
+
+
+// Gives every entry a handle slot
+static watcher_result_t handles_enable(watcher_t *watcher) {
+    watcher_size_t i = 0;
+
+    RESERVE_OR_FAIL(handles,
+                    watcher->entries.capacity > C_WATCHER_MIN_CAPACITY ? watcher->entries.capacity
+                                                                       : C_WATCHER_MIN_CAPACITY);
+    for (i = 0; i < watcher->entries.num; i++) {
+        watcher_handle_slot_t slot = {.entry_index = i, .generation = 1};
+        watcher->handles.items[i]                  = slot;
+        watcher->entries.items[i].handle_index     = i;
+    }
+    watcher->handles.num  = watcher->entries.num;
+    watcher->free_handles = WATCHER_NO_HANDLE;
+    return WATCHER_RESULT_OK;
+}
+
+
+// The caller makes sure a slot is available
+static watcher_size_t handle_take(watcher_t *watcher, watcher_size_t entry_index) {
+    watcher_size_t slot = watcher->free_handles;
+
+    if (slot != WATCHER_NO_HANDLE) {
+        watcher->free_handles = watcher->handles.items[slot].entry_index;
+    } else {
+        // Generation 0 is never used, so that WATCHER_INVALID_HANDLE is never valid
+        watcher_handle_slot_t new_slot = {.entry_index = 0, .generation = 1};
+        slot                           = watcher->handles.num;
+        VECTOR_APPEND(watcher->handles, new_slot);
+    }
+
+    watcher->handles.items[slot].entry_index = entry_index;
+    return slot;
+}
+
+
+static void handle_release(watcher_t *watcher, size_t slot) {
+    watcher_handle_slot_t *handle_slot = &watcher->handles.items[slot];
+
+    handle_slot->generation++;
+    if (handle_slot->generation == 0) {
+        handle_slot->generation = 1;
+    }
+    handle_slot->entry_index = watcher->free_handles;
+    watcher->free_handles    = (watcher_size_t)slot;
+}
+
+
+static uint8_t handle_lookup(const watcher_t *watcher, watcher_handle_t handle, watcher_size_t *entry_index) {
+    size_t slot = HANDLE_SLOT(handle);
+
+    if (slot >= watcher->handles.num || watcher->handles.items[slot].generation != HANDLE_GENERATION(handle)) {
+        return 0;
+    }
+    *entry_index = watcher->handles.items[slot].entry_index;
+    return 1;
+}
+
+
+// Drops whatever refers to an entry that is about to be overwritten or truncated
+static void entry_release(watcher_t *watcher, watcher_size_t entry_index) {
+    const watcher_entry_t *entry = &watcher->entries.items[entry_index];
+
+    if (ENTRY_IS_DEBOUNCED(*entry)) {
+        debouncer_remove(watcher, entry->debouncer_index);
+    }
+    if (ENTRY_IS_BATCHED(*entry)) {
+        watcher->batched_entries--;
+    }
+    if (watcher->dirty_tracking) {
+#ifndef C_WATCHER_LINEAR_LOOKUP
+        if (watcher->pointers_index.slots != NULL) {
+            pointers_index_remove(watcher, entry_index);
+        }
+#endif
+        watcher->dirty[DIRTY_WORD(entry_index)] &= ~DIRTY_BIT(entry_index);
+    }
+}
+
+
+// Moves an entry to another position, updating everything that refers to it
+static void entry_move(watcher_t *watcher, watcher_size_t from, watcher_size_t to) {
+    if (watcher->dirty_tracking) {
+#ifndef C_WATCHER_LINEAR_LOOKUP
+        if (watcher->pointers_index.slots != NULL) {
+            pointers_index_rename(watcher, from, to);
+        }
+#endif
+        if (watcher->dirty[DIRTY_WORD(from)] & DIRTY_BIT(from)) {
+            watcher->dirty[DIRTY_WORD(to)] |= DIRTY_BIT(to);
+        } else {
+            watcher->dirty[DIRTY_WORD(to)] &= ~DIRTY_BIT(to);
+        }
+        watcher->dirty[DIRTY_WORD(from)] &= ~DIRTY_BIT(from);
+    }
+
+    // Small old values live in the entry itself and move along with it
+    watcher->entries.items[to] = watcher->entries.items[from];
+    entry_relink(watcher, to);
+}
+
+
+// Exchanges two entries, updating everything that refers to them
+static void entry_swap(watcher_t *watcher, watcher_size_t a, watcher_size_t b) {
+    if (a == b) {
+        return;
+    }
+
+    if (watcher->dirty_tracking) {
+#ifndef C_WATCHER_LINEAR_LOOKUP
+        watcher_index_t *index = &watcher->pointers_index;
+        if (index->slots != NULL) {
+            // Both are looked up before either changes, as they may share a probe sequence
+            size_t slot_a = pointers_index_find(watcher, a);
+            size_t slot_b = pointers_index_find(watcher, b);
+            if (slot_a < index->capacity) {
+                index->slots[slot_a] = (watcher_size_t)(b + 1);
+            }
+            if (slot_b < index->capacity) {
+                index->slots[slot_b] = (watcher_size_t)(a + 1);
+            }
+        }
+#endif
+        uint32_t dirty_a = watcher->dirty[DIRTY_WORD(a)] & DIRTY_BIT(a);
+        uint32_t dirty_b = watcher->dirty[DIRTY_WORD(b)] & DIRTY_BIT(b);
+        watcher->dirty[DIRTY_WORD(a)] &= ~DIRTY_BIT(a);
+        watcher->dirty[DIRTY_WORD(b)] &= ~DIRTY_BIT(b);
+        if (dirty_a) {
+            watcher->dirty[DIRTY_WORD(b)] |= DIRTY_BIT(b);
+        }
+        if (dirty_b) {
+            watcher->dirty[DIRTY_WORD(a)] |= DIRTY_BIT(a);
+        }
+    }
+
+    watcher_entry_t entry     = watcher->entries.items[a];
+    watcher->entries.items[a] = watcher->entries.items[b];
+    watcher->entries.items[b] = entry;
+    entry_relink(watcher, a);
+    entry_relink(watcher, b);
+}
+
+
+// Points the handle and the debouncer of an entry to its position
+static void entry_relink(watcher_t *watcher, watcher_size_t entry_index) {
+    const watcher_entry_t *entry = &watcher->entries.items[entry_index];
+    if (entry->handle_index != WATCHER_NO_HANDLE) {
+        watcher->handles.items[entry->handle_index].entry_index = entry_index;
+    }
+    if (ENTRY_IS_DEBOUNCED(*entry)) {
+        watcher->debouncers.items[entry->debouncer_index].entry_index = entry_index;
+    }
+}
+
+
+static void tiers_init(watcher_t *watcher) {
+    size_t t = 0;
+    for (t = 0; t < C_WATCHER_TIERS; t++) {
+        watcher->tiers[t].end       = 0;
+        watcher->tiers[t].calls     = 1;
+        watcher->tiers[t].countdown = 1;
+        watcher->tiers[t].period    = 0;
+        watcher->tiers[t].last      = 0;
+    }
+}
+
+
+// Returns a bit for every tier to compare by this call
+static uint32_t tiers_due(watcher_t *watcher, unsigned long timestamp) {
+    uint32_t due = TIER_BIT(0);
+    size_t   t   = 0;
+
+    for (t = 1; t < C_WATCHER_TIERS; t++) {
+        watcher_tier_t *tier = &watcher->tiers[t];
+        if (tier->period > 0) {
+            if (time_after_or_equal(timestamp, tier->last + tier->period)) {
+                tier->last = timestamp;
+                due |= TIER_BIT(t);
+            }
+        } else if (--tier->countdown == 0) {
+            tier->countdown = tier->calls;
+            due |= TIER_BIT(t);
+        }
+    }
+    return due;
+}
+
+
+// Moves the first entry past the last tier to the end of its own tier, the first entry of each slower tier going to
+// the end of that tier in turn; returns its new index
+static watcher_size_t tier_place(watcher_t *watcher) {
+    watcher_size_t position = watcher->tiers[C_WATCHER_TIERS - 1].end;
+    size_t         t        = 0;
+
+    watcher->tiers[C_WATCHER_TIERS - 1].end++;
+    for (t = C_WATCHER_TIERS - 1; t > watcher->entries.items[position].tier; t--) {
+        watcher_size_t start = watcher->tiers[t - 1].end;
+        entry_swap(watcher, start, position);
+        position = start;
+        watcher->tiers[t - 1].end++;
+    }
+    return position;
+}
+
+
+// Drops the entries removed by callbacks, keeping the order of the others
+static void purge_removed(watcher_t *watcher) {
+    watcher_size_t kept = 0;
+    watcher_size_t i    = 0;
+    size_t         t    = 0;
+
+    for (i = 0; i < watcher->entries.num; i++) {
+        // Tiers shrink by the entries removed before their end
+        while (t < C_WATCHER_TIERS && watcher->tiers[t].end == i) {
+            watcher->tiers[t++].end = kept;
+        }
+
+        if (ENTRY_IS_REMOVED(watcher->entries.items[i])) {
+            entry_release(watcher, i);
+        } else {
+            if (kept != i) {
+                entry_move(watcher, i, kept);
+            }
+            kept++;
+        }
+    }
+
+    while (t < C_WATCHER_TIERS) {
+        watcher->tiers[t++].end = kept;
+    }
+
+    watcher->entries.num = kept;
+    watcher->removed     = 0;
+}
+
+
+// Leaves a function invoking callbacks
+static void busy_leave(watcher_t *watcher) {
+    watcher->busy--;
+    if (watcher->busy == 0 && watcher->removed > 0) {
+        purge_removed(watcher);
+    }
+    while (watcher->busy == 0 && watcher->tiers[C_WATCHER_TIERS - 1].end < watcher->entries.num) {
+        tier_place(watcher);
+    }
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    shadow_release_retired(watcher);
+#endif
+}
+
+
+static watcher_result_t add_entry_static(watcher_t *watcher, const watcher_entry_descriptor_t *descriptor,
+                                         void *old_buffer, void *snapshot, watcher_size_t *entry_index) {
+    unsigned long    delay  = descriptor->delay;
+    uint8_t          mode   = entry_mode(descriptor);
+    watcher_result_t result = WATCHER_RESULT_OK;
+
+    if (mode > WATCHER_ENTRY_MODE_HASH_COPY || descriptor->tier >= C_WATCHER_TIERS) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    // Spans are found against a full copy
+    uint8_t diff = descriptor->diff_callback != NULL;
+    if (diff && (mode != WATCHER_ENTRY_MODE_COPY || descriptor->batch_callback != NULL)) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+    // Unless the old value fits in the old_buffer field itself a buffer is required
+    if (shadow_size(mode, descriptor->size) > 0 && old_buffer == NULL) {
+        return WATCHER_RESULT_ALLOC_ERROR;
+    }
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    // Compact entries only reach the base region and old value buffers in the shadow region
+    if (!WATCHED_IN_BASE(watcher, descriptor->pointer, descriptor->size) ||
+        (old_buffer != NULL && !SHADOW_OWNS(watcher, old_buffer))) {
+        return WATCHER_RESULT_INVALID_ARGS;
+    }
+#endif
+#ifdef C_WATCHER_CONCURRENT
+    if (descriptor->seqlock != NULL && snapshot == NULL) {
+        return WATCHER_RESULT_ALLOC_ERROR;
+    }
+#else
+    (void)snapshot;
+#endif
+
+    GROW_OR_FAIL(entries);
+    if (watcher->dirty_tracking) {
+        if ((result = dirty_reserve(watcher, (size_t)watcher->entries.num + 1)) != WATCHER_RESULT_OK) {
+            return result;
+        }
+    }
+    // Once handles are enabled every entry takes a slot
+    if (watcher->handles.capacity > 0 && watcher->free_handles == WATCHER_NO_HANDLE) {
+        GROW_OR_FAIL(handles);
+    }
+
+    // Every batched entry may have a change pending at the same time
+    uint8_t batched = descriptor->batch_callback != NULL;
+    if (batched && watcher->changes.capacity <= watcher->batched_entries) {
+        if (watcher->fn_realloc != NULL && !VECTOR_AT_MAX_CAPACITY(watcher->changes)) {
+            VECTOR_GROW(watcher->changes);
+        } else {
+            return WATCHER_RESULT_STATIC_OVERFLOW;
+        }
+    }
+
+    // Batched and diff callbacks share the callbacks vector, the entry flags tell them apart
+    watcher_size_t     callback_index = 0;
+    watcher_callback_t callback       = descriptor->callback;
+    if (batched) {
+        callback = AS_CALLBACK(descriptor->batch_callback);
+    } else if (diff) {
+        callback = AS_CALLBACK(descriptor->diff_callback);
+    }
+    if ((result = add_callback(watcher, callback, &callback_index)) != WATCHER_RESULT_OK) {
+        return result;
+    }
+
+    watcher_size_t arg_index = 0;
+    if ((result = add_arg(watcher, descriptor->arg, &arg_index)) != WATCHER_RESULT_OK) {
+        return result;
+    }
+
+    watcher_entry_t entry = {
+        .watched         = WATCHED_KEY(watcher, descriptor->pointer),
+        .size            = descriptor->size,
+        .callback_index  = (watcher_callback_index_t)callback_index,
+        .arg_index       = (watcher_callback_index_t)arg_index,
+        .debouncer_index = WATCHER_NO_DEBOUNCER,
+        .mode            = mode,
+        .flags           = (uint8_t)((batched ? ENTRY_FLAG_BATCHED : 0) | (diff ? ENTRY_FLAG_DIFF : 0)),
+        .tier            = descriptor->tier,
+        .handle_index    = WATCHER_NO_HANDLE,
+        .stride          = diff ? (descriptor->stride > 0 ? descriptor->stride : 1) : 0,
+#ifdef C_WATCHER_CONCURRENT
+        .seqlock  = descriptor->seqlock,
+        .snapshot = snapshot,
+#endif
+    };
+    // The hash of hashed copies is kept right before the copy itself
+    ENTRY_SET_OLD_BUFFER(watcher, entry,
+                         mode == WATCHER_ENTRY_MODE_HASH_COPY ? (uint8_t *)old_buffer + HASH_SIZE : old_buffer);
+
+    // Every fallible step of a delayed entry is done before appending it, so a failure never leaves a
+    // half-configured entry behind
+    if (delay > 0) {
+        // Look for or add a new debouncer
+        watcher_size_t delay_index = 0;
+        if ((result = add_delay(watcher, delay, &delay_index)) != WATCHER_RESULT_OK) {
+            return result;
+        }
+
+        GROW_OR_FAIL(debouncers);
+
+        watcher_debouncer_t debounce_data = {
+            .deadline      = 0,
+            .delay_index   = delay_index,
+            .entry_index   = watcher->entries.num,
+            .heap          = 0,
+            .heap_position = 0,
+            .triggered     = TRIGGER_STATE_INACTIVE,
+        };
+
+        entry.debouncer_index = watcher->debouncers.num;
+        VECTOR_APPEND(watcher->debouncers, debounce_data);
+    }
+
+    if (watcher->handles.capacity > 0) {
+        entry.handle_index = handle_take(watcher, watcher->entries.num);
+    }
+
+    *entry_index = watcher->entries.num;
+    VECTOR_APPEND(watcher->entries, entry);
+    watcher->batched_entries += batched;
+    entry_refresh(&watcher->entries.items[*entry_index]);
+    entry_update(watcher, &watcher->entries.items[*entry_index]);
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    if (watcher->dirty_tracking) {
+        pointers_index_insert(watcher, *entry_index);
+    }
+#endif
+
+    // While callbacks run indexes stay put, the entry is placed in its tier afterwards
+    if (watcher->busy == 0) {
+        *entry_index = tier_place(watcher);
+    } else {
+        STATS_ADD(watcher->stats.late_entries, 1);
+    }
+
+    return WATCHER_RESULT_OK;
+}
+
+
+static inline uint8_t entry_mode(const watcher_entry_descriptor_t *descriptor) {
+    // Small regions are cheaper to copy than to hash, so a hashed copy of those is just a copy
+    if (descriptor->mode == WATCHER_ENTRY_MODE_HASH_COPY && FITS_INLINE(descriptor->size)) {
+        return WATCHER_ENTRY_MODE_COPY;
+    }
+    return descriptor->mode;
+}
+
+
+// Bytes of shadow memory an entry needs beyond its old_buffer field
+static inline size_t shadow_size(uint8_t mode, watcher_size_t size) {
+    switch (mode) {
+        case WATCHER_ENTRY_MODE_HASH:
+            return HASH_FITS_INLINE ? 0 : HASH_SIZE;
+        case WATCHER_ENTRY_MODE_HASH_COPY:
+            return HASH_SIZE + size;
+        default:
+            return FITS_INLINE(size) ? 0 : size;
+    }
+}
+
+
+static inline void *entry_hash_pointer(const watcher_t *watcher, const watcher_entry_t *entry) {
+    if (entry->mode == WATCHER_ENTRY_MODE_HASH) {
+        return HASH_FITS_INLINE ? (void *)(uintptr_t)&entry->old_buffer : ENTRY_OLD_BUFFER(watcher, *entry);
+    } else {
+        return (uint8_t *)ENTRY_OLD_BUFFER(watcher, *entry) - HASH_SIZE;
+    }
+}
+
+
+static inline uint8_t entry_changed(const watcher_t *watcher, const watcher_entry_t *entry) {
+    if (entry->mode == WATCHER_ENTRY_MODE_COPY) {
+        return region_differs(entry_value(watcher, entry), ENTRY_GET_OLD_BUFFER_POINTER(watcher, *entry), entry->size);
+    } else {
+        // Hashing reads the watched region once instead of comparing it against a full copy
+        uint64_t hash = region_hash(entry_value(watcher, entry), entry->size);
+        uint64_t old_hash;
+        memcpy(&old_hash, entry_hash_pointer(watcher, entry), HASH_SIZE);
+        if (hash != old_hash) {
+            return 1;
+        }
+        // A hashed copy double checks matching hashes, so collisions can never hide a change
+        return entry->mode == WATCHER_ENTRY_MODE_HASH_COPY &&
+               region_differs(entry_value(watcher, entry), ENTRY_OLD_BUFFER(watcher, *entry), entry->size);
+    }
+}
+
+
+static inline void entry_update(const watcher_t *watcher, watcher_entry_t *entry) {
+    if (entry->mode != WATCHER_ENTRY_MODE_COPY) {
+        uint64_t hash = region_hash(entry_value(watcher, entry), entry->size);
+        memcpy(entry_hash_pointer(watcher, entry), &hash, HASH_SIZE);
+        if (entry->mode == WATCHER_ENTRY_MODE_HASH) {
+            return;
+        }
+    }
+    region_copy(ENTRY_GET_OLD_BUFFER_POINTER(watcher, *entry), entry_value(watcher, entry), entry->size);
+    STATS_ADD(entry->stats.bytes_copied, entry->size);
+}
+
+
+static inline void *entry_old_value(const watcher_t *watcher, watcher_entry_t *entry) {
+    return entry->mode == WATCHER_ENTRY_MODE_HASH ? NULL : ENTRY_GET_OLD_BUFFER_POINTER(watcher, *entry);
+}
+
+
+// Value the entry is compared against and callbacks receive
+static inline const void *entry_value(const watcher_t *watcher, const watcher_entry_t *entry) {
+#ifdef C_WATCHER_CONCURRENT
+    (void)watcher;
+    return entry->seqlock != NULL ? entry->snapshot : entry->watched;
+#else
+    return ENTRY_WATCHED(watcher, *entry);
+#endif
+}
+
+
+// Brings the snapshot of an entry written concurrently up to date, waiting for writers if needed
+static inline void entry_refresh(watcher_entry_t *entry) {
+#ifdef C_WATCHER_CONCURRENT
+    if (entry->seqlock != NULL) {
+        entry_snapshot(entry, 0);
+    }
+#else
+    (void)entry;
+#endif
+}
+
+
+#ifdef C_WATCHER_CONCURRENT
+// Copies the memory of an entry while no writer holds its seqlock; gives up after `retries` attempts (0 for never)
+static uint8_t entry_snapshot(watcher_entry_t *entry, unsigned retries) {
+    unsigned attempts = 0;
+
+    for (;;) {
+        unsigned begin = atomic_load_explicit(entry->seqlock, memory_order_acquire);
+        if ((begin & 1) == 0) {
+            region_copy(entry->snapshot, entry->watched, entry->size);
+            STATS_ADD(entry->stats.bytes_copied, entry->size);
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(entry->seqlock, memory_order_relaxed) == begin) {
+                return 1;
+            }
+        }
+        if (retries > 0 && ++attempts >= retries) {
+            return 0;
+        }
+    }
+}
+
+
+static void merge_staged(watcher_t *watcher) {
+    watcher_staged_entry_t *node     = atomic_exchange_explicit(&watcher->staged, NULL, memory_order_acquire);
+    watcher_staged_entry_t *previous = NULL;
+
+    // The queue is a stack: reverse it so entries are registered in the order they were staged
+    while (node != NULL) {
+        watcher_staged_entry_t *next = node->next;
+        node->next                   = previous;
+        previous                     = node;
+        node                         = next;
+    }
+
+    for (node = previous; node != NULL;) {
+        // The node may be released as soon as it is done
+        watcher_staged_entry_t *next = node->next;
+        node->result                 = add_entry(watcher, &node->descriptor, &node->entry_index);
+        atomic_store_explicit(&node->done, 1, memory_order_release);
+        node = next;
+    }
+}
+#endif
+
+
+static uint8_t trigger_debouncer_entry(watcher_t *watcher, watcher_size_t debouncer_index) {
+    watcher_debouncer_t *pdebouncer  = &watcher->debouncers.items[debouncer_index];
+    watcher_size_t       entry_index = pdebouncer->entry_index;
+
+    pdebouncer->triggered = TRIGGER_STATE_INACTIVE;
+    if (ENTRY_IS_SKIPPED(watcher->entries.items[entry_index])) {
+        // Already reported by this call, or removed
+        return 0;
+    }
+
+    entry_refresh(&watcher->entries.items[entry_index]);
+    uint8_t result = dispatch(watcher, entry_index, 1);
+    if (result == DISPATCH_FAILED) {
+        // The event queue is full: fire again on the next call, hopefully after the consumer made room
+        pdebouncer->triggered = TRIGGER_STATE_ACTIVE;
+        pdebouncer->deadline  = watcher->timestamp + 1;
+        deadlines_push(watcher, debouncer_index);
+        return 0;
+    } else if (result == DISPATCH_DONE) {
+        // The callback may have moved the entries around
+        entry_update(watcher, &watcher->entries.items[entry_index]);
+    }
+    return 1;
+}
+
+
+// Invokes the callback of an entry, queues it or (if defer is set) adds it to the batched changes
+static uint8_t dispatch(watcher_t *watcher, watcher_size_t entry_index, uint8_t defer) {
+    watcher_entry_t *entry = &watcher->entries.items[entry_index];
+
+    if (watcher->events.capacity > 0) {
+        if (!event_push(watcher, entry, entry_index)) {
+            return DISPATCH_FAILED;
+        }
+        STATS_ADD(entry->stats.triggers, 1);
+        return DISPATCH_DONE;
+    }
+
+    STATS_ADD(entry->stats.triggers, 1);
+    if (ENTRY_IS_DIFF(*entry)) {
+        watcher_span_t spans[C_WATCHER_MAX_DIFF_SPANS];
+        const uint8_t *value = entry_value(watcher, entry);
+        watcher_size_t num   = diff_spans(entry_old_value(watcher, entry), value, entry->size, entry->stride, spans);
+        watcher_size_t i     = 0;
+        STATS_TIMED(watcher->entries.items[entry_index].stats.callback_time,
+                    TRACED(entry_index, 1,
+                           AS_DIFF_CALLBACK(watcher->callbacks.items[entry->callback_index])(
+                               spans, num, entry_old_value(watcher, entry), value, entry->size, watcher->user_ptr,
+                               watcher->args.items[entry->arg_index])));
+
+        // The callback may have moved the entries around; what it wrote outside of the spans is reported next time
+        entry              = &watcher->entries.items[entry_index];
+        uint8_t *old_value = entry_old_value(watcher, entry);
+        for (i = 0; i < num; i++) {
+            region_copy(&old_value[spans[i].offset], &value[spans[i].offset], spans[i].length);
+            STATS_ADD(entry->stats.bytes_copied, spans[i].length);
+        }
+        return DISPATCH_UPDATED;
+    } else if (!ENTRY_IS_BATCHED(*entry)) {
+        STATS_TIMED(watcher->entries.items[entry_index].stats.callback_time,
+                    TRACED(entry_index, 1,
+                           watcher->callbacks.items[entry->callback_index](
+                               entry_old_value(watcher, entry), entry_value(watcher, entry), entry->size,
+                               watcher->user_ptr, watcher->args.items[entry->arg_index])));
+        return DISPATCH_DONE;
+    } else if (defer) {
+        // Pointers are only taken by flush_changes, as the entries may move in the meantime
+        watcher_change_t change = {.entry_index = entry_index};
+        entry->flags |= ENTRY_FLAG_QUEUED;
+        VECTOR_APPEND(watcher->changes, change);
+        return DISPATCH_DEFERRED;
+    } else {
+        watcher_change_t change = {
+            .old_value   = entry_old_value(watcher, entry),
+            .new_value   = entry_value(watcher, entry),
+            .arg         = watcher->args.items[entry->arg_index],
+            .size        = entry->size,
+            .entry_index = entry_index,
+        };
+        STATS_TIMED(watcher->entries.items[entry_index].stats.callback_time,
+                    TRACED(entry_index, 1,
+                           AS_BATCH_CALLBACK(watcher->callbacks.items[entry->callback_index])(&change, 1,
+                                                                                              watcher->user_ptr)));
+        return DISPATCH_DONE;
+    }
+}
+
+
+static void flush_changes(watcher_t *watcher) {
+    watcher_size_t num   = watcher->changes.num;
+    watcher_size_t start = 0;
+    watcher_size_t i     = 0;
+
+    while (start < num) {
+        // Gathers the changes sharing the callback of the first one that is left
+        watcher_change_t *changes = watcher->changes.items;
+        if (ENTRY_IS_REMOVED(watcher->entries.items[changes[start].entry_index])) {
+            // Removed by a previous callback, the change is dropped
+            start++;
+            continue;
+        }
+
+        watcher_size_t callback_index = watcher->entries.items[changes[start].entry_index].callback_index;
+        watcher_size_t end            = start;
+
+        for (i = start; i < num; i++) {
+            const watcher_entry_t *entry = &watcher->entries.items[changes[i].entry_index];
+            if (entry->callback_index == callback_index && !ENTRY_IS_REMOVED(*entry)) {
+                watcher_change_t change = changes[i];
+                changes[i]              = changes[end];
+                changes[end]            = change;
+                end++;
+            }
+        }
+
+        // A previous callback may have moved the entries around
+        for (i = start; i < end; i++) {
+            watcher_entry_t *entry = &watcher->entries.items[changes[i].entry_index];
+            changes[i].old_value   = entry_old_value(watcher, entry);
+            changes[i].new_value   = entry_value(watcher, entry);
+            changes[i].arg         = watcher->args.items[entry->arg_index];
+            changes[i].size        = entry->size;
+        }
+
+#ifdef C_WATCHER_STATS
+        unsigned long stats_start = C_WATCHER_STATS_CLOCK();
+#endif
+        TRACED(changes[start].entry_index, end - start,
+               AS_BATCH_CALLBACK(watcher->callbacks.items[callback_index])(&changes[start], end - start,
+                                                                           watcher->user_ptr));
+#ifdef C_WATCHER_STATS
+        // Each change gets an even share of the time; the callback may have moved the changes around
+        unsigned long share = (C_WATCHER_STATS_CLOCK() - stats_start) / (end - start);
+        for (i = start; i < end; i++) {
+            watcher->entries.items[watcher->changes.items[i].entry_index].stats.callback_time += share;
+        }
+#endif
+        start = end;
+    }
+
+    for (i = 0; i < num; i++) {
+        watcher_entry_t *entry = &watcher->entries.items[watcher->changes.items[i].entry_index];
+        entry->flags &= (uint8_t)~ENTRY_FLAG_QUEUED;
+        if (!ENTRY_IS_REMOVED(*entry)) {
+            entry_update(watcher, entry);
+        }
+    }
+    watcher->changes.num = 0;
+}
+
+
+// Fills spans with the changed ranges of elements, merging adjacent ones; the last span stretches over whatever does
+// not fit. Returns the number of spans
+static watcher_size_t diff_spans(const uint8_t *old_value, const uint8_t *value, size_t size, size_t stride,
+                                 watcher_span_t *spans) {
+    // Unchanged stretches are skipped a block of whole elements at a time
+    size_t         block   = stride >= DIFF_BLOCK ? stride : DIFF_BLOCK / stride * stride;
+    size_t         offset  = 0;
+    size_t         element = 0;
+    watcher_size_t num     = 0;
+
+    for (offset = 0; offset < size; offset += block) {
+        size_t block_end = size - offset < block ? size : offset + block;
+        if (!region_differs(&old_value[offset], &value[offset], block_end - offset)) {
+            continue;
+        }
+
+        for (element = offset; element < block_end; element += stride) {
+            size_t length = block_end - element < stride ? block_end - element : stride;
+            if (!region_differs(&old_value[element], &value[element], length)) {
+                continue;
+            }
+
+            watcher_span_t *last = num > 0 ? &spans[num - 1] : NULL;
+            if (last != NULL && ((size_t)last->offset + last->length == element || num == C_WATCHER_MAX_DIFF_SPANS)) {
+                last->length = (watcher_size_t)(element + length - last->offset);
+            } else {
+                spans[num].offset = (watcher_size_t)element;
+                spans[num].length = (watcher_size_t)length;
+                num++;
+            }
+        }
+    }
+
+    return num;
+}
+
+
+// Diff callback of the struct entries: calls the callbacks of the fields touched by the spans
+static void struct_dispatch(const watcher_span_t *spans, watcher_size_t num, void *old_value, const void *new_value,
+                            watcher_size_t size, void *user_ptr, void *arg) {
+    const watcher_field_table_t *table = arg;
+    uint8_t                     *old   = old_value;
+    const uint8_t               *value = new_value;
+    watcher_size_t               span  = 0;
+    watcher_size_t               i     = 0;
+    (void)size;
+
+    // Both the spans and the fields are sorted, so a single pass matches them
+    for (i = 0; i < table->num; i++) {
+        const watcher_field_t *field = &table->fields[i];
+        size_t                 end   = (size_t)field->offset + field->size;
+
+        while (span < num && (size_t)spans[span].offset + spans[span].length <= field->offset) {
+            span++;
+        }
+        if (span == num) {
+            break;
+        }
+        if (spans[span].offset >= end) {
+            continue;
+        }
+
+        if (old == NULL) {
+            // Drained from an event slot too small for the struct: the single span covers it, nothing to compare with
+            field->callback(NULL, &value[field->offset], field->size, user_ptr, field->arg);
+        } else if (region_differs(&old[field->offset], &value[field->offset], field->size)) {
+            // The last span may stretch over unchanged bytes, so the field is compared on its own
+            field->callback(&old[field->offset], &value[field->offset], field->size, user_ptr, field->arg);
+        }
+    }
+}
+
+
+static uint8_t event_push(watcher_t *watcher, const watcher_entry_t *entry, watcher_size_t entry_index) {
+    watcher_event_queue_t *queue = &watcher->events;
+    size_t                 head  = queue->head;
+
+    if (head - LOAD_ACQUIRE(queue->tail) >= queue->capacity) {
+        return 0;
+    }
+
+    size_t           position  = head % queue->capacity;
+    watcher_event_t *event     = &queue->events[position];
+    const void      *old_value = entry_old_value(watcher, (watcher_entry_t *)entry);
+
+    event->callback    = watcher->callbacks.items[entry->callback_index];
+    event->batched     = ENTRY_IS_BATCHED(*entry) != 0;
+    event->stride      = entry->stride;
+    event->arg         = watcher->args.items[entry->arg_index];
+    event->watched     = ENTRY_WATCHED(watcher, *entry);
+    event->timestamp   = watcher->timestamp;
+    event->entry_index = entry_index;
+    event->size        = entry->size;
+    if (old_value != NULL && entry->size <= queue->slot_size) {
+        event->old_value = &queue->slots[position * queue->slot_size];
+        memcpy(event->old_value, old_value, entry->size);
+    } else {
+        event->old_value = NULL;
+    }
+
+    // Publishes the event to the consumer
+    STORE_RELEASE(queue->head, head + 1);
+    return 1;
+}
+
+
+static uint8_t trigger_entry(watcher_t *watcher, watcher_size_t entry_index, uint8_t defer) {
+    watcher_entry_t *entry = &watcher->entries.items[entry_index];
+
+    if (ENTRY_IS_DEBOUNCED(*entry)) {
+        // Triggering a debounced entry starts its delay
+        watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[entry->debouncer_index];
+        if (pdebouncer->triggered == TRIGGER_STATE_INACTIVE) {
+            pdebouncer->triggered = TRIGGER_STATE_RESET;
+            watcher->pending_debouncers++;
+        }
+        return DISPATCH_DONE;
+    } else {
+        return dispatch(watcher, entry_index, defer);
+    }
+}
+
+
+// Returns 0 if the entry has to be checked again by the next call
+static inline uint8_t check_entry(watcher_t *watcher, watcher_size_t entry_index, unsigned long timestamp,
+                                  watcher_size_t *count) {
+    watcher_entry_t *pentry = &watcher->entries.items[entry_index];
+
+    // The memory of an entry removed by a callback may be gone already
+    if (ENTRY_IS_SOFT_DIRTY(watcher, entry_index, *pentry) || ENTRY_IS_REMOVED(*pentry)) {
+        return 1;
+    }
+#ifdef C_WATCHER_CONCURRENT
+    // An entry that is being written is left for the next call rather than stalling the scan
+    if (pentry->seqlock != NULL && !entry_snapshot(pentry, C_WATCHER_SEQLOCK_MAX_RETRIES)) {
+        return 0;
+    }
+#endif
+
+    STATS_ADD(pentry->stats.compares, 1);
+    STATS_ADD(pentry->stats.bytes_compared, pentry->size);
+    if (entry_changed(watcher, pentry) && !ENTRY_IS_SKIPPED(*pentry)) {
+        if (ENTRY_IS_DEBOUNCED(*pentry)) {
+            // A debounced entry is considered triggered after the delay
+            if (watcher->debouncers.items[pentry->debouncer_index].triggered == TRIGGER_STATE_INACTIVE) {
+                arm_debouncer(watcher, pentry->debouncer_index, timestamp);
+            } else {
+                debouncer_suppressed(watcher, pentry);
+            }
+        } else {
+            uint8_t result = trigger_entry(watcher, entry_index, 1);
+            if (result == DISPATCH_FAILED) {
+                return 0;
+            }
+
+            (*count)++;
+            if (result == DISPATCH_DONE) {
+                // The callback may have moved the entries around
+                entry_update(watcher, &watcher->entries.items[entry_index]);
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+static void scan_dirty(watcher_t *watcher, unsigned long timestamp, watcher_size_t *count) {
+    size_t word = 0;
+
+    // Clean entries are skipped 32 at a time; bits are cleared before the check so a callback can mark them again
+    for (word = 0; word < WATCHER_DIRTY_BITMAP_WORDS(watcher->entries.num); word++) {
+        // Entries that could not be checked stay marked, once the word is done so they are not visited twice
+        uint32_t retry = 0;
+        size_t   first = word * 32;
+
+        // Bits past the last entry may have been left by removed entries
+        if (watcher->entries.num - first < 32) {
+            watcher->dirty[word] &= DIRTY_BIT(watcher->entries.num - first) - 1;
+        }
+
+        while (watcher->dirty[word] != 0) {
+            uint32_t       bits        = watcher->dirty[word];
+            watcher_size_t entry_index = (watcher_size_t)(word * 32 + LOWEST_SET_BIT(bits));
+
+            watcher->dirty[word] = bits & (bits - 1);
+            if (!check_entry(watcher, entry_index, timestamp, count)) {
+                retry |= DIRTY_BIT(entry_index);
+            }
+
+            if (watcher->changed) {
+                return;
+            }
+        }
+
+        watcher->dirty[word] |= retry;
+    }
+}
+
+
+static watcher_result_t dirty_reserve(watcher_t *watcher, size_t entries) {
+    size_t words = WATCHER_DIRTY_BITMAP_WORDS(entries);
+
+    if (words <= watcher->dirty_words) {
+        return WATCHER_RESULT_OK;
+    } else if (watcher->fn_realloc == NULL) {
+        return WATCHER_RESULT_STATIC_OVERFLOW;
+    }
+
+    // Cover the whole entries vector so the bitmap grows as rarely as the entries do
+    if (words < WATCHER_DIRTY_BITMAP_WORDS(watcher->entries.capacity)) {
+        words = WATCHER_DIRTY_BITMAP_WORDS(watcher->entries.capacity);
+    }
+
+    uint32_t *dirty = reallocate(watcher, watcher->dirty, words * sizeof(uint32_t));
+    if (dirty == NULL) {
+        return WATCHER_RESULT_ALLOC_ERROR;
+    }
+    memset(&dirty[watcher->dirty_words], 0, (words - watcher->dirty_words) * sizeof(uint32_t));
+    watcher->dirty       = dirty;
+    watcher->dirty_words = words;
+    return WATCHER_RESULT_OK;
+}
+
+
+static uint8_t compare_parallel(watcher_t *watcher, const watcher_pool_t *pool, uint32_t due) {
+    if (watcher->dirty_tracking || watcher->entries.num < C_WATCHER_PARALLEL_MIN_ENTRIES || pool->workers == 0 ||
+        dirty_reserve(watcher, watcher->entries.num) != WATCHER_RESULT_OK) {
+        return 0;
+    }
+
+    // A few tasks per worker balance the load; chunks are whole bitmap words, so no two tasks write the same one
+    size_t            tasks   = pool->workers * 4;
+    compare_context_t context = {
+        .watcher = watcher,
+        .chunk   = ALIGN_UP((watcher->entries.num + tasks - 1) / tasks, 32),
+        .due     = due,
+    };
+    tasks = (watcher->entries.num + context.chunk - 1) / context.chunk;
+
+    // The tasks only assign the words of the entries; those past them may hold bits of removed entries
+    size_t words = WATCHER_DIRTY_BITMAP_WORDS(watcher->entries.num);
+    memset(&watcher->dirty[words], 0, (watcher->dirty_words - words) * sizeof(uint32_t));
+
+    pool->run(pool->pool, compare_task, &context, tasks);
+    return 1;
+}
+
+
+static void compare_task(void *context, size_t task_index) {
+    const compare_context_t *compare = context;
+    watcher_t               *watcher = compare->watcher;
+    size_t                   start   = task_index * compare->chunk;
+    size_t                   end     = start + compare->chunk;
+    size_t                   i       = 0;
+
+    if (end > watcher->entries.num) {
+        end = watcher->entries.num;
+    }
+
+    // Words are assigned rather than or-ed, clearing whatever was left in the bitmap
+    for (i = start; i < end; i += 32) {
+        uint32_t bits = 0;
+        size_t   j    = 0;
+        for (j = i; j < end && j < i + 32; j++) {
+            watcher_entry_t *pentry = &watcher->entries.items[j];
+            if (!(compare->due & TIER_BIT(pentry->tier))) {
+                continue;
+            }
+            // Entries written concurrently are compared against a snapshot, which is taken when dispatching
+            if (ENTRY_IS_SEQLOCKED(*pentry)) {
+                bits |= DIRTY_BIT(j);
+            } else if (!ENTRY_IS_SOFT_DIRTY(watcher, j, *pentry)) {
+                // Only the task an entry belongs to writes its counters
+                STATS_ADD(pentry->stats.compares, 1);
+                STATS_ADD(pentry->stats.bytes_compared, pentry->size);
+                if (entry_changed(watcher, pentry)) {
+                    bits |= DIRTY_BIT(j);
+                }
+            }
+        }
+        watcher->dirty[DIRTY_WORD(i)] = bits;
+    }
+}
+
+
+static void soft_dirty_snapshot(watcher_t *watcher) {
+    watcher_soft_dirty_t *soft_dirty = &watcher->soft_dirty;
+    size_t                pages      = 0;
+    size_t                offset     = 0;
+    watcher_size_t        i          = 0;
+
+    for (i = 0; i < watcher->entries.num; i++) {
+        const watcher_entry_t *pentry = &watcher->entries.items[i];
+        if (ENTRY_IS_LARGE(*pentry)) {
+            pages += SOFTDIRTY_PAGES(soft_dirty->page_size, ENTRY_WATCHED(watcher, *pentry), pentry->size);
+        }
+    }
+    if (pages == 0) {
+        return;
+    }
+
+    // Without a snapshot this call falls back to comparing large entries in full
+    size_t bytes = (pages + 7) / 8;
+    if (bytes > soft_dirty->capacity) {
+        uint8_t *snapshot = reallocate(watcher, soft_dirty->pages, bytes);
+        if (snapshot == NULL) {
+            return;
+        }
+        soft_dirty->pages    = snapshot;
+        soft_dirty->capacity = bytes;
+    }
+
+    memset(soft_dirty->pages, soft_dirty->resync ? 0xFF : 0, bytes);
+    if (!soft_dirty->resync) {
+        for (i = 0; i < watcher->entries.num; i++) {
+            const watcher_entry_t *pentry = &watcher->entries.items[i];
+            if (ENTRY_IS_LARGE(*pentry)) {
+                if (!softdirty_read(soft_dirty, ENTRY_WATCHED(watcher, *pentry), pentry->size, soft_dirty->pages,
+                                    offset)) {
+                    return;
+                }
+                offset += SOFTDIRTY_PAGES(soft_dirty->page_size, ENTRY_WATCHED(watcher, *pentry), pentry->size);
+            }
+        }
+    }
+
+    // Pages written from now on are reported by the next call
+    if (!softdirty_clear(soft_dirty)) {
+        return;
+    }
+    soft_dirty->resync  = 0;
+    soft_dirty->entries = watcher->entries.num;
+}
+
+
+static void scan_soft_dirty(watcher_t *watcher, unsigned long timestamp, watcher_size_t *count) {
+    size_t         offset = 0;
+    watcher_size_t i      = 0;
+    uint8_t        result = DISPATCH_FAILED;
+
+    // Large entries are visited in the same order as by soft_dirty_snapshot, so their pages follow each other
+    for (i = 0; i < watcher->soft_dirty.entries; i++) {
+        watcher_entry_t *pentry = &watcher->entries.items[i];
+        if (!ENTRY_IS_LARGE(*pentry)) {
+            continue;
+        }
+
+        // The pages are accounted for anyway, but the memory of a removed entry is not read
+        if (!ENTRY_IS_REMOVED(*pentry) && soft_dirty_entry_changed(watcher, pentry, offset)) {
+            if (ENTRY_IS_DEBOUNCED(*pentry)) {
+                if (watcher->debouncers.items[pentry->debouncer_index].triggered == TRIGGER_STATE_INACTIVE) {
+                    arm_debouncer(watcher, pentry->debouncer_index, timestamp);
+                } else {
+                    debouncer_suppressed(watcher, pentry);
+                }
+            } else if (ENTRY_IS_SKIPPED(*pentry)) {
+                // Already reported by this call
+            } else if ((result = trigger_entry(watcher, i, 1)) != DISPATCH_FAILED) {
+                (*count)++;
+
+                // The callback may have moved the entries around
+                if (result == DISPATCH_DONE) {
+                    soft_dirty_entry_update(watcher, &watcher->entries.items[i], offset);
+                }
+
+                if (watcher->changed) {
+                    return;
+                }
+            } else {
+                // The written pages of the entry are forgotten by the next snapshot
+                watcher->soft_dirty.resync = 1;
+            }
+        }
+
+        offset += SOFTDIRTY_PAGES(watcher->soft_dirty.page_size, ENTRY_WATCHED(watcher, *pentry), pentry->size);
+    }
+}
+
+
+static uint8_t soft_dirty_next_run(const watcher_t *watcher, const watcher_entry_t *entry, size_t offset,
+                                   size_t *page, size_t *run_start, size_t *run_size) {
+    size_t    page_size = watcher->soft_dirty.page_size;
+    size_t    pages     = SOFTDIRTY_PAGES(page_size, ENTRY_WATCHED(watcher, *entry), entry->size);
+    uintptr_t watched   = (uintptr_t)ENTRY_WATCHED(watcher, *entry);
+    uintptr_t base      = watched / page_size * page_size;
+
+    while (*page < pages && !PAGE_IS_WRITTEN(watcher, offset + *page)) {
+        (*page)++;
+    }
+    if (*page == pages) {
+        return 0;
+    }
+
+    size_t first = *page;
+    while (*page < pages && PAGE_IS_WRITTEN(watcher, offset + *page)) {
+        (*page)++;
+    }
+
+    // Consecutive written pages are handled in one go, clipped to the entry
+    uintptr_t start = base + first * page_size;
+    uintptr_t end   = base + *page * page_size;
+    if (start < watched) {
+        start = watched;
+    }
+    if (end > watched + entry->size) {
+        end = watched + entry->size;
+    }
+    *run_start = start - watched;
+    *run_size  = end - start;
+    return 1;
+}
+
+
+static uint8_t soft_dirty_entry_changed(const watcher_t *watcher, watcher_entry_t *entry, size_t offset) {
+    size_t page = 0, run_start = 0, run_size = 0;
+
+    STATS_ADD(entry->stats.compares, 1);
+    while (soft_dirty_next_run(watcher, entry, offset, &page, &run_start, &run_size)) {
+        if (entry->mode != WATCHER_ENTRY_MODE_COPY) {
+            // Hashes cover the whole entry
+            STATS_ADD(entry->stats.bytes_compared, entry->size);
+            return entry_changed(watcher, entry);
+        }
+        STATS_ADD(entry->stats.bytes_compared, run_size);
+        if (region_differs((const uint8_t *)ENTRY_WATCHED(watcher, *entry) + run_start,
+                           (const uint8_t *)ENTRY_OLD_BUFFER(watcher, *entry) + run_start, run_size)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static void soft_dirty_entry_update(const watcher_t *watcher, watcher_entry_t *entry, size_t offset) {
+    size_t page = 0, run_start = 0, run_size = 0;
+
+    if (entry->mode != WATCHER_ENTRY_MODE_COPY) {
+        entry_update(watcher, entry);
+        return;
+    }
+    // Pages that were not written still match the old value
+    while (soft_dirty_next_run(watcher, entry, offset, &page, &run_start, &run_size)) {
+        region_copy((uint8_t *)ENTRY_OLD_BUFFER(watcher, *entry) + run_start,
+                    (const uint8_t *)ENTRY_WATCHED(watcher, *entry) + run_start, run_size);
+        STATS_ADD(entry->stats.bytes_copied, run_size);
+    }
+}
+
+
+#if !defined(__GNUC__) && !defined(__clang__)
+static unsigned lowest_set_bit(uint32_t word) {
+    unsigned bit = 0;
+    while ((word & 1) == 0) {
+        word >>= 1;
+        bit++;
+    }
+    return bit;
+}
+#endif
+
+
+static void arm_debouncer(watcher_t *watcher, watcher_size_t debouncer_index, unsigned long timestamp) {
+    watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[debouncer_index];
+    pdebouncer->triggered           = TRIGGER_STATE_ACTIVE;
+    pdebouncer->deadline            = timestamp + watcher->delays.items[pdebouncer->delay_index];
+#ifdef C_WATCHER_TRACE
+    pdebouncer->changed = timestamp;
+#endif
+#ifdef C_WATCHER_STATS
+    const watcher_entry_t *entry = &watcher->entries.items[pdebouncer->entry_index];
+    pdebouncer->seen             = region_hash(entry_value(watcher, entry), entry->size);
+#endif
+    deadlines_push(watcher, debouncer_index);
+}
+
+
+// Counts a change absorbed by the running delay of an entry. The old value is only refreshed once the delay expires,
+// so every scan in between finds the change again: it is counted once per distinct value
+static void debouncer_suppressed(watcher_t *watcher, watcher_entry_t *entry) {
+#ifdef C_WATCHER_STATS
+    watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[entry->debouncer_index];
+    uint64_t             seen       = region_hash(entry_value(watcher, entry), entry->size);
+    if (seen != pdebouncer->seen) {
+        pdebouncer->seen = seen;
+        entry->stats.suppressed++;
+    }
+#else
+    (void)watcher;
+    (void)entry;
+#endif
+}
+
+
+#define DEADLINE_AT(position) (watcher->debouncers.items[watcher->debouncers.items[position].heap].deadline)
+
+// Puts a debouncer at a heap position, keeping track of where it is so that it can be removed in constant time
+static inline void deadlines_place(watcher_t *watcher, size_t position, watcher_size_t debouncer_index) {
+    watcher->debouncers.items[position].heap                 = debouncer_index;
+    watcher->debouncers.items[debouncer_index].heap_position = (watcher_size_t)position;
+}
+
+static void deadlines_push(watcher_t *watcher, watcher_size_t debouncer_index) {
+    // Every debouncer is in the heap at most once, so it never outgrows the debouncers vector
+    size_t        position = watcher->deadlines++;
+    unsigned long deadline = watcher->debouncers.items[debouncer_index].deadline;
+
+    while (position > 0) {
+        size_t parent = (position - 1) / 2;
+        if (!time_before(deadline, DEADLINE_AT(parent))) {
+            break;
+        }
+        deadlines_place(watcher, position, watcher->debouncers.items[parent].heap);
+        position = parent;
+    }
+    deadlines_place(watcher, position, debouncer_index);
+}
+
+
+static watcher_size_t deadlines_pop(watcher_t *watcher) {
+    watcher_size_t top = watcher->debouncers.items[0].heap;
+    deadlines_remove(watcher, 0);
+    return top;
+}
+
+
+// Takes the debouncer at a heap position out, the last one takes its place
+static void deadlines_remove(watcher_t *watcher, size_t position) {
+    watcher_size_t last     = watcher->debouncers.items[--watcher->deadlines].heap;
+    size_t         size     = watcher->deadlines;
+    unsigned long  deadline = watcher->debouncers.items[last].deadline;
+
+    if (position == size) {
+        return;
+    }
+
+    // The last item may be due earlier than the parent of the hole, if it comes from another subtree
+    while (position > 0) {
+        size_t parent = (position - 1) / 2;
+        if (!time_before(deadline, DEADLINE_AT(parent))) {
+            break;
+        }
+        deadlines_place(watcher, position, watcher->debouncers.items[parent].heap);
+        position = parent;
+    }
+    while (2 * position + 1 < size) {
+        size_t child = 2 * position + 1;
+        if (child + 1 < size && time_before(DEADLINE_AT(child + 1), DEADLINE_AT(child))) {
+            child++;
+        }
+        if (!time_before(DEADLINE_AT(child), deadline)) {
+            break;
+        }
+        deadlines_place(watcher, position, watcher->debouncers.items[child].heap);
+        position = child;
+    }
+    deadlines_place(watcher, position, last);
+}
+
+
+// Drops a debouncer, moving the last one in its place
+static void debouncer_remove(watcher_t *watcher, watcher_size_t debouncer_index) {
+    watcher_size_t last = (watcher_size_t)(watcher->debouncers.num - 1);
+
+    if (watcher->debouncers.items[debouncer_index].triggered == TRIGGER_STATE_ACTIVE) {
+        deadlines_remove(watcher, watcher->debouncers.items[debouncer_index].heap_position);
+    } else if (watcher->debouncers.items[debouncer_index].triggered == TRIGGER_STATE_RESET) {
+        watcher->pending_debouncers--;
+    }
+
+    if (debouncer_index != last) {
+        // The heap field belongs to the position, not to the debouncer; heap_position moves along with it
+        watcher_debouncer_t *pdebouncer = &watcher->debouncers.items[debouncer_index];
+        watcher_size_t       heap       = pdebouncer->heap;
+        *pdebouncer                     = watcher->debouncers.items[last];
+        pdebouncer->heap                = heap;
+
+        watcher->entries.items[pdebouncer->entry_index].debouncer_index = debouncer_index;
+        if (pdebouncer->triggered == TRIGGER_STATE_ACTIVE) {
+            watcher->debouncers.items[pdebouncer->heap_position].heap = debouncer_index;
         }
-        entry      = &watcher->entries.items[entry_index];
-        old_buffer = ENTRY_GET_OLD_BUFFER_POINTER(*entry);
     }
+    watcher->debouncers.num--;
 }
@@ -1,20 +1,154 @@
 #ifndef C_WATCHER_H_INCLUDED
 #define C_WATCHER_H_INCLUDED
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 
+// Define to allow watched memory to be written by other threads under a seqlock and entries to be registered from
+// other threads (requires C11 atomics)
+// #define C_WATCHER_CONCURRENT
+
+#ifdef C_WATCHER_CONCURRENT
+#include <stdatomic.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Type of entry indexes
-// TODO: use extensive checks to allow for even smaller indexes
 #ifndef C_WATCHER_SIZE_TYPE
 #define C_WATCHER_SIZE_TYPE uint16_t
 #endif
 
+// Define to store entries in a compact layout: watched memory as 32 bit offsets from a base region (see
+// watcher_set_base), old values up to 4 bytes in the entry and larger ones as 32 bit offsets into a single shadow
+// region, callbacks and args as C_WATCHER_CALLBACK_INDEX_TYPE. Old value buffers cannot be provided by the caller.
+// #define C_WATCHER_COMPACT_ENTRIES
+
+#if defined(C_WATCHER_COMPACT_ENTRIES) && defined(C_WATCHER_CONCURRENT)
+#error "C_WATCHER_COMPACT_ENTRIES does not support C_WATCHER_CONCURRENT"
+#endif
+
+// Type of the callback and arg indexes of the entries, which also bounds the number of distinct callbacks and args
+#ifndef C_WATCHER_CALLBACK_INDEX_TYPE
+#ifdef C_WATCHER_COMPACT_ENTRIES
+#define C_WATCHER_CALLBACK_INDEX_TYPE uint8_t
+#else
+#define C_WATCHER_CALLBACK_INDEX_TYPE C_WATCHER_SIZE_TYPE
+#endif
+#endif
+
+// Old values up to this many bytes are kept in the entry itself
+#ifdef C_WATCHER_COMPACT_ENTRIES
+#define WATCHER_INLINE_SIZE sizeof(uint32_t)
+#else
+#define WATCHER_INLINE_SIZE sizeof(void *)
+#endif
+
 // The maximumum number of entries is (realistically) limited to use smaller data types and save RAM
 #ifndef C_WATCHER_MAX_ENTRIES
 #define C_WATCHER_MAX_ENTRIES (0xFFFF)
 #endif
 
+// Capacity of a vector on its first dynamic allocation; vectors then double in size
+#ifndef C_WATCHER_MIN_CAPACITY
+#define C_WATCHER_MIN_CAPACITY 4
+#endif
+
+// Define to deduplicate callbacks, args and delays with linear scans instead of hash indexes, saving RAM and code
+// size on tiny targets at the cost of quadratic registration time
+// #define C_WATCHER_LINEAR_LOOKUP
+
+/**
+ * @brief Number of watcher_size_t slots required by watcher_init_static_index
+ *
+ * @param callbacks capacity of the callbacks vector
+ * @param args capacity of the args vector
+ * @param delays capacity of the delays vector
+ */
+#define WATCHER_STATIC_INDEX_SIZE(callbacks, args, delays) (2 * ((size_t)(callbacks) + (args) + (delays)))
+
+/**
+ * @brief Bytes of the watcher_init_static_index buffer, 0 when C_WATCHER_LINEAR_LOOKUP is defined
+ */
+#ifdef C_WATCHER_LINEAR_LOOKUP
+#define WATCHER_STATIC_INDEX_BYTES(callbacks, args, delays) ((size_t)0)
+#else
+#define WATCHER_STATIC_INDEX_BYTES(callbacks, args, delays)                                                            \
+    (WATCHER_STATIC_INDEX_SIZE(callbacks, args, delays) * sizeof(watcher_size_t))
+#endif
+
+// Alignment of the old value buffers carved from the shadow arena
+#ifndef C_WATCHER_SHADOW_ALIGNMENT
+#define C_WATCHER_SHADOW_ALIGNMENT sizeof(void *)
+#endif
+
+// Size of the first dynamically allocated shadow slab; following slabs double in size
+#ifndef C_WATCHER_SHADOW_SLAB_SIZE
+#define C_WATCHER_SHADOW_SLAB_SIZE 1024
+#endif
+
+/**
+ * @brief Bytes of static shadow pool taken by an entry of `size` bytes compared by copy; values up to
+ * WATCHER_INLINE_SIZE bytes are kept in the entry itself. Pools should be aligned to C_WATCHER_SHADOW_ALIGNMENT, or
+ * be that much larger.
+ *
+ * @param size size of the watched memory
+ */
+#define WATCHER_STATIC_SHADOW_SIZE(size)                                                                               \
+    ((size_t)(size) <= WATCHER_INLINE_SIZE                                                                             \
+         ? (size_t)0                                                                                                   \
+         : ((size_t)(size) + C_WATCHER_SHADOW_ALIGNMENT - 1) / C_WATCHER_SHADOW_ALIGNMENT * C_WATCHER_SHADOW_ALIGNMENT)
+
+/**
+ * @brief Number of words of the bitmap required by watcher_init_static_dirty
+ *
+ * @param entries capacity of the entries vector
+ */
+#define WATCHER_DIRTY_BITMAP_WORDS(entries) (((size_t)(entries) + 31) / 32)
+
+// Entries of at least this many bytes are checked page by page by the soft-dirty backend; smaller ones are polled
+#ifndef C_WATCHER_SOFT_DIRTY_MIN_SIZE
+#define C_WATCHER_SOFT_DIRTY_MIN_SIZE 16384
+#endif
+
+// Below this many entries watcher_watch_parallel compares on the calling thread, as waking the pool costs more
+#ifndef C_WATCHER_PARALLEL_MIN_ENTRIES
+#define C_WATCHER_PARALLEL_MIN_ENTRIES 4096
+#endif
+
+// Attempts at a consistent snapshot of an entry that is being written before watcher_watch moves on; the entry is
+// checked again by the next call
+#ifndef C_WATCHER_SEQLOCK_MAX_RETRIES
+#define C_WATCHER_SEQLOCK_MAX_RETRIES 16
+#endif
+
+// Spans a diff callback receives at most (at least 1); past that, the last span stretches over the remaining changes
+#ifndef C_WATCHER_MAX_DIFF_SPANS
+#define C_WATCHER_MAX_DIFF_SPANS 16
+#endif
+
+// Polling tiers (at most 32); tier 0 is compared by every watcher_watch call, the others as set by watcher_set_tier
+#ifndef C_WATCHER_TIERS
+#define C_WATCHER_TIERS 4
+#endif
+
+// Define to leave out the default pthread pool on targets without pthreads
+// #define C_WATCHER_NO_PTHREAD
+
+// Define to count comparisons, callbacks, scan times and allocations, see watcher_get_stats
+// #define C_WATCHER_STATS
+
+// Clock timing scans and callbacks when C_WATCHER_STATS is defined; any increasing unsigned long counter will do
+#ifndef C_WATCHER_STATS_CLOCK
+#define C_WATCHER_STATS_CLOCK() ((unsigned long)clock())
+#endif
+
+// Define to call trace hooks around scans and callbacks, see watcher_set_trace_hooks
+// #define C_WATCHER_TRACE
+
 #ifndef C_WATCHER_STRUCT_ATTRIBUTES
 #define C_WATCHER_STRUCT_ATTRIBUTES
 #endif
@@ -59,6 +193,95 @@
     (void)&(array); /* Here so passing something that isn't an array results in a compiler error*/                     \
     watcher_add_entry(watcher, array, sizeof(array), cb, ((void *)(arg)))
 
+/**
+ * @brief Add a new entry (in the form of an array) to the watcher, keeping only a hash of its content.
+ * The callback receives a NULL old value.
+ *
+ * @param watcher
+ * @param slice slice to observe
+ * @param num number of items
+ * @param callback function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+#define WATCHER_ADD_SLICE_ENTRY_HASHED(watcher, slice, num, cb, arg)                                                   \
+    watcher_add_entry_hashed(watcher, slice, sizeof(*(slice)) * (num), cb, ((void *)(arg)))
+
+/**
+ * @brief Add a new entry to the watcher, with a batched callback
+ *
+ * @param watcher
+ * @param pointer pointer to observe
+ * @param callback batched function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+#define WATCHER_ADD_ENTRY_BATCHED(watcher, ptr, cb, arg)                                                               \
+    watcher_add_entry_batched(watcher, ptr, sizeof(*(ptr)), cb, ((void *)(arg)))
+
+/**
+ * @brief Add a new entry to the watcher, in a polling tier
+ *
+ * @param watcher
+ * @param pointer pointer to observe
+ * @param callback function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @param tier polling tier, 0 for the fast tier
+ * @return int16_t entry index if successful, -1 on failure
+ */
+#define WATCHER_ADD_ENTRY_TIERED(watcher, ptr, cb, arg, tier)                                                          \
+    watcher_add_entry_tiered(watcher, ptr, sizeof(*(ptr)), cb, ((void *)(arg)), tier)
+
+/**
+ * @brief Add a new entry (in the form of an array) to the watcher, reporting the changed elements
+ *
+ * @param watcher
+ * @param slice slice to observe
+ * @param num number of items
+ * @param callback diff function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+#define WATCHER_ADD_SLICE_ENTRY_DIFF(watcher, slice, num, cb, arg)                                                     \
+    watcher_add_entry_diff(watcher, slice, sizeof(*(slice)) * (num), sizeof(*(slice)), cb, ((void *)(arg)))
+
+/**
+ * @brief Add a new entry (in the form of an array) to the watcher, reporting the changed elements
+ *
+ * @param watcher
+ * @param array array to observe
+ * @param callback diff function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+#define WATCHER_ADD_ARRAY_ENTRY_DIFF(watcher, array, cb, arg)                                                          \
+    (void)&(array); /* Here so passing something that isn't an array results in a compiler error*/                     \
+    watcher_add_entry_diff(watcher, array, sizeof(array), sizeof((array)[0]), cb, ((void *)(arg)))
+
+/**
+ * @brief Add a new struct entry to the watcher, calling the callbacks of its changed fields
+ *
+ * @param watcher
+ * @param ptr struct to observe
+ * @param table pointer to the watcher_field_table_t of the struct
+ * @return int16_t entry index if successful, -1 on failure
+ */
+#define WATCHER_ADD_STRUCT(watcher, ptr, table) watcher_add_struct(watcher, ptr, sizeof(*(ptr)), table)
+
+/**
+ * @brief Initializer for a watcher_field_t
+ *
+ * @param type struct type
+ * @param member field of the struct
+ * @param callback function to be called when the field changes
+ * @param arg additional argument to be passed to the function
+ */
+#define WATCHER_FIELD(type, member, cb, argument)                                                                      \
+    {                                                                                                                  \
+        .offset = offsetof(type, member), .size = sizeof(((type *)0)->member), .callback = cb,                         \
+        .arg = ((void *)(argument))                                                                                    \
+    }
+
 /**
  * @brief Add a new entry (in the form of an array, with delayed reaction) to the watcher
  *
@@ -86,6 +309,33 @@
 #define WATCHER_ADD_ENTRY_DELAYED(watcher, ptr, cb, arg, delay)                                                        \
     watcher_add_entry_delayed(watcher, ptr, sizeof(*(ptr)), cb, arg, delay)
 
+/**
+ * @brief Initializer for a watcher_entry_descriptor_t
+ *
+ * @param pointer pointer to observe
+ * @param callback function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ */
+#define WATCHER_ENTRY(ptr, cb, argument)                                                                               \
+    {                                                                                                                  \
+        .pointer = ptr, .size = sizeof(*(ptr)), .callback = cb, .arg = ((void *)(argument)), .delay = 0,               \
+        .old_buffer = NULL                                                                                             \
+    }
+
+/**
+ * @brief Initializer for a (delayed) watcher_entry_descriptor_t
+ *
+ * @param pointer pointer to observe
+ * @param callback function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @param delay number of ticks to wait after a change before invoking the callback
+ */
+#define WATCHER_ENTRY_DELAYED(ptr, cb, argument, delay_ticks)                                                          \
+    {                                                                                                                  \
+        .pointer = ptr, .size = sizeof(*(ptr)), .callback = cb, .arg = ((void *)(argument)), .delay = delay_ticks,     \
+        .old_buffer = NULL                                                                                             \
+    }
+
 
 // Private utility, defines a vector struct
 #define VECTOR_DEFINE(type, name)                                                                                      \
@@ -97,6 +347,8 @@
 
 typedef C_WATCHER_SIZE_TYPE watcher_size_t;
 
+typedef C_WATCHER_CALLBACK_INDEX_TYPE watcher_callback_index_t;
+
 /**
  * @brief Callback typedef
  *
@@ -109,6 +361,137 @@ typedef C_WATCHER_SIZE_TYPE watcher_size_t;
 typedef void (*watcher_callback_t)(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr,
                                    void *arg);
 
+/**
+ * @brief Change of an entry with a batched callback
+ */
+typedef struct {
+    void          *old_value;
+    const void    *new_value;
+    void          *arg;
+    watcher_size_t size;
+    watcher_size_t entry_index;
+} watcher_change_t;
+
+/**
+ * @brief Batched callback typedef, invoked once per watcher_watch call with every change of the entries sharing it
+ *
+ * @param changes changes, in no particular order; the array belongs to the watcher and is only valid during the call
+ * @param num number of changes
+ * @param user_ptr user specified context
+ */
+typedef void (*watcher_batch_callback_t)(watcher_change_t *changes, watcher_size_t num, void *user_ptr);
+
+/**
+ * @brief Changed part of an entry with a diff callback, in bytes from its start
+ */
+typedef struct {
+    watcher_size_t offset;
+    watcher_size_t length;
+} watcher_span_t;
+
+/**
+ * @brief Diff callback typedef, receiving the changed elements on top of the whole values
+ *
+ * @param spans changed ranges of whole elements, in order; adjacent ones are merged
+ * @param num number of spans, at most C_WATCHER_MAX_DIFF_SPANS
+ * @param old_value old value
+ * @param new_value new value
+ * @param size size of the data type
+ * @param user_ptr user specified context
+ * @param arg extra argument
+ */
+typedef void (*watcher_diff_callback_t)(const watcher_span_t *spans, watcher_size_t num, void *old_value,
+                                        const void *new_value, watcher_size_t size, void *user_ptr, void *arg);
+
+/**
+ * @brief Field of a struct entry; its callback receives the old and new value of the field alone
+ */
+typedef struct {
+    watcher_size_t     offset;     // Position of the field in the struct
+    watcher_size_t     size;       // Field size
+    watcher_callback_t callback;
+    void              *arg;
+} watcher_field_t;
+
+/**
+ * @brief Fields of a struct entry, sorted by offset. They may overlap, and the bytes that belong to none (e.g.
+ * padding) are not reported.
+ */
+typedef struct {
+    const watcher_field_t *fields;
+    watcher_size_t         num;
+} watcher_field_table_t;
+
+
+#ifdef C_WATCHER_CONCURRENT
+/**
+ * @brief Sequence counter bracketing the writes to one or more entries, initialized to 0.
+ * Writers sharing a counter must be serialized among themselves.
+ */
+typedef atomic_uint watcher_seqlock_t;
+
+/**
+ * @brief Starts writing memory protected by a seqlock
+ *
+ * @param seqlock
+ */
+static inline void watcher_write_begin(watcher_seqlock_t *seqlock) {
+    unsigned sequence = atomic_load_explicit(seqlock, memory_order_relaxed);
+    atomic_store_explicit(seqlock, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+/**
+ * @brief Ends writing memory protected by a seqlock
+ *
+ * @param seqlock
+ */
+static inline void watcher_write_end(watcher_seqlock_t *seqlock) {
+    unsigned sequence = atomic_load_explicit(seqlock, memory_order_relaxed);
+    atomic_store_explicit(seqlock, sequence + 1, memory_order_release);
+}
+#endif
+
+
+/**
+ * @brief How changes of an entry are detected
+ */
+typedef enum {
+    // Keep a full copy of the watched region (default)
+    WATCHER_ENTRY_MODE_COPY = 0,
+    // Keep only a 64 bit hash of the watched region; the callback receives a NULL old value
+    WATCHER_ENTRY_MODE_HASH,
+    // Keep a full copy and its hash, comparing the copy only when the hash matches
+    WATCHER_ENTRY_MODE_HASH_COPY,
+} watcher_entry_mode_t;
+
+
+/**
+ * @brief Description of a single entry, used for batch registration
+ */
+typedef struct {
+    const void        *pointer;       // Memory to observe
+    watcher_size_t     size;          // Memory size
+    watcher_callback_t callback;      // Function to be called on memory change
+    void              *arg;           // Additional argument to be passed to the function
+    unsigned long      delay;         // Delay in ticks, 0 for an immediate entry
+    // Pre allocated old value buffer, NULL to allocate it. Hashed entries need 8 more bytes: the hash of a
+    // WATCHER_ENTRY_MODE_HASH_COPY entry comes first, followed by the copy
+    void   *old_buffer;
+    uint8_t mode;     // One of watcher_entry_mode_t
+    uint8_t tier;     // Polling tier, 0 for the fast tier
+    // Batched function to be called on memory change, used instead of callback if not NULL
+    watcher_batch_callback_t batch_callback;
+    // Diff function to be called on memory change, used instead of callback if not NULL; only for copied entries
+    watcher_diff_callback_t diff_callback;
+    watcher_size_t          stride;     // Element size of a diff entry, 0 to report bytes
+#ifdef C_WATCHER_CONCURRENT
+    // Seqlock bracketing writes from other threads, NULL if the memory is only written by the watching thread.
+    // Such entries also take a buffer for a consistent copy of the memory from the shadow arena.
+    watcher_seqlock_t *seqlock;
+#endif
+} watcher_entry_descriptor_t;
+
 
 typedef enum {
     WATCHER_RESULT_OK = 0,
@@ -118,89 +501,601 @@ typedef enum {
 } watcher_result_t;
 
 
+// Debouncer index of entries that are not delayed
+#define WATCHER_NO_DEBOUNCER ((watcher_size_t)~(watcher_size_t)0)
+
+// Handle slot of entries registered before handles were enabled, and end of the free slots list
+#define WATCHER_NO_HANDLE ((watcher_size_t)~(watcher_size_t)0)
+
+// Never returned for a valid entry
+#define WATCHER_INVALID_HANDLE ((watcher_handle_t)0)
+
+/**
+ * @brief Stable reference to an entry: the entry index in the lower 16 bits and a generation in the upper ones, so a
+ * handle to a removed entry is recognized even once its slot is reused
+ */
+typedef uint32_t watcher_handle_t;
+
+// Slot of the handles table
+typedef struct {
+    watcher_size_t entry_index;     // Entry referenced by the slot, or next free slot
+    uint16_t       generation;
+} watcher_handle_slot_t;
+
+#ifdef C_WATCHER_STATS
+/**
+ * @brief Counters of an entry, see watcher_get_entry_stats. Times are in C_WATCHER_STATS_CLOCK units.
+ */
+typedef struct {
+    unsigned long compares;          // Comparisons against the old value
+    unsigned long triggers;          // Changes reported, queued or batched
+    unsigned long suppressed;        // Changes absorbed by a delay that was already running
+    unsigned long callback_time;     // Time spent in the callback; batched callbacks are shared among their changes
+    uint64_t      bytes_compared;
+    uint64_t      bytes_copied;      // Bytes copied to the old value or the snapshot
+} watcher_entry_stats_t;
+
+/**
+ * @brief Counters of a watcher, see watcher_get_stats. Times are in C_WATCHER_STATS_CLOCK units.
+ */
+typedef struct {
+    unsigned long scans;               // watcher_watch, watcher_watch_parallel and watcher_watch_budget calls
+    unsigned long scan_time;           // Total time of the scans, callbacks included
+    unsigned long last_scan_time;
+    unsigned long max_scan_time;
+    unsigned long interrupted;         // Scans stopped early because the watcher was destroyed
+    unsigned long late_entries;        // Entries registered during a scan, which carries on with them
+    unsigned long allocations;         // Successful calls to the allocator
+    uint64_t      allocated_bytes;     // Bytes requested by those calls
+} watcher_stats_t;
+#endif
+
+#ifdef C_WATCHER_TRACE
+/**
+ * @brief Callback invocation reported to the trace hooks
+ */
+typedef struct {
+    watcher_size_t entry_index;        // Entry whose change is reported, the first one for a batched callback
+    watcher_size_t callback_index;     // Position of the callback in the callbacks vector
+    watcher_size_t changes;            // Changes passed to a batched callback, 1 otherwise
+    unsigned long  timestamp;          // Timestamp of the watcher_watch call
+    // Timestamp at which the delay of a debounced entry started, i.e. its first change; timestamp otherwise
+    unsigned long changed;
+    uint8_t       debounced;
+} watcher_trace_dispatch_t;
+
+/**
+ * @brief Hooks called around scans and callbacks, see watcher_set_trace_hooks. Any of them may be NULL.
+ * The value returned by a begin hook is passed to the matching end hook; calls nest when callbacks trigger entries.
+ */
+typedef struct {
+    unsigned long (*scan_begin)(void *context, unsigned long timestamp);
+    void (*scan_end)(void *context, unsigned long timestamp, watcher_size_t count, unsigned long token);
+    unsigned long (*dispatch_begin)(void *context, const watcher_trace_dispatch_t *dispatch);
+    void (*dispatch_end)(void *context, const watcher_trace_dispatch_t *dispatch, unsigned long token);
+    void *context;     // Passed to the hooks
+} watcher_trace_hooks_t;
+#endif
+
+
 // TODO: consider whether the vector index optimization is appropriate for the callback's argument
 typedef struct C_WATCHER_STRUCT_ATTRIBUTES {
-    const void    *watched;        // Memory pointer
-    void          *old_buffer;     // Old value buffer
-    watcher_size_t size;           // Memory size
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    uint32_t watched;         // Offset of the memory from the base region
+    uint32_t old_buffer;      // Offset of the old value buffer from the shadow region
+#else
+    const void *watched;        // Memory pointer
+    void       *old_buffer;     // Old value buffer
+#endif
+    watcher_size_t size;     // Memory size
 
-    watcher_size_t callback_index;     // Index for the callback vector
-    watcher_size_t arg_index;          // Index for the argument vector
+    watcher_callback_index_t callback_index;     // Index for the callback vector
+    watcher_callback_index_t arg_index;          // Index for the argument vector
+    watcher_size_t debouncer_index;     // Index for the debouncer vector, WATCHER_NO_DEBOUNCER if not delayed
+    uint8_t        mode;                // One of watcher_entry_mode_t
+    uint8_t        flags;               // Batched callback, pending batched change, removal, shadow ownership
+    uint8_t        tier;                // Polling tier
+    watcher_size_t handle_index;        // Slot in the handles table, WATCHER_NO_HANDLE if handles are not enabled
+    watcher_size_t stride;              // Element size of an entry with a diff callback
+#ifdef C_WATCHER_CONCURRENT
+    watcher_seqlock_t *seqlock;      // NULL if the memory is not written concurrently
+    void              *snapshot;     // Consistent copy of the memory, taken under the seqlock
+#endif
+#ifdef C_WATCHER_STATS
+    watcher_entry_stats_t stats;
+#endif
 } watcher_entry_t;
 
 
 typedef struct C_WATCHER_STRUCT_ATTRIBUTES {
-    unsigned long  timestamp;
+    unsigned long  deadline;          // Timestamp at which the delayed callback fires, once active
     watcher_size_t delay_index;
-    watcher_size_t callback_index;
-    watcher_size_t arg_index;
+    watcher_size_t entry_index;       // Debounced entry
+    watcher_size_t heap;              // Debouncer index at this position of the deadline heap
+    watcher_size_t heap_position;     // Position of the debouncer in the deadline heap, while its delay runs
     uint8_t        triggered;
+#ifdef C_WATCHER_TRACE
+    unsigned long changed;     // Timestamp at which the delay started
+#endif
+#ifdef C_WATCHER_STATS
+    uint64_t seen;     // Hash of the value last seen while the delay runs
+#endif
 } watcher_debouncer_t;
 
 
-// Watcher data
+// Open addressing hash table of positions in a vector, used to deduplicate items in constant time
 typedef struct {
-    VECTOR_DEFINE(watcher_entry_t, entries);
-    VECTOR_DEFINE(unsigned long, delays);
-    VECTOR_DEFINE(watcher_callback_t, callbacks);
-    VECTOR_DEFINE(void *, args);
-    VECTOR_DEFINE(watcher_debouncer_t, debouncers);
-
-    void *user_ptr;
+    watcher_size_t *slots;
+    size_t          capacity;
+} watcher_index_t;
 
-    // Allocator
-    void *(*fn_realloc)(void *, size_t);
-    void (*fn_free)(void *);
 
-    uint8_t changed;
-} watcher_t;
+// Bump allocator for the old value buffers
+typedef struct {
+    struct watcher_shadow_slab *slabs;       // Dynamically allocated slabs, most recent first
+    uint8_t                    *memory;      // Region currently allocated from
+    size_t                      used;
+    size_t                      capacity;
+} watcher_shadow_arena_t;
 
 
 /**
- * @brief Initialize a watcher structure, dynamically allocating the required memory
+ * @brief Task run by a thread pool
  *
- * @param watcher
- * @param user_ptr user pointer that will be provided to the entries' callbacks
+ * @param context task context
+ * @param task_index index of the task, from 0 to the number of tasks
  */
-watcher_result_t watcher_init(watcher_t *watcher, void *user_ptr, void *(*fn_realloc)(void *, size_t),
-                              void (*fn_free)(void *));
+typedef void (*watcher_task_t)(void *context, size_t task_index);
 
 /**
- * @brief Initialize a watcher structure, providing static memory for allocation.
- * Every parameter is relative to a different vector
- *
- * @param watcher
- * @param entries
- * @param entries_capacity
- * @param callbacks
- * @param callbacks_capacity
- * @param args
- * @param args_capacity
- * @param delays
- * @param delays_capacity
- * @param timestamps
- * @param timestamps_capacity
- * @param user_ptr user pointer that will be provided to the entries' callbacks
+ * @brief Limits of a watcher_watch_budget call; the scan stops at whichever comes first
  */
-// TODO: collect all the required parameters in a struct
-// TODO: add a function that returns that struct (with allocated memory information) for a watcher that has been
-// dynamically allocated
-void watcher_init_static(watcher_t *watcher, watcher_entry_t *entries, watcher_size_t entries_capacity,
-                         watcher_callback_t *callbacks, watcher_size_t callbacks_capacity, void **args,
-                         watcher_size_t args_capacity, unsigned long *delays, watcher_size_t delays_capacity,
-                         watcher_debouncer_t *debouncers, watcher_size_t debouncers_capacity, void *user_ptr);
+typedef struct {
+    watcher_size_t entries;     // Maximum number of entries to compare, 0 for no limit
+    // Optional clock, NULL to only limit the entries. It is read every few entries, so the deadline can be overrun by
+    // the time it takes to compare them
+    unsigned long (*clock)(void *arg);
+    void         *clock_arg;      // Passed to clock
+    unsigned long deadline;       // Value of clock at which the scan stops
+} watcher_budget_t;
+
 
 /**
- * @brief Frees the allocated memory for a buffer (if it was not statically allocated)
- *
- * @param watcher
+ * @brief Thread pool used by watcher_watch_parallel
  */
-// TODO: add a "clear" function that doesn't deallocate memory
-void watcher_destroy(watcher_t *watcher);
+typedef struct {
+    // Runs task(context, i) for every i in [0, tasks), returning once all of them completed
+    void (*run)(void *pool, watcher_task_t task, void *context, size_t tasks);
+    void  *pool;        // Passed to run
+    size_t workers;     // Number of threads running the tasks, used to size them
+} watcher_pool_t;
+
 
 /**
- * @brief Adds a new entry to the watched vector, allocating the memory dinamically.
- *
+ * @brief How watcher_watch finds changes
+ */
+typedef enum {
+    // Compare every entry (or every marked entry, with dirty tracking) against its old value (default)
+    WATCHER_BACKEND_POLL = 0,
+    // Linux only: large entries only compare the pages the kernel reports as written since the previous call
+    WATCHER_BACKEND_SOFT_DIRTY,
+} watcher_backend_t;
+
+
+// State of the soft-dirty backend
+typedef struct {
+    int            pagemap;        // /proc/self/pagemap descriptor
+    int            clear_refs;     // /proc/self/clear_refs descriptor
+    size_t         page_size;
+    uint8_t       *pages;          // Written pages of the large entries, one bit each, taken by watcher_watch
+    size_t         capacity;       // Bytes in pages
+    watcher_size_t entries;        // Number of entries covered by pages, 0 outside of watcher_watch
+    uint8_t        resync;         // Written pages are unknown, the next call compares every page
+    uint8_t        owner;          // The backend is taken for the process
+} watcher_soft_dirty_t;
+
+
+/**
+ * @brief Change queued by watcher_watch while an event queue is set, see watcher_set_event_queue
+ */
+typedef struct {
+    watcher_callback_t callback;
+    void              *arg;
+    const void        *watched;          // Watched memory, passed as the new value when the event is drained
+    void              *old_value;        // Copy slot of the event, NULL for hashed entries or if it does not fit
+    unsigned long      timestamp;        // Timestamp of the watcher_watch call that detected the change
+    watcher_size_t     entry_index;
+    watcher_size_t     size;
+    uint8_t            batched;          // callback is a watcher_batch_callback_t
+    watcher_size_t     stride;           // If not 0 callback is a watcher_diff_callback_t, with elements this large
+} watcher_event_t;
+
+
+// Single producer, single consumer ring of events
+typedef struct {
+    watcher_event_t *events;
+    uint8_t         *slots;         // Old value copies, slot_size bytes for each event
+    size_t           capacity;      // Number of events, 0 if callbacks are invoked by watcher_watch
+    size_t           slot_size;
+    size_t           head;          // Events pushed, only written by the watching thread
+    size_t           tail;          // Events drained, only written by the consumer
+} watcher_event_queue_t;
+
+
+// Polling tier: a dense range of entries compared every `calls` watcher_watch calls or every `period` timestamp units
+typedef struct {
+    watcher_size_t end;           // The tier holds the entries from the end of the previous one up to here
+    unsigned       calls;         // Calls between two comparisons, when period is 0
+    unsigned       countdown;     // Calls left before the next comparison
+    unsigned long  period;        // Timestamp units between two comparisons, 0 to count calls instead
+    unsigned long  last;          // Timestamp of the last comparison
+} watcher_tier_t;
+
+
+#ifdef C_WATCHER_CONCURRENT
+/**
+ * @brief Entry queued for registration by watcher_stage_entry
+ */
+typedef struct watcher_staged_entry {
+    watcher_entry_descriptor_t   descriptor;
+    struct watcher_staged_entry *next;
+    watcher_result_t             result;          // Registration result, valid once done is set
+    watcher_size_t               entry_index;     // Index of the registered entry, valid once done is set
+    atomic_uchar                 done;
+} watcher_staged_entry_t;
+#endif
+
+
+// Watcher data
+typedef struct {
+    VECTOR_DEFINE(watcher_entry_t, entries);
+    VECTOR_DEFINE(unsigned long, delays);
+    VECTOR_DEFINE(watcher_callback_t, callbacks);
+    VECTOR_DEFINE(void *, args);
+    VECTOR_DEFINE(watcher_debouncer_t, debouncers);
+    // Changes of batched entries found by the current watcher_watch call, large enough for every batched entry
+    VECTOR_DEFINE(watcher_change_t, changes);
+    watcher_size_t batched_entries;
+    // Handle slots, empty until the first watcher_get_handle call on a dynamically allocated watcher
+    VECTOR_DEFINE(watcher_handle_slot_t, handles);
+    watcher_size_t free_handles;     // First free slot in handles, WATCHER_NO_HANDLE if none
+    // Entries are sorted by tier; the ones registered while callbacks run follow the last tier until they are placed
+    watcher_tier_t tiers[C_WATCHER_TIERS];
+
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    watcher_index_t callbacks_index;
+    watcher_index_t args_index;
+    watcher_index_t delays_index;
+#endif
+
+    watcher_shadow_arena_t shadow;
+
+    // Entries to compare on the next watcher_watch call, one bit each, when dirty tracking is enabled
+    uint32_t *dirty;
+    size_t    dirty_words;
+    uint8_t   dirty_tracking;
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    // Entries by watched pointer, maintained while dirty tracking is enabled
+    watcher_index_t pointers_index;
+#endif
+
+    uint8_t              backend;     // One of watcher_backend_t
+    watcher_soft_dirty_t soft_dirty;
+
+    // Changes waiting for watcher_drain_events, when set
+    watcher_event_queue_t events;
+
+#ifdef C_WATCHER_CONCURRENT
+    // Entries waiting to be registered by the next watcher_watch call, most recent first
+    _Atomic(watcher_staged_entry_t *) staged;
+#endif
+
+    // Min-heap of active debouncers by deadline, stored in the `heap` field of the debouncers vector
+    watcher_size_t deadlines;
+    // Debouncers triggered outside of watcher_watch, armed by the next call
+    watcher_size_t pending_debouncers;
+    unsigned long  timestamp;     // Timestamp of the last watcher_watch call
+    size_t         cursor;        // Next entry compared by watcher_watch_budget
+    // Nesting level of the functions invoking callbacks; entries removed meanwhile are only flagged and dropped at the
+    // end, so that indexes stay put while they run
+    uint8_t        busy;
+    watcher_size_t removed;     // Entries flagged as removed
+
+    void *user_ptr;
+
+#ifdef C_WATCHER_COMPACT_ENTRIES
+    // Region every watched memory lies in, see watcher_set_base
+    const uint8_t *base;
+    size_t         base_size;
+#endif
+
+    // Allocator
+    void *(*fn_realloc)(void *, size_t);
+    void (*fn_free)(void *);
+
+    uint8_t changed;     // Set by watcher_destroy, so that a watcher_watch call in progress stops
+
+#ifdef C_WATCHER_STATS
+    watcher_stats_t stats;
+#endif
+#ifdef C_WATCHER_TRACE
+    watcher_trace_hooks_t trace;
+#endif
+} watcher_t;
+
+
+/**
+ * @brief Bytes of static memory taken by the vectors of a watcher with the given capacities, deduplication index
+ * included, plus `shadow` bytes of shadow pool (see WATCHER_STATIC_SHADOW_SIZE). It is a constant expression, so it
+ * can size a memory budget at compile time.
+ */
+#define WATCHER_STATIC_SIZE(entries, callbacks, args, delays, debouncers, shadow)                                      \
+    ((size_t)(entries) * sizeof(watcher_entry_t) + (size_t)(callbacks) * sizeof(watcher_callback_t) +                 \
+     (size_t)(args) * sizeof(void *) + (size_t)(delays) * sizeof(unsigned long) +                                      \
+     (size_t)(debouncers) * sizeof(watcher_debouncer_t) + WATCHER_STATIC_INDEX_BYTES(callbacks, args, delays) +        \
+     (size_t)(shadow))
+
+
+/**
+ * @brief Static memory of a watcher, see watcher_init_static_config. Every buffer past the debouncers is optional
+ * and left out if NULL.
+ */
+typedef struct {
+    watcher_entry_t     *entries;
+    watcher_size_t       entries_capacity;
+    watcher_callback_t  *callbacks;
+    watcher_size_t       callbacks_capacity;
+    void               **args;
+    watcher_size_t       args_capacity;
+    unsigned long       *delays;
+    watcher_size_t       delays_capacity;
+    watcher_debouncer_t *debouncers;
+    watcher_size_t       debouncers_capacity;
+
+    watcher_size_t        *index;     // See watcher_init_static_index
+    size_t                 index_len;
+    void                  *shadow;     // See watcher_init_static_shadow
+    size_t                 shadow_size;
+    uint32_t              *dirty;     // See watcher_init_static_dirty
+    size_t                 dirty_words;
+    watcher_change_t      *changes;     // See watcher_init_static_changes
+    watcher_size_t         changes_capacity;
+    watcher_handle_slot_t *handles;     // See watcher_init_static_handles
+    watcher_size_t         handles_capacity;
+
+    void *user_ptr;     // User pointer that will be provided to the entries' callbacks
+} watcher_static_config_t;
+
+
+/**
+ * @brief Memory of a watcher by buffer, in the units of watcher_static_config_t: items for the vectors, slots for the
+ * index, bytes for the shadow pool and words for the dirty bitmap
+ */
+typedef struct {
+    watcher_size_t entries;
+    watcher_size_t callbacks;
+    watcher_size_t args;
+    watcher_size_t delays;
+    watcher_size_t debouncers;
+    size_t         index;
+    size_t         shadow;
+    size_t         dirty;
+    watcher_size_t changes;
+    watcher_size_t handles;
+} watcher_footprint_t;
+
+
+/**
+ * @brief Memory held by a watcher, see watcher_get_memory_info
+ */
+typedef struct {
+    // Smallest static layout holding the registered entries: a watcher_init_static_config with these capacities can
+    // register them all again
+    watcher_footprint_t used;
+    watcher_footprint_t allocated;     // Capacities currently held
+    size_t              used_bytes;
+    // Every byte held, including the shadow slab headers and the event queue
+    size_t allocated_bytes;
+} watcher_memory_info_t;
+
+
+/**
+ * @brief Initialize a watcher structure, dynamically allocating the required memory
+ *
+ * @param watcher
+ * @param user_ptr user pointer that will be provided to the entries' callbacks
+ */
+watcher_result_t watcher_init(watcher_t *watcher, void *user_ptr, void *(*fn_realloc)(void *, size_t),
+                              void (*fn_free)(void *));
+
+/**
+ * @brief Initialize a watcher structure, providing static memory for allocation.
+ * Every parameter is relative to a different vector
+ *
+ * @param watcher
+ * @param entries
+ * @param entries_capacity
+ * @param callbacks
+ * @param callbacks_capacity
+ * @param args
+ * @param args_capacity
+ * @param delays
+ * @param delays_capacity
+ * @param timestamps
+ * @param timestamps_capacity
+ * @param user_ptr user pointer that will be provided to the entries' callbacks
+ */
+void watcher_init_static(watcher_t *watcher, watcher_entry_t *entries, watcher_size_t entries_capacity,
+                         watcher_callback_t *callbacks, watcher_size_t callbacks_capacity, void **args,
+                         watcher_size_t args_capacity, unsigned long *delays, watcher_size_t delays_capacity,
+                         watcher_debouncer_t *debouncers, watcher_size_t debouncers_capacity, void *user_ptr);
+
+/**
+ * @brief Initialize a watcher structure with the static memory described by config: watcher_init_static followed by
+ * the watcher_init_static_* function of every optional buffer provided
+ *
+ * @param watcher
+ * @param config static memory and user pointer
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_config(watcher_t *watcher, const watcher_static_config_t *config);
+
+/**
+ * @brief Provides static memory for the deduplication indexes of a statically initialized watcher.
+ * Without it the watcher falls back to linear lookups. Does nothing when C_WATCHER_LINEAR_LOOKUP is defined.
+ *
+ * @param watcher watcher initialized with watcher_init_static
+ * @param buffer index memory
+ * @param buffer_len number of slots in buffer, at least WATCHER_STATIC_INDEX_SIZE of the watcher capacities
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_index(watcher_t *watcher, watcher_size_t *buffer, size_t buffer_len);
+
+/**
+ * @brief Provides a static byte pool for the old value buffers of a statically initialized watcher, allowing
+ * watcher_add_entry and watcher_add_entry_delayed to be used on it
+ *
+ * @param watcher watcher initialized with watcher_init_static
+ * @param pool shadow memory
+ * @param pool_size size of pool in bytes
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_shadow(watcher_t *watcher, void *pool, size_t pool_size);
+
+/**
+ * @brief Provides static memory for the dirty bitmap of a statically initialized watcher and enables dirty tracking
+ * (see watcher_set_dirty_tracking)
+ *
+ * @param watcher watcher initialized with watcher_init_static
+ * @param bitmap bitmap memory
+ * @param words number of words in bitmap, at least WATCHER_DIRTY_BITMAP_WORDS of the entries capacity
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_dirty(watcher_t *watcher, uint32_t *bitmap, size_t words);
+
+/**
+ * @brief Provides static memory for the event queue of a statically initialized watcher (see
+ * watcher_set_event_queue). Slots are used as they are, so slot_size should keep them aligned for the watched types.
+ *
+ * @param watcher watcher initialized with watcher_init_static
+ * @param events event memory
+ * @param slots old value memory, capacity * slot_size bytes; NULL if slot_size is 0
+ * @param capacity number of events
+ * @param slot_size bytes of old value kept for each event
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_event_queue(watcher_t *watcher, watcher_event_t *events, void *slots,
+                                                 size_t capacity, size_t slot_size);
+
+/**
+ * @brief Provides static memory for the changes passed to batched callbacks by a statically initialized watcher,
+ * allowing batched entries to be added to it
+ *
+ * @param watcher watcher initialized with watcher_init_static
+ * @param changes changes memory
+ * @param capacity number of changes, one for each batched entry
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_changes(watcher_t *watcher, watcher_change_t *changes, watcher_size_t capacity);
+
+/**
+ * @brief Provides static memory for the handles of a statically initialized watcher, enabling them
+ *
+ * @param watcher watcher initialized with watcher_init_static
+ * @param slots handle slots
+ * @param capacity number of slots, at least the entries capacity
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_init_static_handles(watcher_t *watcher, watcher_handle_slot_t *slots,
+                                             watcher_size_t capacity);
+
+#ifdef C_WATCHER_COMPACT_ENTRIES
+/**
+ * @brief Sets the region every watched memory lies in, which entries address through 32 bit offsets. It is required
+ * before the first entry is added and cannot change afterwards.
+ *
+ * @param watcher
+ * @param base start of the region
+ * @param size size of the region in bytes, at most 4 GiB
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_set_base(watcher_t *watcher, const void *base, size_t size);
+#endif
+
+/**
+ * @brief Frees the allocated memory for a buffer (if it was not statically allocated)
+ *
+ * @param watcher
+ */
+// TODO: add a "clear" function that doesn't deallocate memory
+void watcher_destroy(watcher_t *watcher);
+
+/**
+ * @brief Makes sure every vector can hold at least the specified number of items without further allocations.
+ * Static watchers only check that their capacity is sufficient.
+ *
+ * @param watcher
+ * @param entries
+ * @param callbacks
+ * @param args
+ * @param delays
+ * @param debouncers
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_reserve(watcher_t *watcher, size_t entries, size_t callbacks, size_t args, size_t delays,
+                                 size_t debouncers);
+
+/**
+ * @brief Makes sure the next `bytes` bytes of old value buffers are carved from a single contiguous region
+ *
+ * @param watcher
+ * @param bytes
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_reserve_shadow(watcher_t *watcher, size_t bytes);
+
+/**
+ * @brief Reports how much memory the watcher holds and how much its entries actually need, for instance to freeze a
+ * dynamically allocated watcher into a static layout
+ *
+ * @param watcher
+ * @param info
+ */
+void watcher_get_memory_info(const watcher_t *watcher, watcher_memory_info_t *info);
+
+/**
+ * @brief Bytes of static memory described by a footprint
+ *
+ * @param footprint
+ * @return size_t
+ */
+size_t watcher_footprint_bytes(const watcher_footprint_t *footprint);
+
+/**
+ * @brief Adds a batch of entries, sizing the vectors once for the whole batch.
+ * If an entry fails the ones preceding it stay registered.
+ *
+ * @param watcher
+ * @param descriptors array of entry descriptions
+ * @param num number of descriptors
+ * @return watcher_result_t WATCHER_RESULT_OK if every entry was added
+ */
+watcher_result_t watcher_add_entries(watcher_t *watcher, const watcher_entry_descriptor_t *descriptors, size_t num);
+
+/**
+ * @brief Adds a new entry from its description, reporting its index apart from the result
+ *
+ * @param watcher
+ * @param descriptor entry description
+ * @param entry_index filled with the index of the entry if successful
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_add_entry_descriptor(watcher_t *watcher, const watcher_entry_descriptor_t *descriptor,
+                                              watcher_size_t *entry_index);
+
+/**
+ * @brief Adds a new entry to the watched vector, allocating the memory dinamically.
+ *
  * @param watcher
  * @param pointer pointer to observe
  * @param size size of the associated type
@@ -225,6 +1120,86 @@ watcher_result_t watcher_add_entry(watcher_t *watcher, const void *pointer, watc
 watcher_result_t watcher_add_entry_delayed(watcher_t *watcher, const void *pointer, watcher_size_t size,
                                            watcher_callback_t callback, void *arg, unsigned long delay);
 
+/**
+ * @brief Adds a new entry to the watched vector, keeping only a 64 bit hash of its content instead of a copy.
+ * The callback receives a NULL old value.
+ *
+ * @param watcher
+ * @param pointer pointer to observe
+ * @param size size of the associated type
+ * @param callback function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+watcher_result_t watcher_add_entry_hashed(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                          watcher_callback_t callback, void *arg);
+
+/**
+ * @brief Adds a new entry to the watched vector with a batched callback: watcher_watch collects the changes of all the
+ * entries sharing it and invokes it once at the end of the call. Entries triggered with watcher_trigger_entry or
+ * watcher_trigger_all get a call each. Batched callbacks must not add batched entries, as that may move the changes.
+ *
+ * @param watcher
+ * @param pointer pointer to observe
+ * @param size size of the associated type
+ * @param callback batched function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+watcher_result_t watcher_add_entry_batched(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                           watcher_batch_callback_t callback, void *arg);
+
+/**
+ * @brief Adds a new entry to the watched vector with a diff callback, which also receives the changed ranges of whole
+ * elements so that it does not have to look for them. Only the changed ranges are copied to the old value afterwards.
+ * When an event queue is set the ranges are found when the event is drained, against the copy in its slot (the whole
+ * entry is reported if it did not fit).
+ *
+ * @param watcher
+ * @param pointer pointer to observe
+ * @param size size of the associated type
+ * @param stride size of each element, 1 to report bytes
+ * @param callback diff function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @return int16_t entry index if successful, -1 on failure
+ */
+watcher_result_t watcher_add_entry_diff(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                        watcher_size_t stride, watcher_diff_callback_t callback, void *arg);
+
+/**
+ * @brief Adds a new entry watching a whole struct, with one callback per field. The struct is kept in a single old
+ * value and compared at once; only the changed ranges are then matched against the fields, instead of comparing each
+ * of them as an entry of its own. The entry is a diff entry reporting bytes, so it can be removed and queued as such;
+ * when it is drained from an event slot smaller than the struct, every field is reported with a NULL old value.
+ *
+ * @param watcher
+ * @param pointer pointer to the struct
+ * @param size size of the struct
+ * @param table fields of the struct, which must outlive the entry
+ * @return int16_t entry index if successful, -1 on failure
+ */
+watcher_result_t watcher_add_struct(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                    const watcher_field_table_t *table);
+
+/**
+ * @brief Adds a new entry to the watched vector in a polling tier. Each tier is a dense range of the entries, so
+ * watcher_watch skips the tiers that are not due as a whole; dirty tracking, the soft-dirty backend and
+ * watcher_watch_budget ignore tiers.
+ * The entry goes at the end of its tier, moving the first entry of every slower tier: when tiers are used, keep track
+ * of entries with watcher_get_handle rather than by index. Entries added while callbacks run are compared on every
+ * call until the function invoking them returns.
+ *
+ * @param watcher
+ * @param pointer pointer to observe
+ * @param size size of the associated type
+ * @param callback function to be called on memory change
+ * @param arg additional argument to be passed to the function
+ * @param tier polling tier, less than C_WATCHER_TIERS
+ * @return int16_t entry index if successful, -1 on failure
+ */
+watcher_result_t watcher_add_entry_tiered(watcher_t *watcher, const void *pointer, watcher_size_t size,
+                                          watcher_callback_t callback, void *arg, uint8_t tier);
+
 /**
  * @brief Adds a new entry to the watched vector, with pre allocated memory for the old value buffer
  *
@@ -256,15 +1231,215 @@ watcher_result_t watcher_add_entry_delayed_static(watcher_t *watcher, const void
                                                   void *old_buffer);
 
 
+/**
+ * @brief Returns a handle to an entry, which stays valid until the entry is removed while its index may change.
+ * The first call on a dynamically allocated watcher enables handles, which from then on take a slot per entry.
+ *
+ * @param watcher
+ * @param entry_index index returned on registration
+ * @return watcher_handle_t handle, WATCHER_INVALID_HANDLE if the index is not valid or memory is not available
+ */
+watcher_handle_t watcher_get_handle(watcher_t *watcher, watcher_size_t entry_index);
+
+/**
+ * @brief Retrieves the current index of an entry, e.g. for watcher_trigger_entry or watcher_mark_dirty
+ *
+ * @param watcher
+ * @param handle
+ * @param entry_index filled with the index of the entry
+ * @return watcher_result_t WATCHER_RESULT_OK if successful, WATCHER_RESULT_INVALID_ARGS if the entry was removed
+ */
+watcher_result_t watcher_get_entry_index(watcher_t *watcher, watcher_handle_t handle, watcher_size_t *entry_index);
+
+/**
+ * @brief Removes an entry in constant time, moving the last entry in its place; its debouncer goes with it.
+ * The handle is invalid from now on. Entries removed by callbacks stay in place, silent, until the function invoking
+ * them returns. The old value buffer is only given back to the shadow arena by watcher_compact.
+ *
+ * @param watcher
+ * @param handle
+ * @return watcher_result_t WATCHER_RESULT_OK if successful, WATCHER_RESULT_INVALID_ARGS if the entry was removed
+ */
+watcher_result_t watcher_remove_entry(watcher_t *watcher, watcher_handle_t handle);
+
+/**
+ * @brief Reclaims the memory left behind by removed entries: callbacks, args and delays no entry uses anymore are
+ * dropped, old value buffers are repacked in entry order into a single slab and the vectors are shrunk to fit.
+ * Only for dynamically allocated watchers, outside of callbacks.
+ *
+ * @param watcher
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_compact(watcher_t *watcher);
+
+
+#ifdef C_WATCHER_CONCURRENT
+/**
+ * @brief Queues an entry for registration by the next watcher_watch call. Unlike every other function it can be called
+ * from any thread, and it never blocks. The node must stay valid until its done flag is set (with release semantics).
+ *
+ * @param watcher
+ * @param node entry to register
+ */
+void watcher_stage_entry(watcher_t *watcher, watcher_staged_entry_t *node);
+#endif
+
+
 /**
  * @brief Run the observer engine
  *
  * @param watcher
  * @param timestamp current time
- * @return watcher_size_t number of entries which had their callback invoked
+ * @return watcher_size_t number of entries which had their callback invoked, or an event queued
  */
 watcher_size_t watcher_watch(watcher_t *watcher, unsigned long timestamp);
 
+/**
+ * @brief Run the observer engine, comparing the entries on the threads of a pool. Callbacks are still invoked on the
+ * calling thread, in entry order; changes made by callbacks to entries already compared are reported by the next
+ * call. With dirty tracking enabled, fewer than C_WATCHER_PARALLEL_MIN_ENTRIES entries or a NULL pool (or if the
+ * required bitmap cannot be allocated) this is the same as watcher_watch.
+ *
+ * @param watcher
+ * @param timestamp current time
+ * @param pool thread pool, e.g. initialized with watcher_pool_init_pthread
+ * @return watcher_size_t number of entries which had their callback invoked, or an event queued
+ */
+watcher_size_t watcher_watch_parallel(watcher_t *watcher, unsigned long timestamp, const watcher_pool_t *pool);
+
+/**
+ * @brief Invokes the callbacks of the changes queued by watcher_watch, oldest first. While an event queue is set this
+ * is the only place callbacks are invoked, and it may run on a thread other than the watching one as long as a single
+ * thread drains the queue; such a consumer must not call other watcher functions from the callbacks.
+ * The callbacks receive the copy of the old value taken when the change was detected, and the watched memory itself as
+ * the new value, which may have changed again since.
+ *
+ * @param watcher
+ * @param max maximum number of events to dispatch
+ * @return watcher_size_t number of callbacks invoked
+ */
+watcher_size_t watcher_drain_events(watcher_t *watcher, watcher_size_t max);
+
+/**
+ * @brief Run the observer engine on part of the entries, resuming from where the previous call stopped, so that a
+ * full sweep is spread over several calls. Expired delayed entries are handled by every call, regardless of the
+ * budget. The soft-dirty backend is not used: large entries are polled like the others.
+ *
+ * @param watcher
+ * @param timestamp current time
+ * @param budget limits of the call
+ * @param swept if not NULL, set to 1 if this call reached the last entry, so the next one starts a new sweep
+ * @return watcher_size_t number of entries which had their callback invoked, or an event queued
+ */
+watcher_size_t watcher_watch_budget(watcher_t *watcher, unsigned long timestamp, const watcher_budget_t *budget,
+                                    uint8_t *swept);
+
+#ifndef C_WATCHER_NO_PTHREAD
+/**
+ * @brief Starts a pool of pthreads. The thread calling run works on the tasks as well, so threads - 1 are created.
+ *
+ * @param pool
+ * @param threads number of threads, including the calling one
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_pool_init_pthread(watcher_pool_t *pool, size_t threads);
+
+/**
+ * @brief Stops the threads of a pool started with watcher_pool_init_pthread and frees its memory
+ *
+ * @param pool
+ */
+void watcher_pool_destroy_pthread(watcher_pool_t *pool);
+#endif
+
+/**
+ * @brief Reports when the next delayed callback is due, so the caller knows when to invoke watcher_watch again.
+ * Delayed entries triggered outside of watcher_watch are due immediately, as they are armed by its next call.
+ *
+ * @param watcher
+ * @param deadline filled with the timestamp of the earliest pending delayed callback
+ * @return uint8_t 1 if a delayed callback is pending, 0 otherwise
+ */
+uint8_t watcher_next_deadline(watcher_t *watcher, unsigned long *deadline);
+
+/**
+ * @brief Sets how often the entries of a slower tier are compared by watcher_watch, by default on every call
+ *
+ * @param watcher
+ * @param tier tier from 1 to C_WATCHER_TIERS - 1; tier 0 is compared by every call
+ * @param calls compare the tier every this many calls, when period is 0
+ * @param period compare the tier once this many timestamp units passed since the last time, 0 to count calls
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_set_tier(watcher_t *watcher, uint8_t tier, unsigned calls, unsigned long period);
+
+/**
+ * @brief Enables or disables dirty tracking. While enabled watcher_watch only compares the entries marked with
+ * watcher_mark_dirty or watcher_mark_dirty_ptr since the previous call, and changes to unmarked entries go unnoticed.
+ * Every entry is marked when tracking is enabled, so changes made while it was off are not lost.
+ *
+ * @param watcher
+ * @param enabled
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_set_dirty_tracking(watcher_t *watcher, uint8_t enabled);
+
+/**
+ * @brief Selects how watcher_watch finds changes, normally right after watcher_init.
+ *
+ * WATCHER_BACKEND_SOFT_DIRTY asks the kernel which pages were written since the previous call (through
+ * /proc/self/pagemap) and only compares those for entries of at least C_WATCHER_SOFT_DIRTY_MIN_SIZE bytes. Note that:
+ *  - soft-dirty bits are cleared for the whole process (through /proc/self/clear_refs), so only one watcher per
+ *    process can use this backend, until it selects WATCHER_BACKEND_POLL or is destroyed, and every page of the
+ *    process faults once on its first write after each call;
+ *  - large entries must only be written by the thread calling watcher_watch: a page written by another thread
+ *    between the read of its bit and the clearing of all of them is seen as clean, and the change is lost until the
+ *    page is written again;
+ *  - writes by a callback to its own large entry are reported by the next call;
+ *  - only writes made by this process are seen, so memory shared with other processes must be polled.
+ * It is only available on Linux kernels built with CONFIG_MEM_SOFT_DIRTY and for dynamically allocated watchers.
+ *
+ * @param watcher
+ * @param backend one of watcher_backend_t
+ * @return watcher_result_t WATCHER_RESULT_OK if successful, WATCHER_RESULT_INVALID_ARGS if the backend is unavailable
+ * or taken by another watcher
+ */
+watcher_result_t watcher_set_backend(watcher_t *watcher, watcher_backend_t backend);
+
+/**
+ * @brief Sets up a queue of `capacity` events and makes watcher_watch push changes into it instead of invoking the
+ * callbacks, so a slow callback no longer delays the scan; they are invoked by watcher_drain_events instead.
+ * The old value of each change is copied into a slot of the event if the entry is at most slot_size bytes; larger
+ * entries get a NULL old value. When the queue is full a change is left in place and reported again by a later
+ * watcher_watch call, and an expired delayed entry fires on the first call after the consumer made room.
+ * A capacity of 0 invokes callbacks inline again. It can only be changed while the queue is empty.
+ *
+ * @param watcher dynamically allocated watcher
+ * @param capacity number of events
+ * @param slot_size bytes of old value kept for each event, rounded up to C_WATCHER_SHADOW_ALIGNMENT
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_set_event_queue(watcher_t *watcher, size_t capacity, size_t slot_size);
+
+/**
+ * @brief Marks an entry as possibly changed, so the next watcher_watch compares it. Does nothing if dirty tracking
+ * is disabled.
+ *
+ * @param watcher
+ * @param entry_index
+ */
+void watcher_mark_dirty(watcher_t *watcher, watcher_size_t entry_index);
+
+/**
+ * @brief Marks every entry watching `pointer` (as passed on registration) as possibly changed.
+ * Does nothing if dirty tracking is disabled.
+ *
+ * @param watcher
+ * @param pointer
+ * @return uint8_t 1 if an entry watching pointer was found, 0 otherwise
+ */
+uint8_t watcher_mark_dirty_ptr(watcher_t *watcher, const void *pointer);
+
 /**
  * @brief Trigger an entry, invoking its callback
  *
@@ -284,4 +1459,133 @@ void watcher_trigger_all(watcher_t *watcher);
 void watcher_reset_all(watcher_t *watcher);
 
 
+#ifdef C_WATCHER_STATS
+/**
+ * @brief Copies the counters of the watcher
+ *
+ * @param watcher
+ * @param stats
+ */
+void watcher_get_stats(const watcher_t *watcher, watcher_stats_t *stats);
+
+/**
+ * @brief Copies the counters of an entry
+ *
+ * @param watcher
+ * @param entry_index
+ * @param stats
+ * @return watcher_result_t WATCHER_RESULT_OK if successful
+ */
+watcher_result_t watcher_get_entry_stats(const watcher_t *watcher, watcher_size_t entry_index,
+                                         watcher_entry_stats_t *stats);
+
+/**
+ * @brief Zeroes the counters of the watcher and of every entry
+ *
+ * @param watcher
+ */
+void watcher_reset_stats(watcher_t *watcher);
+#endif
+
+
+#ifdef C_WATCHER_TRACE
+// Buckets of a watcher_histogram_t: bucket 0 counts zeroes, bucket b values from 2^(b-1) to 2^b - 1
+#define WATCHER_HISTOGRAM_BUCKETS (sizeof(unsigned long) * 8 + 1)
+
+/**
+ * @brief Log2 histogram of latencies
+ */
+typedef struct {
+    unsigned long buckets[WATCHER_HISTOGRAM_BUCKETS];
+    unsigned long count;
+    unsigned long max;
+} watcher_histogram_t;
+
+/**
+ * @brief Scan or callback kept by a trace recorder
+ */
+typedef struct {
+    unsigned long  start;        // Clock of the recorder
+    unsigned long  duration;
+    unsigned long  delay;        // Timestamp units from the first change of a debounced entry to its callback
+    watcher_size_t index;        // Entry of a callback, number of callbacks invoked by a scan
+    watcher_size_t callback;     // Callback index, WATCHER_TRACE_SCAN for a scan
+} watcher_trace_record_t;
+
+// Callback index of the records of scans
+#define WATCHER_TRACE_SCAN ((watcher_size_t)~(watcher_size_t)0)
+
+/**
+ * @brief Built-in trace hooks: latency histograms by callback index and a ring of the most recent scans and callbacks
+ */
+typedef struct {
+    unsigned long (*clock)(void *arg);     // Monotonic clock; the Chrome trace export takes it as microseconds
+    void                   *clock_arg;     // Passed to clock
+    watcher_histogram_t    *callbacks;     // Callback latencies, by callback index
+    watcher_size_t          num_callbacks;
+    watcher_histogram_t     scans;         // Scan durations, callbacks included
+    watcher_histogram_t     debounce;      // Timestamp units from the first change of a debounced entry to its callback
+    watcher_trace_record_t *records;       // Ring of records, oldest first from head once it wrapped around
+    size_t                  capacity;
+    size_t                  head;          // Records written so far
+} watcher_trace_recorder_t;
+
+/**
+ * @brief Sets the hooks called around every scan and every callback invoked by the watcher; callbacks of queued
+ * events, invoked by watcher_drain_events, are not reported. Batched callbacks are reported once per call.
+ *
+ * @param watcher
+ * @param hooks hooks to copy, NULL to remove them
+ */
+void watcher_set_trace_hooks(watcher_t *watcher, const watcher_trace_hooks_t *hooks);
+
+/**
+ * @brief Initializes a trace recorder on caller provided memory
+ *
+ * @param recorder
+ * @param histograms latency histograms, one per callback; callbacks past num_histograms are only recorded in the ring
+ * @param num_histograms
+ * @param records ring of records
+ * @param capacity number of records, 0 to only keep histograms
+ * @param clock monotonic clock measuring latencies
+ * @param clock_arg passed to clock
+ */
+void watcher_trace_recorder_init(watcher_trace_recorder_t *recorder, watcher_histogram_t *histograms,
+                                 watcher_size_t num_histograms, watcher_trace_record_t *records, size_t capacity,
+                                 unsigned long (*clock)(void *arg), void *clock_arg);
+
+/**
+ * @brief Fills hooks feeding a recorder, to be passed to watcher_set_trace_hooks
+ *
+ * @param recorder
+ * @param hooks
+ */
+void watcher_trace_recorder_hooks(watcher_trace_recorder_t *recorder, watcher_trace_hooks_t *hooks);
+
+/**
+ * @brief Returns an upper bound of a percentile of a histogram: the largest value of the bucket it falls in
+ *
+ * @param histogram
+ * @param percent from 0 to 100
+ * @return unsigned long 0 if the histogram is empty
+ */
+unsigned long watcher_histogram_percentile(const watcher_histogram_t *histogram, unsigned percent);
+
+/**
+ * @brief Writes the records of a recorder as Chrome trace_event JSON, to be loaded in chrome://tracing or Perfetto
+ *
+ * @param recorder
+ * @param write called with consecutive pieces of the JSON text
+ * @param arg passed to write
+ * @return size_t number of bytes written
+ */
+size_t watcher_trace_export_chrome(const watcher_trace_recorder_t *recorder,
+                                   void (*write)(void *arg, const char *text, size_t length), void *arg);
+#endif
+
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
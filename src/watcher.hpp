@@ -0,0 +1,326 @@
+#ifndef C_WATCHER_HPP_INCLUDED
+#define C_WATCHER_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "watcher.h"
+
+#ifdef C_WATCHER_CONCURRENT
+#error "The C++ front-end does not support C_WATCHER_CONCURRENT"
+#endif
+
+
+namespace c_watcher {
+
+namespace detail {
+
+// Owner of the callback of an entry, chained to the others of the same watcher
+struct Callable {
+    Callable *next = nullptr;
+    virtual ~Callable() = default;
+};
+
+
+// The callback of an entry watching a T: the trampoline is generated for each T and callback type, so the size is a
+// compile time constant and the callback is called directly, with typed values and no user_ptr
+template <typename T, typename F>
+struct TypedCallable final : Callable {
+    F function;
+
+    template <typename G>
+    explicit TypedCallable(G &&callback) : function(std::forward<G>(callback)) {}
+
+    static void invoke(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr, void *arg) {
+        (void)size;
+        (void)user_ptr;
+        static_cast<TypedCallable *>(arg)->function(*static_cast<const T *>(old_value),
+                                                    *static_cast<const T *>(new_value));
+    }
+};
+
+}     // namespace detail
+
+
+/**
+ * @brief Operations shared by Watcher and StaticWatcher; Derived provides the memory of the callbacks
+ */
+template <typename Derived>
+class BasicWatcher {
+  public:
+    BasicWatcher(const BasicWatcher &)            = delete;
+    BasicWatcher &operator=(const BasicWatcher &) = delete;
+
+    /**
+     * @brief Watches a value, calling function(old_value, new_value) with two const T & when it changes
+     *
+     * @param value watched memory, which must outlive the watcher
+     * @param function callback, moved or copied into the watcher
+     * @param entry_index if not NULL, filled with the index of the entry
+     * @return watcher_result_t WATCHER_RESULT_OK if successful
+     */
+    template <typename T, typename F>
+    watcher_result_t watch(T &value, F &&function, watcher_size_t *entry_index = nullptr) {
+        return add(value, 0, 0, std::forward<F>(function), entry_index);
+    }
+
+    /**
+     * @brief Watches a value, calling function(old_value, new_value) once delay ticks passed since it changed
+     */
+    template <typename T, typename F>
+    watcher_result_t watch_delayed(T &value, unsigned long delay, F &&function, watcher_size_t *entry_index = nullptr) {
+        return add(value, delay, 0, std::forward<F>(function), entry_index);
+    }
+
+    /**
+     * @brief Watches a value in a polling tier, see watcher_add_entry_tiered
+     */
+    template <typename T, typename F>
+    watcher_result_t watch_tiered(T &value, uint8_t tier, F &&function, watcher_size_t *entry_index = nullptr) {
+        return add(value, 0, tier, std::forward<F>(function), entry_index);
+    }
+
+    /**
+     * @brief Runs the observer engine, see watcher_watch
+     */
+    watcher_size_t poll(unsigned long timestamp) {
+        return watcher_watch(&watcher_, timestamp);
+    }
+
+    /**
+     * @brief Reports when the next delayed callback is due, see watcher_next_deadline
+     */
+    bool next_deadline(unsigned long &deadline) {
+        return watcher_next_deadline(&watcher_, &deadline) != 0;
+    }
+
+    void trigger_all() {
+        watcher_trigger_all(&watcher_);
+    }
+
+    void reset_all() {
+        watcher_reset_all(&watcher_);
+    }
+
+    watcher_handle_t handle(watcher_size_t entry_index) {
+        return watcher_get_handle(&watcher_, entry_index);
+    }
+
+    /**
+     * @brief Stops watching an entry; its callback is only released with the watcher
+     */
+    watcher_result_t remove(watcher_handle_t handle) {
+        return watcher_remove_entry(&watcher_, handle);
+    }
+
+    // The wrapped watcher, for the functions that have no method
+    watcher_t *native() {
+        return &watcher_;
+    }
+
+    const watcher_t *native() const {
+        return &watcher_;
+    }
+
+  protected:
+    BasicWatcher()  = default;
+    ~BasicWatcher() = default;
+
+    // Destroys the callbacks, giving their memory back through Derived::release
+    void release_callables() {
+        while (callables_ != nullptr) {
+            detail::Callable *next = callables_->next;
+            static_cast<Derived *>(this)->release(callables_);
+            callables_ = next;
+        }
+    }
+
+    watcher_t         watcher_;
+    detail::Callable *callables_ = nullptr;
+
+  private:
+    template <typename T, typename F>
+    watcher_result_t add(T &value, unsigned long delay, uint8_t tier, F &&function, watcher_size_t *entry_index) {
+        using Callable = detail::TypedCallable<T, typename std::decay<F>::type>;
+
+        static_assert(std::is_trivially_copyable<T>::value, "watched values are compared and copied bytewise");
+        static_assert(sizeof(T) <= std::numeric_limits<watcher_size_t>::max(),
+                      "the size of watched values must fit in watcher_size_t");
+        // Old values are kept in the entry itself or in the shadow arena, aligned to C_WATCHER_SHADOW_ALIGNMENT
+        static_assert(alignof(T) <= C_WATCHER_SHADOW_ALIGNMENT, "old values are not aligned enough for T");
+
+        Callable *callable = static_cast<Derived *>(this)->template make<Callable>(std::forward<F>(function));
+        if (callable == nullptr) {
+            return Derived::exhausted;
+        }
+
+        watcher_entry_descriptor_t descriptor = {};
+        descriptor.pointer                    = &value;
+        descriptor.size                       = static_cast<watcher_size_t>(sizeof(T));
+        descriptor.callback                   = &Callable::invoke;
+        descriptor.arg                        = static_cast<detail::Callable *>(callable);
+        descriptor.delay                      = delay;
+        descriptor.tier                       = tier;
+
+        watcher_size_t   index  = 0;
+        watcher_result_t result = watcher_add_entry_descriptor(&watcher_, &descriptor, &index);
+        if (result != WATCHER_RESULT_OK) {
+            static_cast<Derived *>(this)->release(callable);
+            return result;
+        }
+
+        callable->next = callables_;
+        callables_     = callable;
+        if (entry_index != nullptr) {
+            *entry_index = index;
+        }
+        return WATCHER_RESULT_OK;
+    }
+};
+
+
+/**
+ * @brief Dynamically allocated watcher, destroyed along with its old value buffers and callbacks
+ */
+class Watcher : public BasicWatcher<Watcher> {
+    friend class BasicWatcher<Watcher>;
+
+  public:
+    explicit Watcher(void *(*fn_realloc)(void *, size_t) = std::realloc, void (*fn_free)(void *) = std::free) {
+        watcher_init(&watcher_, nullptr, fn_realloc, fn_free);
+    }
+
+    ~Watcher() {
+        watcher_destroy(&watcher_);
+        release_callables();
+    }
+
+    // Every pointer held by a watcher_t leads out of it, so it moves bytewise; the source is left empty
+    Watcher(Watcher &&other) noexcept {
+        watcher_            = other.watcher_;
+        callables_          = other.callables_;
+        other.callables_    = nullptr;
+        watcher_init(&other.watcher_, nullptr, watcher_.fn_realloc, watcher_.fn_free);
+    }
+
+    Watcher &operator=(Watcher &&other) noexcept {
+        if (this != &other) {
+            watcher_destroy(&watcher_);
+            release_callables();
+            watcher_         = other.watcher_;
+            callables_       = other.callables_;
+            other.callables_ = nullptr;
+            watcher_init(&other.watcher_, nullptr, watcher_.fn_realloc, watcher_.fn_free);
+        }
+        return *this;
+    }
+
+  private:
+    static constexpr watcher_result_t exhausted = WATCHER_RESULT_ALLOC_ERROR;
+
+    template <typename Callable, typename F>
+    Callable *make(F &&function) {
+        return new (std::nothrow) Callable(std::forward<F>(function));
+    }
+
+    void release(detail::Callable *callable) {
+        delete callable;
+    }
+};
+
+
+/**
+ * @brief Watcher living in its own storage, on top of watcher_init_static: it never allocates.
+ * As the watcher points into the object it can be neither copied nor moved.
+ *
+ * @tparam Entries capacity of every vector
+ * @tparam ShadowBytes old values of the entries larger than a pointer, each rounded to C_WATCHER_SHADOW_ALIGNMENT
+ * @tparam CallableBytes callbacks, along with their captures and two pointers of bookkeeping each
+ */
+template <std::size_t Entries, std::size_t ShadowBytes = Entries * 2 * sizeof(void *),
+          std::size_t CallableBytes = Entries * 6 * sizeof(void *)>
+class StaticWatcher : public BasicWatcher<StaticWatcher<Entries, ShadowBytes, CallableBytes>> {
+    friend class BasicWatcher<StaticWatcher>;
+
+    static_assert(Entries > 0 && Entries <= C_WATCHER_MAX_ENTRIES, "capacity out of range");
+
+  public:
+    static constexpr std::size_t capacity = Entries;
+
+    StaticWatcher() {
+        const watcher_size_t    size   = static_cast<watcher_size_t>(Entries);
+        watcher_static_config_t config = {};
+        config.entries                 = entries_;
+        config.entries_capacity        = size;
+        config.callbacks               = callbacks_;
+        config.callbacks_capacity      = size;
+        config.args                    = args_;
+        config.args_capacity           = size;
+        config.delays                  = delays_;
+        config.delays_capacity         = size;
+        config.debouncers              = debouncers_;
+        config.debouncers_capacity     = size;
+        config.shadow                  = shadow_;
+        config.shadow_size             = sizeof(shadow_);
+#ifndef C_WATCHER_LINEAR_LOOKUP
+        config.index     = index_;
+        config.index_len = sizeof(index_) / sizeof(index_[0]);
+#endif
+        watcher_init_static_config(&this->watcher_, &config);
+    }
+
+    ~StaticWatcher() {
+        watcher_destroy(&this->watcher_);
+        this->release_callables();
+    }
+
+  private:
+    static constexpr watcher_result_t exhausted = WATCHER_RESULT_STATIC_OVERFLOW;
+
+    template <typename Callable, typename F>
+    Callable *make(F &&function) {
+        static_assert(alignof(Callable) <= alignof(std::max_align_t), "over-aligned callbacks are not supported");
+
+        // Bump allocation: the memory of the callbacks is only given back with the watcher, or right away if the
+        // registration fails
+        std::size_t offset = (used_ + alignof(Callable) - 1) / alignof(Callable) * alignof(Callable);
+        if (offset + sizeof(Callable) > CallableBytes) {
+            return nullptr;
+        }
+        Callable *callable = new (&callables_memory_[offset]) Callable(std::forward<F>(function));
+        last_              = callable;
+        last_used_         = used_;
+        used_              = offset + sizeof(Callable);
+        return callable;
+    }
+
+    void release(detail::Callable *callable) {
+        if (callable == last_) {
+            used_ = last_used_;
+            last_ = nullptr;
+        }
+        callable->~Callable();
+    }
+
+    watcher_entry_t     entries_[Entries];
+    watcher_callback_t  callbacks_[Entries];
+    void               *args_[Entries];
+    unsigned long       delays_[Entries];
+    watcher_debouncer_t debouncers_[Entries];
+    alignas(C_WATCHER_SHADOW_ALIGNMENT) uint8_t shadow_[ShadowBytes > 0 ? ShadowBytes : 1];
+#ifndef C_WATCHER_LINEAR_LOOKUP
+    watcher_size_t index_[WATCHER_STATIC_INDEX_SIZE(Entries, Entries, Entries)];
+#endif
+    alignas(std::max_align_t) unsigned char callables_memory_[CallableBytes > 0 ? CallableBytes : 1];
+    std::size_t       used_      = 0;
+    detail::Callable *last_      = nullptr;     // Most recent allocation, given back first
+    std::size_t       last_used_ = 0;
+};
+
+}     // namespace c_watcher
+
+
+#endif
@@ -0,0 +1,208 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include "watcher.h"
+
+
+#define SLOTS 48
+
+// Every watched value lies in the model
+static struct {
+    uint8_t  flag;
+    uint32_t counter;
+    uint64_t timestamp;
+    uint8_t  slots[SLOTS][64];
+} model;
+
+static watcher_t *registering_watcher = NULL;
+static int        calls               = 0;
+static uint8_t    last_old            = 0;
+
+
+static void callback(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr, void *arg) {
+    (void)new_value;
+    (void)user_ptr;
+    (void)arg;
+    // Hashed entries have no old value
+    if (old_value != NULL) {
+        last_old = ((uint8_t *)old_value)[size - 1];
+    }
+    calls++;
+}
+
+
+// Registers enough entries to move the shadow region, then reads the old value it was given
+static void registering_callback(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr,
+                                 void *arg) {
+    uint8_t old[64];
+    size_t  i = 0;
+    (void)new_value;
+    (void)user_ptr;
+    (void)arg;
+
+    memcpy(old, old_value, size);
+    for (i = 1; i < SLOTS; i++) {
+        assert_true(WATCHER_ADD_ENTRY(registering_watcher, &model.slots[i], callback, NULL) >= 0);
+    }
+    assert_memory_equal(old, old_value, size);
+    calls++;
+}
+
+
+static void compact_layout_test(void **state) {
+    (void)state;
+    watcher_t watcher;
+    uint8_t   outside = 0;
+
+    memset(&model, 0, sizeof(model));
+    calls = 0;
+    assert_int_equal(WATCHER_RESULT_OK, WATCHER_INIT_STD(&watcher, NULL));
+
+    // Nothing can be watched before the base region is known
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, WATCHER_ADD_ENTRY(&watcher, &model.flag, callback, NULL));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_base(&watcher, &model, sizeof(model)));
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, WATCHER_ADD_ENTRY(&watcher, &outside, callback, NULL));
+    // Past the end of the region
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS,
+                     watcher_add_entry(&watcher, &model.slots[SLOTS - 1][32], 64, callback, NULL));
+
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.flag, callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.counter, callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.timestamp, callback, NULL) >= 0);
+    assert_true(watcher_add_entry_hashed(&watcher, &model.slots[0], sizeof(model.slots[0]), callback, NULL) >= 0);
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_set_base(&watcher, &model, sizeof(model)));
+
+    // Old values up to 4 bytes stay in the entry, the timestamp needs the shadow region
+    watcher_memory_info_t info;
+    watcher_get_memory_info(&watcher, &info);
+    assert_true(info.used.shadow >= sizeof(model.timestamp));
+
+    model.flag      = 1;
+    model.counter   = 2;
+    model.timestamp = 3;
+    assert_int_equal(3, watcher_watch(&watcher, 0));
+    assert_int_equal(3, calls);
+    model.slots[0][5] = 1;
+    assert_int_equal(1, watcher_watch(&watcher, 1));
+    assert_int_equal(0, watcher_watch(&watcher, 2));
+
+    watcher_destroy(&watcher);
+}
+
+
+static void compact_shadow_growth_test(void **state) {
+    (void)state;
+    watcher_t watcher;
+    size_t    i = 0;
+
+    memset(&model, 0, sizeof(model));
+    calls               = 0;
+    registering_watcher = &watcher;
+    assert_int_equal(WATCHER_RESULT_OK, WATCHER_INIT_STD(&watcher, NULL));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_base(&watcher, &model, sizeof(model)));
+
+    // The registrations move the shadow region while the callback still holds its old value
+    model.slots[0][63] = 7;
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.slots[0], registering_callback, NULL) >= 0);
+    model.slots[0][63] = 8;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, calls);
+    assert_int_equal(SLOTS, watcher.entries.num);
+
+    // Every old value followed the region
+    for (i = 1; i < SLOTS; i++) {
+        model.slots[i][63] = (uint8_t)i;
+    }
+    assert_int_equal(SLOTS - 1, watcher_watch(&watcher, 1));
+    assert_int_equal(SLOTS, calls);
+
+    // Compaction repacks the old values and keeps them valid
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, watcher_get_handle(&watcher, 3)));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_compact(&watcher));
+    model.slots[SLOTS - 1][63] = 100;
+    assert_int_equal(1, watcher_watch(&watcher, 2));
+    assert_int_equal(SLOTS - 1, last_old);
+    assert_int_equal(0, watcher_watch(&watcher, 3));
+
+    watcher_destroy(&watcher);
+}
+
+
+static void compact_index_limit_test(void **state) {
+    (void)state;
+    watcher_t watcher;
+    uintptr_t i = 0;
+
+    memset(&model, 0, sizeof(model));
+    assert_int_equal(WATCHER_RESULT_OK, WATCHER_INIT_STD(&watcher, NULL));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_base(&watcher, &model, sizeof(model)));
+
+    // Args take 8 bit indexes
+    for (i = 0; i <= 0xFF; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &model.flag, callback, (void *)i) >= 0);
+    }
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, WATCHER_ADD_ENTRY(&watcher, &model.flag, callback, (void *)i));
+    // Known args still fit
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.flag, callback, (void *)0) >= 0);
+
+    watcher_destroy(&watcher);
+}
+
+
+static void compact_static_test(void **state) {
+    (void)state;
+    watcher_t           watcher;
+    watcher_entry_t     entries[2];
+    watcher_callback_t  callbacks[1];
+    void               *args[1];
+    unsigned long       delays[1];
+    watcher_debouncer_t debouncers[1];
+    uint64_t            shadow[1];
+    uint64_t            old_buffer = 0;
+
+    memset(&model, 0, sizeof(model));
+    calls                          = 0;
+    watcher_static_config_t config = {
+        .entries             = entries,
+        .entries_capacity    = 2,
+        .callbacks           = callbacks,
+        .callbacks_capacity  = 1,
+        .args                = args,
+        .args_capacity       = 1,
+        .delays              = delays,
+        .delays_capacity     = 1,
+        .debouncers          = debouncers,
+        .debouncers_capacity = 1,
+        .shadow              = shadow,
+        .shadow_size         = WATCHER_STATIC_SHADOW_SIZE(sizeof(model.timestamp)),
+    };
+    assert_int_equal(WATCHER_RESULT_OK, watcher_init_static_config(&watcher, &config));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_base(&watcher, &model, sizeof(model)));
+
+    // Old value buffers outside of the shadow region cannot be addressed
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS,
+                     watcher_add_entry_static(&watcher, &model.timestamp, sizeof(model.timestamp), callback, NULL,
+                                              &old_buffer));
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.timestamp, callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &model.counter, callback, NULL) >= 0);
+
+    model.timestamp = 1;
+    model.counter   = 1;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(2, calls);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(compact_layout_test),
+        cmocka_unit_test(compact_shadow_growth_test),
+        cmocka_unit_test(compact_index_limit_test),
+        cmocka_unit_test(compact_static_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
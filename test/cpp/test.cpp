@@ -0,0 +1,101 @@
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <setjmp.h>
+#include <utility>
+extern "C" {
+#include <cmocka.h>
+}
+#include "watcher.hpp"
+
+
+struct Point {
+    int x;
+    int y;
+};
+
+
+static void watcher_cpp_test(void **state) {
+    (void)state;
+    int      value   = 0;
+    Point    point   = {1, 2};
+    int      calls   = 0;
+    int      old_x   = 0;
+    uint64_t big[16] = {0};
+
+    c_watcher::Watcher watcher;
+    assert_int_equal(WATCHER_RESULT_OK, watcher.watch(value, [&calls](const int &old_value, const int &new_value) {
+        assert_int_equal(old_value + 1, new_value);
+        calls++;
+    }));
+    watcher_size_t point_index = 0;
+    assert_int_equal(WATCHER_RESULT_OK, watcher.watch(
+                                            point,
+                                            [&old_x](const Point &old_value, const Point &new_value) {
+                                                old_x = old_value.x;
+                                                assert_int_equal(10, new_value.x);
+                                            },
+                                            &point_index));
+    assert_int_equal(1, point_index);
+    // Larger than a pointer, so the old value comes from the shadow arena
+    assert_int_equal(WATCHER_RESULT_OK,
+                     watcher.watch_delayed(big, 5, [&calls](const uint64_t (&)[16], const uint64_t (&new_value)[16]) {
+                         assert_int_equal(3, new_value[15]);
+                         calls++;
+                     }));
+
+    watcher.poll(0);
+    value++;
+    point.x = 10;
+    big[15] = 3;
+    watcher.poll(1);
+    assert_int_equal(1, calls);
+    assert_int_equal(1, old_x);
+
+    // A moved watcher keeps its entries and callbacks, the source is left empty
+    c_watcher::Watcher moved(std::move(watcher));
+    assert_int_equal(0, watcher.native()->entries.num);
+    assert_int_equal(0, watcher.poll(2));
+    value++;
+    moved.poll(6);
+    assert_int_equal(3, calls);
+
+    watcher = std::move(moved);
+    value++;
+    watcher.poll(7);
+    assert_int_equal(4, calls);
+}
+
+
+static void watcher_cpp_static_test(void **state) {
+    (void)state;
+    int  values[3] = {0};
+    int  calls     = 0;
+    long large     = 0;
+
+    c_watcher::StaticWatcher<2> watcher;
+    static_assert(c_watcher::StaticWatcher<2>::capacity == 2, "capacity is known at compile time");
+    for (int i = 0; i < 2; i++) {
+        assert_int_equal(WATCHER_RESULT_OK, watcher.watch(values[i], [&calls, i](const int &, const int &new_value) {
+            assert_int_equal(i + 1, new_value);
+            calls++;
+        }));
+    }
+    // The failed registration gives its callback memory back
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, watcher.watch(large, [](const long &, const long &) {}));
+
+    values[0] = 1;
+    values[1] = 2;
+    assert_int_equal(2, watcher.poll(0));
+    assert_int_equal(2, calls);
+}
+
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(watcher_cpp_test),
+        cmocka_unit_test(watcher_cpp_static_test),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -7,6 +7,11 @@
 #include <cmocka.h>
 #include "watcher.h"
 
+#ifdef C_WATCHER_CONCURRENT
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 static char      var1 = 0;
 static int       var2 = 0;
 static long long var3 = 0;
@@ -102,6 +107,9 @@ void watcher_delayed_test(void **state) {
     assert_int_equal(1, cbtest);
     assert_false(watcher_watch(&watcher, 11000));
     assert_int_equal(1, cbtest);
+    // The old value is updated once the delayed callback fires
+    assert_false(watcher_watch(&watcher, 17000));
+    assert_int_equal(1, cbtest);
 
     watcher_destroy(&watcher);
 }
@@ -132,11 +140,1703 @@ void watcher_mixed_test(void **state) {
 }
 
 
+void watcher_batch_test(void **state) {
+    (void)state;
+    cbtest            = 0;
+    int      values[] = {0, 0, 0};
+    uint64_t slice[4] = {0};
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    assert_int_equal(WATCHER_RESULT_OK, watcher_reserve(&watcher, 16, 2, 2, 1, 1));
+    assert_true(watcher.entries.capacity >= 16);
+
+    watcher_entry_descriptor_t descriptors[] = {
+        WATCHER_ENTRY(&values[0], callback, entries_arg),
+        WATCHER_ENTRY(&values[1], callback, entries_arg),
+        WATCHER_ENTRY_DELAYED(&values[2], callback, entries_arg, 1000),
+        WATCHER_ENTRY(&slice, null_arg_callback, NULL),
+    };
+    assert_int_equal(WATCHER_RESULT_OK, watcher_add_entries(&watcher, descriptors, 4));
+    assert_int_equal(4, watcher.entries.num);
+    assert_int_equal(16, watcher.entries.capacity);
+
+    values[1]++;
+    slice[3]++;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(2, cbtest);
+
+    values[2]++;
+    assert_false(watcher_watch(&watcher, 0));
+    assert_true(watcher_watch(&watcher, 1000));
+    assert_int_equal(3, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_static_reserve_test(void **state) {
+    (void)state;
+    int                 value = 0;
+    watcher_entry_t     entries[2];
+    watcher_callback_t  callbacks[1];
+    void               *args[1];
+    unsigned long       delays[1];
+    watcher_debouncer_t debouncers[1];
+
+    watcher_t watcher;
+    watcher_init_static(&watcher, entries, 2, callbacks, 1, args, 1, delays, 1, debouncers, 1, user_pointer);
+
+    assert_int_equal(WATCHER_RESULT_OK, watcher_reserve(&watcher, 2, 1, 1, 1, 1));
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, watcher_reserve(&watcher, 3, 1, 1, 1, 1));
+
+    watcher_entry_descriptor_t descriptors[] = {
+        WATCHER_ENTRY(&value, callback, entries_arg),
+        WATCHER_ENTRY(&value, callback, entries_arg),
+        WATCHER_ENTRY(&value, callback, entries_arg),
+    };
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, watcher_add_entries(&watcher, descriptors, 3));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_add_entries(&watcher, descriptors, 2));
+    assert_int_equal(2, watcher.entries.num);
+}
+
+
+void watcher_dedup_test(void **state) {
+    (void)state;
+    static uint8_t values[200] = {0};
+    size_t         i           = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    for (i = 0; i < 200; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], i % 2 ? callback : null_arg_callback,
+                                      (void *)(uintptr_t)(i % 50)) >= 0);
+    }
+    assert_int_equal(2, watcher.callbacks.num);
+    assert_int_equal(50, watcher.args.num);
+    for (i = 0; i < 200; i++) {
+        watcher_entry_t *entry = &watcher.entries.items[i];
+        assert_ptr_equal((void *)(uintptr_t)(i % 50), watcher.args.items[entry->arg_index]);
+        assert_true(watcher.callbacks.items[entry->callback_index] == (i % 2 ? callback : null_arg_callback));
+    }
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_static_index_test(void **state) {
+    (void)state;
+    cbtest = 0;
+    int                 values[4] = {0};
+    watcher_entry_t     entries[4];
+    watcher_callback_t  callbacks[2];
+    void               *args[2];
+    unsigned long       delays[2];
+    watcher_debouncer_t debouncers[2];
+    watcher_size_t      index[WATCHER_STATIC_INDEX_SIZE(2, 2, 2)];
+
+    watcher_t watcher;
+    watcher_init_static(&watcher, entries, 4, callbacks, 2, args, 2, delays, 2, debouncers, 2, user_pointer);
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, watcher_init_static_index(&watcher, index, 4));
+
+    // Entries registered before the index is provided are indexed as well
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &values[0], callback, entries_arg) >= 0);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_init_static_index(&watcher, index, WATCHER_STATIC_INDEX_SIZE(2, 2, 2)));
+
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &values[1], callback, entries_arg) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &values[2], null_arg_callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &values[3], callback, entries_arg) >= 0);
+    assert_int_equal(2, watcher.callbacks.num);
+    assert_int_equal(2, watcher.args.num);
+
+    values[0]++;
+    values[2]++;
+    values[3]++;
+    assert_int_equal(3, watcher_watch(&watcher, 0));
+    assert_int_equal(3, cbtest);
+}
+
+
+void watcher_shadow_arena_test(void **state) {
+    (void)state;
+    cbtest                       = 0;
+    static uint64_t slices[8][4] = {0};
+    size_t          i            = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    assert_int_equal(WATCHER_RESULT_OK, watcher_reserve_shadow(&watcher, sizeof(slices)));
+    for (i = 0; i < 8; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &slices[i], callback, entries_arg) >= 0);
+    }
+
+    // Every old value buffer comes from the same aligned slab, back to back
+    for (i = 0; i < 8; i++) {
+        uint8_t *old_buffer = watcher.entries.items[i].old_buffer;
+        assert_ptr_equal((uint8_t *)watcher.entries.items[0].old_buffer + i * sizeof(slices[0]), old_buffer);
+        assert_int_equal(0, (uintptr_t)old_buffer % C_WATCHER_SHADOW_ALIGNMENT);
+    }
+
+    slices[3][2]++;
+    slices[7][0]++;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(2, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_static_shadow_test(void **state) {
+    (void)state;
+    cbtest                       = 0;
+    uint64_t            slice[4] = {0};
+    uint64_t            pool[5]  = {0};
+    watcher_entry_t     entries[2];
+    watcher_callback_t  callbacks[1];
+    void               *args[1];
+    unsigned long       delays[1];
+    watcher_debouncer_t debouncers[1];
+
+    watcher_t watcher;
+    watcher_init_static(&watcher, entries, 2, callbacks, 1, args, 1, delays, 1, debouncers, 1, user_pointer);
+
+    // Without a shadow pool a static watcher cannot allocate old value buffers
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, WATCHER_ADD_ENTRY(&watcher, &slice, callback, entries_arg));
+    assert_int_equal(0, watcher.entries.num);
+
+    assert_int_equal(WATCHER_RESULT_OK, watcher_init_static_shadow(&watcher, pool, sizeof(pool)));
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &slice, callback, entries_arg) >= 0);
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, WATCHER_ADD_ENTRY(&watcher, &slice, callback, entries_arg));
+    assert_int_equal(1, watcher.entries.num);
+
+    slice[1]++;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, cbtest);
+}
+
+
+void watcher_memory_info_test(void **state) {
+    (void)state;
+    watcher_t             watcher;
+    watcher_memory_info_t info;
+
+    assert_int_equal(WATCHER_RESULT_OK, WATCHER_INIT_STD(&watcher, user_pointer));
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &var2, callback, entries_arg) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &array, callback, entries_arg) >= 0);
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &var3, callback, entries_arg, 5) >= 0);
+
+    watcher_get_memory_info(&watcher, &info);
+    assert_int_equal(3, info.used.entries);
+    assert_int_equal(1, info.used.callbacks);
+    assert_int_equal(1, info.used.args);
+    assert_int_equal(1, info.used.debouncers);
+    // Only the array does not fit in its entry
+    assert_int_equal(WATCHER_STATIC_SHADOW_SIZE(sizeof(array)), info.used.shadow);
+    assert_int_equal(WATCHER_STATIC_SIZE(info.used.entries, info.used.callbacks, info.used.args, info.used.delays,
+                                         info.used.debouncers, info.used.shadow),
+                     info.used_bytes);
+    assert_true(info.allocated.entries >= 3);
+    assert_true(info.allocated_bytes >= info.used_bytes);
+    watcher_destroy(&watcher);
+
+    // The used footprint is enough to register the same entries on a static watcher
+    watcher_static_config_t config = {
+        .entries             = malloc(info.used.entries * sizeof(watcher_entry_t)),
+        .entries_capacity    = info.used.entries,
+        .callbacks           = malloc(info.used.callbacks * sizeof(watcher_callback_t)),
+        .callbacks_capacity  = info.used.callbacks,
+        .args                = malloc(info.used.args * sizeof(void *)),
+        .args_capacity       = info.used.args,
+        .delays              = malloc(info.used.delays * sizeof(unsigned long)),
+        .delays_capacity     = info.used.delays,
+        .debouncers          = malloc(info.used.debouncers * sizeof(watcher_debouncer_t)),
+        .debouncers_capacity = info.used.debouncers,
+        .index               = info.used.index > 0 ? malloc(info.used.index * sizeof(watcher_size_t)) : NULL,
+        .index_len           = info.used.index,
+        .shadow              = malloc(info.used.shadow),
+        .shadow_size         = info.used.shadow,
+        .user_ptr            = user_pointer,
+    };
+    assert_int_equal(WATCHER_RESULT_OK, watcher_init_static_config(&watcher, &config));
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &var2, callback, entries_arg) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &array, callback, entries_arg) >= 0);
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &var3, callback, entries_arg, 5) >= 0);
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, WATCHER_ADD_ENTRY(&watcher, &var1, callback, entries_arg));
+
+    cbtest = 0;
+    array[9]++;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, cbtest);
+
+    watcher_get_memory_info(&watcher, &info);
+    assert_int_equal(info.used_bytes, info.allocated_bytes);
+
+    watcher_destroy(&watcher);
+    free(config.entries);
+    free(config.callbacks);
+    free(config.args);
+    free(config.delays);
+    free(config.debouncers);
+    free(config.index);
+    free(config.shadow);
+
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_init_static_config(&watcher, NULL));
+}
+
+
+void watcher_many_entries_test(void **state) {
+    (void)state;
+    cbtest                       = 0;
+    static uint8_t values[40000] = {0};
+    size_t         i             = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    for (i = 0; i < 40000; i++) {
+        if (i % 2) {
+            assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], callback, entries_arg) >= 0);
+        } else {
+            assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &values[i], callback, entries_arg, 10) >= 0);
+        }
+    }
+    assert_int_equal(20000, watcher.debouncers.num);
+    assert_int_equal(1, watcher.args.num);
+
+    // Entries past the int16_t range are still dispatched
+    values[39999]++;
+    values[39998]++;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, cbtest);
+    assert_int_equal(1, watcher_watch(&watcher, 10));
+    assert_int_equal(2, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_deadline_test(void **state) {
+    (void)state;
+    cbtest                 = 0;
+    uint8_t       values[] = {0, 0, 0};
+    unsigned long deadline = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &values[0], callback, entries_arg, 3000) >= 0);
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &values[1], callback, entries_arg, 1000) >= 0);
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &values[2], callback, entries_arg, 2000) >= 0);
+    assert_false(watcher_next_deadline(&watcher, &deadline));
+
+    values[0]++;
+    values[1]++;
+    values[2]++;
+    assert_false(watcher_watch(&watcher, 100));
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(1100, deadline);
+
+    assert_int_equal(1, watcher_watch(&watcher, 1100));
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(2100, deadline);
+
+    assert_int_equal(2, watcher_watch(&watcher, 5000));
+    assert_int_equal(3, cbtest);
+    assert_false(watcher_next_deadline(&watcher, &deadline));
+
+    // Triggering a delayed entry makes it due on the next watch, which starts its delay
+    watcher_trigger_entry(&watcher, 1);
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(5000, deadline);
+    assert_false(watcher_watch(&watcher, 6000));
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(7000, deadline);
+    assert_int_equal(1, watcher_watch(&watcher, 7000));
+    assert_int_equal(4, cbtest);
+
+    // Removing an armed debouncer moves the last one, armed as well, in its place
+    values[0]++;
+    values[1]++;
+    values[2]++;
+    assert_false(watcher_watch(&watcher, 8000));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, watcher_get_handle(&watcher, 1)));
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(10000, deadline);
+    assert_int_equal(1, watcher_watch(&watcher, 10000));
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(11000, deadline);
+    assert_int_equal(1, watcher_watch(&watcher, 11000));
+    assert_false(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(6, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_sizes_test(void **state) {
+    (void)state;
+    static uint8_t region[301] = {0};
+    size_t         size        = 0;
+    size_t         i           = 0;
+
+    // Every byte of regions of every size, from the inline compares to the vectorized ones, is checked
+    for (size = 1; size < sizeof(region); size += size < 40 ? 1 : 37) {
+        cbtest = 0;
+        watcher_t watcher;
+        WATCHER_INIT_STD(&watcher, user_pointer);
+        assert_true(watcher_add_entry(&watcher, region, (watcher_size_t)size, callback, entries_arg) >= 0);
+
+        for (i = 0; i < size; i++) {
+            region[i] ^= 0x10;
+            assert_int_equal(1, watcher_watch(&watcher, 0));
+            assert_int_equal(0, watcher_watch(&watcher, 0));
+        }
+        region[size] ^= 0x10;
+        assert_int_equal(0, watcher_watch(&watcher, 0));
+        assert_int_equal(size, cbtest);
+
+        watcher_destroy(&watcher);
+    }
+}
+
+
+static const void *last_old_value = NULL;
+static uint8_t     last_old_copy[256];
+
+static void old_value_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr, void *arg) {
+    (void)new_value;
+    (void)user_ptr;
+    (void)arg;
+    last_old_value = old_value;
+    if (old_value != NULL) {
+        memcpy(last_old_copy, old_value, size < sizeof(last_old_copy) ? size : sizeof(last_old_copy));
+    }
+    cbtest++;
+}
+
+
+void watcher_hashed_test(void **state) {
+    (void)state;
+    cbtest                    = 0;
+    static uint8_t page[4096] = {0};
+    uint32_t       counter    = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    assert_true(WATCHER_ADD_SLICE_ENTRY_HASHED(&watcher, page, sizeof(page), old_value_callback, NULL) >= 0);
+    watcher_entry_descriptor_t descriptor = WATCHER_ENTRY(&counter, old_value_callback, NULL);
+    descriptor.mode                       = WATCHER_ENTRY_MODE_HASH_COPY;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_add_entries(&watcher, &descriptor, 1));
+    if (sizeof(void *) >= sizeof(uint64_t)) {
+        // The hash is stored in place of the old buffer pointer
+        assert_int_equal(0, watcher.shadow.used);
+    }
+
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    page[4095] = 1;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_null(last_old_value);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    page[4095] = 0;
+    page[0]    = 1;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(2, cbtest);
+
+    // Small regions fall back to a plain copy, which still provides the old value
+    counter = 42;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_non_null(last_old_value);
+    assert_int_equal(0, *(const uint32_t *)last_old_copy);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_hash_copy_test(void **state) {
+    (void)state;
+    cbtest                   = 0;
+    static uint8_t data[256] = {0};
+    static uint8_t buffer[sizeof(uint64_t) + sizeof(data)];
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    watcher_entry_descriptor_t descriptor = WATCHER_ENTRY(&data, old_value_callback, NULL);
+    descriptor.mode                       = WATCHER_ENTRY_MODE_HASH_COPY;
+    descriptor.old_buffer                 = buffer;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_add_entries(&watcher, &descriptor, 1));
+
+    data[100] = 7;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_ptr_equal(last_old_value, &buffer[sizeof(uint64_t)]);
+    assert_int_equal(0, last_old_copy[100]);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    assert_int_equal(7, buffer[sizeof(uint64_t) + 100]);
+
+    data[100] = 8;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(7, last_old_copy[100]);
+    assert_int_equal(2, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_dirty_test(void **state) {
+    (void)state;
+    cbtest               = 0;
+    uint32_t values[100] = {0};
+    size_t   i           = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    for (i = 0; i < 50; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], callback, entries_arg) >= 0);
+    }
+
+    // Changes made before tracking is enabled are still found
+    values[3]++;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_dirty_tracking(&watcher, 1));
+    for (i = 50; i < 100; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], callback, entries_arg) >= 0);
+    }
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &values[99], callback, entries_arg, 10) >= 0);
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, cbtest);
+
+    // Unmarked changes go unnoticed
+    values[10]++;
+    values[70]++;
+    values[99]++;
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    watcher_mark_dirty(&watcher, 10);
+    assert_true(watcher_mark_dirty_ptr(&watcher, &values[70]));
+    assert_false(watcher_mark_dirty_ptr(&watcher, &i));
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(3, cbtest);
+
+    // Marking a pointer marks every entry watching it, delayed ones included
+    assert_true(watcher_mark_dirty_ptr(&watcher, &values[99]));
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, watcher_watch(&watcher, 10));
+    assert_int_equal(5, cbtest);
+
+    // Clean marked entries are compared but not triggered
+    watcher_mark_dirty(&watcher, 20);
+    watcher_mark_dirty(&watcher, 1000);
+    assert_int_equal(0, watcher_watch(&watcher, 10));
+
+    // Back to polling
+    values[40]++;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_dirty_tracking(&watcher, 0));
+    assert_int_equal(1, watcher_watch(&watcher, 10));
+    assert_int_equal(6, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+void watcher_static_dirty_test(void **state) {
+    (void)state;
+    cbtest = 0;
+    int                 values[40] = {0};
+    watcher_entry_t     entries[40];
+    watcher_callback_t  callbacks[1];
+    void               *args[1];
+    unsigned long       delays[1];
+    watcher_debouncer_t debouncers[1];
+    uint32_t            bitmap[WATCHER_DIRTY_BITMAP_WORDS(40)];
+    size_t              i = 0;
+
+    watcher_t watcher;
+    watcher_init_static(&watcher, entries, 40, callbacks, 1, args, 1, delays, 1, debouncers, 1, user_pointer);
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW, watcher_init_static_dirty(&watcher, bitmap, 1));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_init_static_dirty(&watcher, bitmap, WATCHER_DIRTY_BITMAP_WORDS(40)));
+
+    for (i = 0; i < 40; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], callback, entries_arg) >= 0);
+    }
+
+    values[0]++;
+    values[39]++;
+    watcher_mark_dirty(&watcher, 39);
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_true(watcher_mark_dirty_ptr(&watcher, &values[0]));
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(2, cbtest);
+}
+
+
+void watcher_soft_dirty_test(void **state) {
+    (void)state;
+    cbtest                          = 0;
+    static uint8_t large[3 * 16384] = {0};
+    uint32_t       small            = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    assert_true(watcher_add_entry(&watcher, large, 2 * 16384 + 100, old_value_callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &small, old_value_callback, NULL) >= 0);
+
+    // The backend is optional: where the kernel does not support it the watcher keeps polling
+    watcher_result_t result = watcher_set_backend(&watcher, WATCHER_BACKEND_SOFT_DIRTY);
+    assert_true(result == WATCHER_RESULT_OK || result == WATCHER_RESULT_INVALID_ARGS);
+    assert_int_equal(result == WATCHER_RESULT_OK ? WATCHER_BACKEND_SOFT_DIRTY : WATCHER_BACKEND_POLL, watcher.backend);
+
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    large[20000] = 1;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    // Only the written pages are copied, the rest of the old value stays valid
+    large[0]              = 2;
+    large[2 * 16384 + 99] = 3;
+    small                 = 4;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    large[0] = 5;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(2, last_old_copy[0]);
+    assert_int_equal(4, cbtest);
+
+    // The backend has one owner per process, until it goes back to polling or is destroyed
+    watcher_t other;
+    WATCHER_INIT_STD(&other, user_pointer);
+    if (result == WATCHER_RESULT_OK) {
+        assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_set_backend(&other, WATCHER_BACKEND_SOFT_DIRTY));
+    }
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_backend(&watcher, WATCHER_BACKEND_POLL));
+    assert_int_equal(result, watcher_set_backend(&other, WATCHER_BACKEND_SOFT_DIRTY));
+    watcher_destroy(&other);
+    assert_int_equal(result, watcher_set_backend(&watcher, WATCHER_BACKEND_SOFT_DIRTY));
+    watcher_destroy(&watcher);
+
+    // Static watchers have nowhere to keep the written pages
+    watcher_entry_t     entries[1];
+    watcher_callback_t  callbacks[1];
+    void               *args[1];
+    unsigned long       delays[1];
+    watcher_debouncer_t debouncers[1];
+    watcher_init_static(&watcher, entries, 1, callbacks, 1, args, 1, delays, 1, debouncers, 1, user_pointer);
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_set_backend(&watcher, WATCHER_BACKEND_SOFT_DIRTY));
+}
+
+
+static size_t  last_index  = 0;
+static uint8_t check_order = 1;
+
+static void ordered_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr, void *arg) {
+    (void)old_value;
+    (void)new_value;
+    (void)size;
+    (void)user_ptr;
+    // Immediate callbacks are dispatched in entry order
+    assert_true(!check_order || (size_t)arg >= last_index);
+    last_index = (size_t)arg;
+    cbtest++;
+}
+
+
+static size_t serial_runs = 0;
+
+static void serial_pool_run(void *pool, watcher_task_t task, void *context, size_t tasks) {
+    size_t i = 0;
+    (void)pool;
+    for (i = 0; i < tasks; i++) {
+        task(context, i);
+    }
+    serial_runs++;
+}
+
+
+void watcher_parallel_test(void **state) {
+    (void)state;
+    static uint16_t values[10000] = {0};
+    size_t          i             = 0;
+    size_t          p             = 0;
+
+    watcher_pool_t pools[2] = {{.run = serial_pool_run, .pool = NULL, .workers = 3}};
+    assert_int_equal(WATCHER_RESULT_OK, watcher_pool_init_pthread(&pools[1], 4));
+
+    for (p = 0; p < 2; p++) {
+        cbtest = 0;
+        watcher_t watcher;
+        WATCHER_INIT_STD(&watcher, user_pointer);
+
+        for (i = 0; i < 10000; i++) {
+            if (i % 100 == 0) {
+                assert_true(watcher_add_entry_delayed(&watcher, &values[i], sizeof(values[i]), ordered_callback,
+                                                      (void *)i, 10) >= 0);
+            } else {
+                assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], ordered_callback, i) >= 0);
+            }
+        }
+
+        last_index = 0;
+        assert_int_equal(0, watcher_watch_parallel(&watcher, 0, &pools[p]));
+        for (i = 0; i < 10000; i += 7) {
+            values[i]++;
+        }
+        last_index = 0;
+        assert_int_equal(1429 - 15, watcher_watch_parallel(&watcher, 0, &pools[p]));
+        assert_int_equal(0, watcher_watch_parallel(&watcher, 5, &pools[p]));
+        // Delayed callbacks are dispatched in deadline order
+        check_order = 0;
+        assert_int_equal(15, watcher_watch_parallel(&watcher, 10, &pools[p]));
+        assert_int_equal(1429, cbtest);
+        check_order = 1;
+
+        // A change left in place by a full queue does not outlive the removal of its entry
+        watcher_handle_t tail[100];
+        for (i = 0; i < 100; i++) {
+            tail[i] = watcher_get_handle(&watcher, (watcher_size_t)(9900 + i));
+        }
+        assert_int_equal(WATCHER_RESULT_OK, watcher_set_event_queue(&watcher, 1, 0));
+        values[10]++;
+        values[9990]++;
+        last_index = 0;
+        assert_int_equal(1, watcher_watch_parallel(&watcher, 20, &pools[p]));
+        for (i = 0; i < 100; i++) {
+            assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, tail[i]));
+        }
+        assert_int_equal(9900, watcher.entries.num);
+        assert_int_equal(1, watcher_drain_events(&watcher, 1));
+        last_index = 0;
+        assert_int_equal(0, watcher_watch_parallel(&watcher, 30, &pools[p]));
+        assert_int_equal(0, watcher_drain_events(&watcher, 1));
+        assert_int_equal(1430, cbtest);
+
+        // Small watchers are compared on the calling thread
+        watcher_destroy(&watcher);
+        WATCHER_INIT_STD(&watcher, user_pointer);
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[0], ordered_callback, 0) >= 0);
+        values[0]++;
+        last_index = 0;
+        assert_int_equal(1, watcher_watch_parallel(&watcher, 0, &pools[p]));
+        watcher_destroy(&watcher);
+    }
+
+    assert_int_equal(6, serial_runs);
+    watcher_pool_destroy_pthread(&pools[1]);
+}
+
+
+void watcher_event_queue_test(void **state) {
+    (void)state;
+    cbtest                    = 0;
+    uint32_t       values[3]  = {0};
+    static uint8_t page[4096] = {0};
+    uint32_t       old_value  = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_event_queue(&watcher, 2, sizeof(uint32_t)));
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &values[0], old_value_callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &values[1], old_value_callback, NULL) >= 0);
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &values[2], old_value_callback, NULL, 10) >= 0);
+    assert_true(WATCHER_ADD_SLICE_ENTRY(&watcher, page, sizeof(page), old_value_callback, NULL) >= 0);
+
+    // Changes are only queued, and the page is left for later as the queue is full
+    values[0] = 1;
+    values[1] = 1;
+    page[0]   = 1;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(0, cbtest);
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_set_event_queue(&watcher, 0, 0));
+
+    assert_int_equal(1, watcher_drain_events(&watcher, 1));
+    assert_int_equal(1, cbtest);
+    memcpy(&old_value, last_old_copy, sizeof(old_value));
+    assert_int_equal(0, old_value);
+
+    // The old value of entries larger than a slot is not kept
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(2, watcher_drain_events(&watcher, 8));
+    assert_int_equal(3, cbtest);
+    assert_null(last_old_value);
+    assert_int_equal(0, watcher_drain_events(&watcher, 8));
+
+    // An expired delayed entry waits for room in the queue
+    values[2] = 1;
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    values[0] = 2;
+    values[1] = 2;
+    assert_int_equal(2, watcher_watch(&watcher, 10));
+    assert_int_equal(0, watcher_watch(&watcher, 10));
+    assert_int_equal(2, watcher_drain_events(&watcher, 8));
+    assert_int_equal(1, watcher_watch(&watcher, 11));
+    assert_int_equal(1, watcher_drain_events(&watcher, 8));
+    assert_int_equal(6, cbtest);
+    memcpy(&old_value, last_old_copy, sizeof(old_value));
+    assert_int_equal(0, old_value);
+
+    // Without a queue callbacks are invoked inline again
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_event_queue(&watcher, 0, 0));
+    values[0] = 3;
+    assert_int_equal(1, watcher_watch(&watcher, 11));
+    assert_int_equal(7, cbtest);
+    assert_int_equal(0, watcher_drain_events(&watcher, 8));
+
+    watcher_destroy(&watcher);
+}
+
+
+static int batch_calls[2] = {0};
+
+static void batch_callback(watcher_change_t *changes, uint16_t num, void *user_ptr) {
+    uint16_t i = 0;
+    assert_ptr_equal(user_pointer, user_ptr);
+    for (i = 0; i < num; i++) {
+        // Every test change increments the value by one
+        assert_int_equal(sizeof(uint32_t), changes[i].size);
+        assert_int_equal(*(const uint32_t *)changes[i].new_value, *(uint32_t *)changes[i].old_value + 1);
+        assert_ptr_equal(entries_arg, changes[i].arg);
+    }
+    batch_calls[0]++;
+    cbtest += num;
+}
+
+
+static void other_batch_callback(watcher_change_t *changes, uint16_t num, void *user_ptr) {
+    batch_callback(changes, num, user_ptr);
+    batch_calls[0]--;
+    batch_calls[1]++;
+}
+
+
+void watcher_batched_test(void **state) {
+    (void)state;
+    cbtest             = 0;
+    uint32_t values[6] = {0};
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    assert_int_equal(0, WATCHER_ADD_ENTRY_BATCHED(&watcher, &values[0], batch_callback, entries_arg));
+    assert_int_equal(1, WATCHER_ADD_ENTRY_BATCHED(&watcher, &values[1], batch_callback, entries_arg));
+    assert_int_equal(2, WATCHER_ADD_ENTRY_BATCHED(&watcher, &values[2], other_batch_callback, entries_arg));
+    assert_int_equal(3, WATCHER_ADD_ENTRY(&watcher, &values[3], callback, entries_arg));
+    assert_int_equal(4, WATCHER_ADD_ENTRY_BATCHED(&watcher, &values[4], batch_callback, entries_arg));
+    watcher_entry_descriptor_t descriptor = WATCHER_ENTRY_DELAYED(&values[5], NULL, entries_arg, 10);
+    descriptor.batch_callback             = batch_callback;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_add_entries(&watcher, &descriptor, 1));
+
+    // One call per batched callback
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    values[0]++;
+    values[2]++;
+    values[3]++;
+    values[4]++;
+    assert_int_equal(4, watcher_watch(&watcher, 0));
+    assert_int_equal(4, cbtest);
+    assert_int_equal(1, batch_calls[0]);
+    assert_int_equal(1, batch_calls[1]);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    // Expired delayed entries join the batch of the call
+    values[5]++;
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    values[1]++;
+    assert_int_equal(2, watcher_watch(&watcher, 10));
+    assert_int_equal(6, cbtest);
+    assert_int_equal(2, batch_calls[0]);
+
+    // Manual triggers are not batched
+    values[0]++;
+    watcher_trigger_entry(&watcher, 0);
+    assert_int_equal(7, cbtest);
+    assert_int_equal(3, batch_calls[0]);
+
+    // Queued events of the same batched callback are drained together
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_event_queue(&watcher, 8, sizeof(uint32_t)));
+    values[0]++;
+    values[1]++;
+    values[2]++;
+    assert_int_equal(3, watcher_watch(&watcher, 10));
+    assert_int_equal(3, watcher_drain_events(&watcher, 8));
+    assert_int_equal(10, cbtest);
+    assert_int_equal(4, batch_calls[0]);
+    assert_int_equal(2, batch_calls[1]);
+
+    watcher_destroy(&watcher);
+
+    // Static watchers need memory for the changes
+    watcher_entry_t    entries[2];
+    watcher_callback_t callbacks[2];
+    void              *args[2];
+    watcher_change_t   changes[1];
+    watcher_init_static(&watcher, entries, 2, callbacks, 2, args, 2, NULL, 0, NULL, 0, user_pointer);
+    assert_int_equal(WATCHER_RESULT_STATIC_OVERFLOW,
+                     watcher_add_entry_batched(&watcher, &values[0], sizeof(values[0]), batch_callback, entries_arg));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_init_static_changes(&watcher, changes, 1));
+    assert_int_equal(0,
+                     watcher_add_entry_batched(&watcher, &values[0], sizeof(values[0]), batch_callback, entries_arg));
+    values[0]++;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(11, cbtest);
+}
+
+
+static unsigned long fake_clock_reads = 0;
+
+static unsigned long fake_clock(void *arg) {
+    assert_ptr_equal(entries_arg, arg);
+    return fake_clock_reads++;
+}
+
+
+void watcher_budget_test(void **state) {
+    (void)state;
+    cbtest = 0;
+    static uint32_t  values[100] = {0};
+    watcher_budget_t budget      = {.entries = 30, .clock = NULL};
+    uint8_t          swept       = 0;
+    size_t           i           = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    for (i = 0; i < 100; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], callback, entries_arg) >= 0);
+    }
+
+    // The sweep is spread over four calls
+    values[10]++;
+    values[90]++;
+    assert_int_equal(1, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_false(swept);
+    assert_int_equal(0, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_false(swept);
+    assert_int_equal(0, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_false(swept);
+    assert_int_equal(1, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_true(swept);
+    assert_int_equal(2, cbtest);
+
+    // The clock is read every few entries
+    budget.entries   = 0;
+    budget.clock     = fake_clock;
+    budget.clock_arg = entries_arg;
+    budget.deadline  = 2;
+    fake_clock_reads = 0;
+    values[99]++;
+    assert_int_equal(0, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_false(swept);
+    assert_int_equal(3, fake_clock_reads);
+    budget.deadline = 100;
+    assert_int_equal(1, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_true(swept);
+    assert_int_equal(3, cbtest);
+
+    // With dirty tracking only marked entries count
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_dirty_tracking(&watcher, 1));
+    budget.clock   = NULL;
+    budget.entries = 50;
+    assert_int_equal(0, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_false(swept);
+    assert_int_equal(0, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_true(swept);
+    budget.entries = 1;
+    values[5]++;
+    values[70]++;
+    watcher_mark_dirty(&watcher, 5);
+    watcher_mark_dirty(&watcher, 70);
+    assert_int_equal(1, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_false(swept);
+    assert_int_equal(1, watcher_watch_budget(&watcher, 0, &budget, &swept));
+    assert_true(swept);
+    assert_int_equal(5, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+static uint32_t registered_values[64] = {0};
+static size_t   registered            = 0;
+
+static void registering_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr, void *arg) {
+    watcher_t *watcher = arg;
+    (void)old_value;
+    (void)new_value;
+    (void)size;
+    (void)user_ptr;
+
+    // Registers an entry and writes to one that was already compared
+    assert_true(WATCHER_ADD_ENTRY(watcher, &registered_values[registered + 1], callback, entries_arg) >= 0);
+    registered++;
+    registered_values[0]++;
+    cbtest++;
+}
+
+
+void watcher_register_from_callback_test(void **state) {
+    (void)state;
+    cbtest              = 0;
+    registered          = 0;
+    uint32_t values[32] = {0};
+    size_t   i          = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &registered_values[63], callback, entries_arg) >= 0);
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &registered_values[0], callback, entries_arg) >= 0);
+    for (i = 0; i < 32; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], registering_callback, &watcher) >= 0);
+    }
+
+    // The scan goes on after each registration instead of starting over, so the writes to the entry already compared
+    // are reported once, by the next call
+    for (i = 0; i < 32; i++) {
+        values[i]++;
+    }
+    assert_int_equal(32, watcher_watch(&watcher, 0));
+    assert_int_equal(32, cbtest);
+    assert_int_equal(32, registered);
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(33, cbtest);
+
+    // Entries registered by callbacks are watched right away
+    registered_values[1]++;
+    registered_values[63]++;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(35, cbtest);
+
+    watcher_destroy(&watcher);
+}
+
+
+static watcher_t       *removing_watcher = NULL;
+static watcher_handle_t removed_handle   = WATCHER_INVALID_HANDLE;
+
+static void removing_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr, void *arg) {
+    (void)old_value;
+    (void)new_value;
+    (void)size;
+    (void)user_ptr;
+    (void)arg;
+
+    // Removes an entry the scan did not reach yet
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(removing_watcher, removed_handle));
+    cbtest++;
+}
+
+
+void watcher_handles_test(void **state) {
+    (void)state;
+    cbtest = 0;
+
+    uint32_t       remover    = 0;
+    uint32_t       values[8]  = {0};
+    uint32_t       delayed    = 0;
+    uint64_t       large[4]   = {0};
+    uint8_t        unused[16] = {0};
+    unsigned long  deadline   = 0;
+    watcher_size_t index      = 0;
+    size_t         i          = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    removing_watcher = &watcher;
+
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &remover, removing_callback, NULL) >= 0);
+    for (i = 0; i < 8; i++) {
+        assert_true(WATCHER_ADD_ENTRY(&watcher, &values[i], callback, entries_arg) >= 0);
+    }
+    assert_true(WATCHER_ADD_ENTRY_DELAYED(&watcher, &delayed, callback, entries_arg, 10) >= 0);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_dirty_tracking(&watcher, 1));
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    watcher_handle_t handles[8];
+    for (i = 0; i < 8; i++) {
+        handles[i] = watcher_get_handle(&watcher, (watcher_size_t)(i + 1));
+        assert_int_not_equal(WATCHER_INVALID_HANDLE, handles[i]);
+    }
+    watcher_handle_t delayed_handle = watcher_get_handle(&watcher, 9);
+    assert_int_equal(WATCHER_INVALID_HANDLE, watcher_get_handle(&watcher, 10));
+
+    // The last entry takes the place of the removed one and the handle becomes invalid
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, handles[2]));
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_remove_entry(&watcher, handles[2]));
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_get_entry_index(&watcher, handles[2], &index));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_index(&watcher, delayed_handle, &index));
+    assert_int_equal(3, index);
+    assert_int_equal(9, watcher.entries.num);
+
+    values[2]++;
+    delayed++;
+    assert_false(watcher_mark_dirty_ptr(&watcher, &values[2]));
+    assert_true(watcher_mark_dirty_ptr(&watcher, &delayed));
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+    assert_int_equal(1, watcher_watch(&watcher, 10));
+    assert_int_equal(1, cbtest);
+
+    // An armed debouncer goes away with its entry
+    delayed++;
+    assert_true(watcher_mark_dirty_ptr(&watcher, &delayed));
+    assert_int_equal(0, watcher_watch(&watcher, 20));
+    assert_true(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, delayed_handle));
+    assert_false(watcher_next_deadline(&watcher, &deadline));
+    assert_int_equal(0, watcher.debouncers.num);
+    assert_int_equal(0, watcher_watch(&watcher, 30));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_index(&watcher, handles[7], &index));
+    assert_int_equal(3, index);
+
+    // An entry removed by a callback is silent but stays in place until watcher_watch returns
+    cbtest         = 0;
+    removed_handle = handles[5];
+    remover++;
+    values[5]++;
+    values[6]++;
+    assert_true(watcher_mark_dirty_ptr(&watcher, &remover));
+    assert_true(watcher_mark_dirty_ptr(&watcher, &values[5]));
+    assert_true(watcher_mark_dirty_ptr(&watcher, &values[6]));
+    assert_int_equal(2, watcher_watch(&watcher, 40));
+    assert_int_equal(2, cbtest);
+    assert_int_equal(7, watcher.entries.num);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_index(&watcher, handles[6], &index));
+    assert_ptr_equal(&values[6], watcher.entries.items[index].watched);
+    assert_false(watcher_mark_dirty_ptr(&watcher, &values[5]));
+
+    // The slot is reused with a new generation
+    int reused = WATCHER_ADD_ENTRY(&watcher, &values[5], callback, entries_arg);
+    assert_true(reused >= 0);
+    watcher_handle_t handle = watcher_get_handle(&watcher, (watcher_size_t)reused);
+    assert_int_equal(handles[5] & 0xFFFF, handle & 0xFFFF);
+    assert_int_not_equal(handles[5], handle);
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_get_entry_index(&watcher, handles[5], &index));
+
+    // Compaction drops the callbacks, args and delays no entry uses anymore
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &large, callback, entries_arg) >= 0);
+    int unused_index = WATCHER_ADD_ENTRY(&watcher, &unused, null_arg_callback, NULL);
+    assert_true(unused_index >= 0);
+    assert_int_equal(WATCHER_RESULT_OK,
+                     watcher_remove_entry(&watcher, watcher_get_handle(&watcher, (watcher_size_t)unused_index)));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, watcher_get_handle(&watcher, 0)));
+    assert_int_equal(3, watcher.callbacks.num);
+    assert_int_equal(1, watcher.delays.num);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_compact(&watcher));
+    assert_int_equal(1, watcher.callbacks.num);
+    assert_int_equal(1, watcher.args.num);
+    assert_int_equal(0, watcher.delays.num);
+    assert_int_equal(watcher.entries.num, watcher.entries.capacity);
+
+    // Old values survive the repacking
+    cbtest = 0;
+    large[1]++;
+    values[0]++;
+    unused[0]++;
+    assert_true(watcher_mark_dirty_ptr(&watcher, &large));
+    assert_true(watcher_mark_dirty_ptr(&watcher, &values[0]));
+    assert_false(watcher_mark_dirty_ptr(&watcher, &unused));
+    assert_int_equal(2, watcher_watch(&watcher, 50));
+    assert_int_equal(2, cbtest);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_dirty_tracking(&watcher, 0));
+    assert_int_equal(0, watcher_watch(&watcher, 60));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_index(&watcher, handle, &index));
+    assert_ptr_equal(&values[5], watcher.entries.items[index].watched);
+
+    watcher_destroy(&watcher);
+}
+
+
+static uint32_t late_value = 0;
+
+static void late_registering_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr,
+                                      void *arg) {
+    (void)old_value;
+    (void)new_value;
+    (void)size;
+    (void)user_ptr;
+
+    assert_true(WATCHER_ADD_ENTRY((watcher_t *)arg, &late_value, callback, entries_arg) >= 0);
+}
+
+
+static void assert_tiers_dense(const watcher_t *watcher) {
+    watcher_size_t i = 0;
+    for (i = 0; i < watcher->entries.num; i++) {
+        size_t t = watcher->entries.items[i].tier;
+        assert_true(i < watcher->tiers[t].end);
+        assert_true(t == 0 || i >= watcher->tiers[t - 1].end);
+    }
+    assert_int_equal(watcher->entries.num, watcher->tiers[C_WATCHER_TIERS - 1].end);
+}
+
+
+void watcher_tiers_test(void **state) {
+    (void)state;
+    cbtest = 0;
+
+    uint32_t       hot[4]  = {0};
+    uint32_t       warm[4] = {0};
+    uint32_t       cold[4] = {0};
+    uint32_t       trigger = 0;
+    watcher_size_t index   = 0;
+    size_t         i       = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_tier(&watcher, 1, 3, 0));
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_tier(&watcher, 2, 0, 100));
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_set_tier(&watcher, 0, 2, 0));
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_set_tier(&watcher, 1, 0, 0));
+
+    watcher_entry_descriptor_t descriptor = WATCHER_ENTRY(&hot[0], callback, entries_arg);
+    descriptor.tier                       = C_WATCHER_TIERS;
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_add_entries(&watcher, &descriptor, 1));
+
+    // Registered slowest first, so that most registrations move entries of the slower tiers
+    watcher_handle_t cold_handles[4];
+    for (i = 0; i < 4; i++) {
+        int cold_index = WATCHER_ADD_ENTRY_TIERED(&watcher, &cold[i], callback, entries_arg, 2);
+        assert_true(cold_index >= 0);
+        cold_handles[i] = watcher_get_handle(&watcher, (watcher_size_t)cold_index);
+    }
+    for (i = 0; i < 4; i++) {
+        assert_true(WATCHER_ADD_ENTRY_TIERED(&watcher, &warm[i], callback, entries_arg, 1) >= 0);
+    }
+    for (i = 0; i < 4; i++) {
+        int hot_index = WATCHER_ADD_ENTRY(&watcher, &hot[i], callback, entries_arg);
+        assert_true(hot_index >= 0 && hot_index < 4);
+    }
+    assert_tiers_dense(&watcher);
+    assert_int_equal(4, watcher.tiers[0].end);
+    assert_int_equal(8, watcher.tiers[1].end);
+    for (i = 0; i < 4; i++) {
+        assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_index(&watcher, cold_handles[i], &index));
+        assert_ptr_equal(&cold[i], watcher.entries.items[index].watched);
+    }
+
+    // Tier 1 is compared every third call, tier 2 every 100 timestamp units
+    for (i = 0; i < 4; i++) {
+        hot[i]++;
+        warm[i]++;
+        cold[i]++;
+    }
+    assert_int_equal(4, watcher_watch(&watcher, 10));
+    assert_int_equal(0, watcher_watch(&watcher, 20));
+    assert_int_equal(4, watcher_watch(&watcher, 30));
+    assert_int_equal(0, watcher_watch(&watcher, 99));
+    assert_int_equal(4, watcher_watch(&watcher, 100));
+    assert_int_equal(12, cbtest);
+
+    // Removal keeps the tiers dense
+    assert_int_equal(WATCHER_RESULT_OK, watcher_remove_entry(&watcher, watcher_get_handle(&watcher, 5)));
+    assert_tiers_dense(&watcher);
+    assert_int_equal(7, watcher.tiers[1].end);
+
+    // An entry registered by a callback is placed in its tier once watcher_watch returns
+    assert_true(WATCHER_ADD_ENTRY(&watcher, &trigger, late_registering_callback, &watcher) >= 0);
+    trigger++;
+    assert_int_equal(1, watcher_watch(&watcher, 110));
+    assert_tiers_dense(&watcher);
+    assert_int_equal(6, watcher.tiers[0].end);
+    late_value++;
+    assert_int_equal(1, watcher_watch(&watcher, 120));
+    for (i = 0; i < 4; i++) {
+        assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_index(&watcher, cold_handles[i], &index));
+        assert_ptr_equal(&cold[i], watcher.entries.items[index].watched);
+    }
+
+    watcher_destroy(&watcher);
+}
+
+
+static watcher_span_t diff_spans_seen[C_WATCHER_MAX_DIFF_SPANS];
+static watcher_size_t diff_spans_num = 0;
+static uint32_t      *diff_write     = NULL;
+
+static void diff_callback(const watcher_span_t *spans, watcher_size_t num, void *old_value, const void *new_value,
+                          watcher_size_t size, void *user_ptr, void *arg) {
+    (void)size;
+    assert_ptr_equal(arg, entries_arg);
+    assert_ptr_equal(user_pointer, user_ptr);
+
+    // Old and new values are still whole
+    watcher_size_t i = 0;
+    for (i = 0; i < num; i++) {
+        assert_true(memcmp((uint8_t *)old_value + spans[i].offset, (const uint8_t *)new_value + spans[i].offset,
+                           spans[i].length) != 0);
+    }
+    memcpy(diff_spans_seen, spans, num * sizeof(watcher_span_t));
+    diff_spans_num = num;
+
+    if (diff_write != NULL) {
+        (*diff_write)++;
+        diff_write = NULL;
+    }
+    cbtest++;
+}
+
+
+void watcher_diff_test(void **state) {
+    (void)state;
+    cbtest = 0;
+
+    static uint32_t data[1024] = {0};
+    struct {
+        uint16_t a;
+        uint16_t b;
+    } pairs[8] = {0};
+    size_t i   = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+    assert_true(WATCHER_ADD_SLICE_ENTRY_DIFF(&watcher, data, 1024, diff_callback, entries_arg) >= 0);
+    assert_true(watcher_add_entry_diff(&watcher, pairs, sizeof(pairs), sizeof(pairs[0]), diff_callback,
+                                       entries_arg) >= 0);
+
+    watcher_entry_descriptor_t descriptor = WATCHER_ENTRY(&data[0], NULL, entries_arg);
+    descriptor.diff_callback              = diff_callback;
+    descriptor.mode                       = WATCHER_ENTRY_MODE_HASH;
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_add_entries(&watcher, &descriptor, 1));
+
+    // Adjacent elements are merged
+    data[3]++;
+    data[4]++;
+    data[900]++;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(2, diff_spans_num);
+    assert_int_equal(3 * sizeof(uint32_t), diff_spans_seen[0].offset);
+    assert_int_equal(2 * sizeof(uint32_t), diff_spans_seen[0].length);
+    assert_int_equal(900 * sizeof(uint32_t), diff_spans_seen[1].offset);
+    assert_int_equal(sizeof(uint32_t), diff_spans_seen[1].length);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    // Spans are whole elements
+    pairs[5].b = 1;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, diff_spans_num);
+    assert_int_equal(5 * sizeof(pairs[0]), diff_spans_seen[0].offset);
+    assert_int_equal(sizeof(pairs[0]), diff_spans_seen[0].length);
+
+    // Only the spans are copied, so a write outside of them made by the callback is reported next time
+    data[10]++;
+    diff_write = &data[500];
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, diff_spans_num);
+    assert_int_equal(500 * sizeof(uint32_t), diff_spans_seen[0].offset);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    // The last span stretches over the changes that do not fit
+    for (i = 0; i < 2 * C_WATCHER_MAX_DIFF_SPANS; i++) {
+        data[2 * i]++;
+    }
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(C_WATCHER_MAX_DIFF_SPANS, diff_spans_num);
+    assert_int_equal(2 * (C_WATCHER_MAX_DIFF_SPANS - 1) * sizeof(uint32_t),
+                     diff_spans_seen[C_WATCHER_MAX_DIFF_SPANS - 1].offset);
+    assert_int_equal((4 * C_WATCHER_MAX_DIFF_SPANS - 1) * sizeof(uint32_t) -
+                         diff_spans_seen[C_WATCHER_MAX_DIFF_SPANS - 1].offset,
+                     diff_spans_seen[C_WATCHER_MAX_DIFF_SPANS - 1].length);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    // Queued changes are diffed against the copy in their slot
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_event_queue(&watcher, 4, sizeof(pairs)));
+    pairs[1].a = 1;
+    pairs[7].a = 1;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, watcher_drain_events(&watcher, 4));
+    assert_int_equal(2, diff_spans_num);
+    assert_int_equal(sizeof(pairs[0]), diff_spans_seen[0].offset);
+    assert_int_equal(7 * sizeof(pairs[0]), diff_spans_seen[1].offset);
+
+    watcher_destroy(&watcher);
+}
+
+
+typedef struct {
+    uint8_t  flag;
+    uint32_t counter;
+    uint16_t samples[32];
+    uint32_t tail;
+    char     name[8];
+} model_t;
+
+static unsigned fields_seen = 0;
+
+static void field_callback(void *old_value, const void *new_value, watcher_size_t size, void *user_ptr, void *arg) {
+    assert_ptr_equal(user_pointer, user_ptr);
+    // No old value when drained from a small event slot
+    assert_true(old_value == NULL || memcmp(old_value, new_value, size) != 0);
+    fields_seen |= 1U << (uintptr_t)arg;
+    cbtest++;
+}
+
+
+void watcher_struct_test(void **state) {
+    (void)state;
+    cbtest = 0;
+
+    static model_t               model    = {0};
+    static const watcher_field_t fields[] = {
+        WATCHER_FIELD(model_t, flag, field_callback, 0),    WATCHER_FIELD(model_t, counter, field_callback, 1),
+        WATCHER_FIELD(model_t, samples, field_callback, 2), WATCHER_FIELD(model_t, tail, field_callback, 3),
+        WATCHER_FIELD(model_t, name, field_callback, 4),
+    };
+    static const watcher_field_t       reversed_fields[] = {fields[1], fields[0]};
+    static const watcher_field_table_t table             = {.fields = fields, .num = 5};
+    static const watcher_field_table_t counter           = {.fields = &fields[1], .num = 1};
+    static const watcher_field_table_t reversed          = {.fields = reversed_fields, .num = 2};
+    size_t                             i                 = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    // Fields out of order or past the end of the struct are refused
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, WATCHER_ADD_STRUCT(&watcher, &model, &reversed));
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS,
+                     watcher_add_struct(&watcher, &model, offsetof(model_t, name), &table));
+    assert_true(watcher_add_struct(&watcher, &model, sizeof(model), &counter) >= 0);
+    assert_true(WATCHER_ADD_STRUCT(&watcher, &model, &table) >= 0);
+
+    // Only the changed fields are reported, the counter by both entries
+    model.counter = 5;
+    model.name[7] = 'x';
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(3, cbtest);
+    assert_int_equal((1U << 1) | (1U << 4), fields_seen);
+    assert_int_equal(0, watcher_watch(&watcher, 0));
+
+    // Padding belongs to no field
+    cbtest      = 0;
+    fields_seen = 0;
+    ((uint8_t *)&model)[offsetof(model_t, flag) + 1] = 1;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(0, cbtest);
+
+    // The last span stretches over the unchanged tail, which is compared on its own
+    for (i = 0; i < 32; i += 2) {
+        model.samples[i]++;
+    }
+    model.name[0] = 'y';
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(2, cbtest);
+    assert_int_equal((1U << 2) | (1U << 4), fields_seen);
+
+    // Without an old value in the slot every field is reported
+    cbtest      = 0;
+    fields_seen = 0;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_set_event_queue(&watcher, 8, 0));
+    model.counter++;
+    assert_int_equal(2, watcher_watch(&watcher, 0));
+    assert_int_equal(0, cbtest);
+    assert_int_equal(2, watcher_drain_events(&watcher, 8));
+    assert_int_equal(6, cbtest);
+    assert_int_equal(0x1F, fields_seen);
+
+    watcher_destroy(&watcher);
+}
+
+
+#ifdef C_WATCHER_CONCURRENT
+static struct {
+    watcher_seqlock_t seqlock;
+    uint8_t           bytes[64];
+    atomic_uchar      stop;
+} shared;
+
+static watcher_staged_entry_t staged[4];
+static uint32_t               staged_values[4];
+
+
+static void consistent_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr, void *arg) {
+    const uint8_t *old_bytes = old_value;
+    const uint8_t *new_bytes = new_value;
+    uint16_t       i         = 0;
+    (void)user_ptr;
+    (void)arg;
+
+    // Every write sets all the bytes to the same value, so a torn read would show two different values
+    for (i = 1; i < size; i++) {
+        assert_int_equal(old_bytes[0], old_bytes[i]);
+        assert_int_equal(new_bytes[0], new_bytes[i]);
+    }
+    cbtest++;
+}
+
+
+static void *concurrent_writer(void *arg) {
+    uint8_t value = 0;
+    size_t  i     = 0;
+    (void)arg;
+
+    while (!atomic_load(&shared.stop)) {
+        value++;
+        watcher_write_begin(&shared.seqlock);
+        for (i = 0; i < sizeof(shared.bytes); i++) {
+            ((volatile uint8_t *)shared.bytes)[i] = value;
+        }
+        watcher_write_end(&shared.seqlock);
+        // Leave room for the watcher on single core machines
+        sched_yield();
+    }
+    return NULL;
+}
+
+
+static void *concurrent_stager(void *arg) {
+    watcher_t *watcher = arg;
+    size_t     i       = 0;
+
+    for (i = 0; i < 4; i++) {
+        watcher_entry_descriptor_t descriptor = WATCHER_ENTRY(&staged_values[i], callback, entries_arg);
+        staged[i].descriptor                  = descriptor;
+        watcher_stage_entry(watcher, &staged[i]);
+    }
+    return NULL;
+}
+
+
+void watcher_concurrent_test(void **state) {
+    (void)state;
+    cbtest = 0;
+    pthread_t writer, stager;
+    size_t    i = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    atomic_init(&shared.seqlock, 0);
+    atomic_init(&shared.stop, 0);
+    watcher_entry_descriptor_t descriptor = WATCHER_ENTRY(&shared.bytes, consistent_callback, NULL);
+    descriptor.seqlock                    = &shared.seqlock;
+    assert_int_equal(WATCHER_RESULT_OK, watcher_add_entries(&watcher, &descriptor, 1));
+
+    assert_int_equal(0, pthread_create(&writer, NULL, concurrent_writer, NULL));
+    assert_int_equal(0, pthread_create(&stager, NULL, concurrent_stager, &watcher));
+    while (cbtest < 100) {
+        watcher_watch(&watcher, 0);
+        sched_yield();
+    }
+    atomic_store(&shared.stop, 1);
+    assert_int_equal(0, pthread_join(writer, NULL));
+    assert_int_equal(0, pthread_join(stager, NULL));
+
+    // Staged entries are registered by the next call, in order
+    watcher_watch(&watcher, 0);
+    for (i = 0; i < 4; i++) {
+        assert_int_equal(1, atomic_load_explicit(&staged[i].done, memory_order_acquire));
+        assert_int_equal(WATCHER_RESULT_OK, staged[i].result);
+        assert_int_equal(i + 1, staged[i].entry_index);
+    }
+
+    cbtest = 0;
+    staged_values[2]++;
+    assert_int_equal(1, watcher_watch(&watcher, 0));
+    assert_int_equal(1, cbtest);
+
+    watcher_destroy(&watcher);
+}
+#endif
+
+
+#ifdef C_WATCHER_STATS
+static void watcher_stats_test(void **state) {
+    (void)state;
+    cbtest = 0;
+    var2   = 0;
+    var3   = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    watcher_stats_t       stats;
+    watcher_entry_stats_t entry_stats;
+    watcher_get_stats(&watcher, &stats);
+    assert_int_equal(0, stats.allocations);
+
+    assert_int_equal(0, WATCHER_ADD_ENTRY(&watcher, &var2, callback, entries_arg));
+    assert_int_equal(1, WATCHER_ADD_ENTRY_DELAYED(&watcher, &var3, callback, entries_arg, 10));
+    watcher_get_stats(&watcher, &stats);
+    assert_true(stats.allocations > 0);
+    assert_true(stats.allocated_bytes > 0);
+    // Registration takes the first copy
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_stats(&watcher, 0, &entry_stats));
+    assert_int_equal(sizeof(var2), entry_stats.bytes_copied);
+    assert_int_equal(WATCHER_RESULT_INVALID_ARGS, watcher_get_entry_stats(&watcher, 2, &entry_stats));
+
+    watcher_watch(&watcher, 0);
+    var2++;
+    watcher_watch(&watcher, 1);
+    assert_int_equal(1, cbtest);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_stats(&watcher, 0, &entry_stats));
+    assert_int_equal(2, entry_stats.compares);
+    assert_int_equal(2 * sizeof(var2), entry_stats.bytes_compared);
+    assert_int_equal(1, entry_stats.triggers);
+    assert_int_equal(2 * sizeof(var2), entry_stats.bytes_copied);
+    assert_int_equal(0, entry_stats.suppressed);
+
+    // Changes found while the delay runs are absorbed by it, each once however many scans see it
+    var3++;
+    watcher_watch(&watcher, 2);
+    var3++;
+    watcher_watch(&watcher, 3);
+    watcher_watch(&watcher, 4);
+    watcher_watch(&watcher, 5);
+    var3++;
+    watcher_watch(&watcher, 6);
+    watcher_watch(&watcher, 7);
+    assert_int_equal(1, cbtest);
+    watcher_watch(&watcher, 12);
+    assert_int_equal(2, cbtest);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_stats(&watcher, 1, &entry_stats));
+    assert_int_equal(9, entry_stats.compares);
+    assert_int_equal(1, entry_stats.triggers);
+    assert_int_equal(2, entry_stats.suppressed);
+
+    watcher_get_stats(&watcher, &stats);
+    assert_int_equal(9, stats.scans);
+    assert_int_equal(0, stats.interrupted);
+    assert_int_equal(0, stats.late_entries);
+    assert_true(stats.max_scan_time >= stats.last_scan_time);
+    assert_true(stats.scan_time >= stats.max_scan_time);
+
+    watcher_reset_stats(&watcher);
+    watcher_get_stats(&watcher, &stats);
+    assert_int_equal(0, stats.scans);
+    assert_int_equal(0, stats.allocations);
+    assert_int_equal(WATCHER_RESULT_OK, watcher_get_entry_stats(&watcher, 1, &entry_stats));
+    assert_int_equal(0, entry_stats.compares);
+    assert_int_equal(0, entry_stats.suppressed);
+
+    watcher_destroy(&watcher);
+}
+#endif
+
+
+#ifdef C_WATCHER_TRACE
+static unsigned long trace_time = 0;
+
+static unsigned long trace_clock(void *arg) {
+    (void)arg;
+    return trace_time;
+}
+
+
+static void slow_callback(void *old_value, const void *new_value, uint16_t size, void *user_ptr, void *arg) {
+    callback(old_value, new_value, size, user_ptr, arg);
+    trace_time += 100;
+}
+
+
+static void append_text(void *arg, const char *text, size_t length) {
+    strncat(arg, text, length);
+}
+
+
+static void watcher_trace_test(void **state) {
+    (void)state;
+    cbtest     = 0;
+    var2       = 0;
+    var3       = 0;
+    trace_time = 0;
+
+    watcher_t watcher;
+    WATCHER_INIT_STD(&watcher, user_pointer);
+
+    watcher_histogram_t      histograms[2];
+    watcher_trace_record_t   records[4];
+    watcher_trace_recorder_t recorder;
+    watcher_trace_hooks_t    hooks;
+    watcher_trace_recorder_init(&recorder, histograms, 2, records, 4, trace_clock, NULL);
+    watcher_trace_recorder_hooks(&recorder, &hooks);
+    watcher_set_trace_hooks(&watcher, &hooks);
+
+    assert_int_equal(0, WATCHER_ADD_ENTRY(&watcher, &var2, slow_callback, entries_arg));
+    assert_int_equal(1, WATCHER_ADD_ENTRY_DELAYED(&watcher, &var3, callback, entries_arg, 10));
+
+    watcher_watch(&watcher, 0);
+    var2++;
+    var3++;
+    watcher_watch(&watcher, 1);
+    assert_int_equal(1, cbtest);
+    assert_int_equal(1, histograms[0].count);
+    assert_int_equal(100, histograms[0].max);
+    // 100 falls in the bucket from 64 to 127
+    assert_int_equal(1, histograms[0].buckets[7]);
+    // Percentiles never exceed the largest value seen
+    assert_int_equal(100, watcher_histogram_percentile(&histograms[0], 99));
+    assert_int_equal(2, recorder.scans.count);
+
+    // The debounced entry fires 10 ticks after its first change, however many followed
+    var3++;
+    watcher_watch(&watcher, 5);
+    watcher_watch(&watcher, 11);
+    assert_int_equal(2, cbtest);
+    assert_int_equal(1, histograms[1].count);
+    assert_int_equal(1, recorder.debounce.count);
+    assert_int_equal(10, recorder.debounce.max);
+
+    // Records are written as calls end: scan 0, callback, scan 1, scan 5, callback, scan 11
+    assert_int_equal(6, recorder.head);
+    assert_int_equal(1, records[(recorder.head - 1) % 4].index);
+    assert_int_equal(WATCHER_TRACE_SCAN, records[(recorder.head - 1) % 4].callback);
+    assert_int_equal(10, records[(recorder.head - 2) % 4].delay);
+
+    char   json[1024] = {0};
+    size_t length     = watcher_trace_export_chrome(&recorder, append_text, json);
+    assert_int_equal(strlen(json), length);
+    assert_ptr_equal(json, strstr(json, "{\"traceEvents\":[{\"name\":\"scan\""));
+    assert_non_null(strstr(json, "\"name\":\"callback 1\""));
+    assert_non_null(strstr(json, "\"delay\":10"));
+
+    // Without hooks nothing is recorded
+    watcher_set_trace_hooks(&watcher, NULL);
+    var2++;
+    watcher_watch(&watcher, 12);
+    assert_int_equal(3, cbtest);
+    assert_int_equal(6, recorder.head);
+
+    watcher_destroy(&watcher);
+}
+#endif
+
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(watcher_test),
         cmocka_unit_test(watcher_delayed_test),
         cmocka_unit_test(watcher_mixed_test),
+        cmocka_unit_test(watcher_batch_test),
+        cmocka_unit_test(watcher_static_reserve_test),
+        cmocka_unit_test(watcher_dedup_test),
+        cmocka_unit_test(watcher_static_index_test),
+        cmocka_unit_test(watcher_shadow_arena_test),
+        cmocka_unit_test(watcher_static_shadow_test),
+        cmocka_unit_test(watcher_memory_info_test),
+        cmocka_unit_test(watcher_many_entries_test),
+        cmocka_unit_test(watcher_deadline_test),
+        cmocka_unit_test(watcher_sizes_test),
+        cmocka_unit_test(watcher_hashed_test),
+        cmocka_unit_test(watcher_hash_copy_test),
+        cmocka_unit_test(watcher_dirty_test),
+        cmocka_unit_test(watcher_static_dirty_test),
+        cmocka_unit_test(watcher_soft_dirty_test),
+        cmocka_unit_test(watcher_parallel_test),
+        cmocka_unit_test(watcher_event_queue_test),
+        cmocka_unit_test(watcher_batched_test),
+        cmocka_unit_test(watcher_budget_test),
+        cmocka_unit_test(watcher_register_from_callback_test),
+        cmocka_unit_test(watcher_handles_test),
+        cmocka_unit_test(watcher_tiers_test),
+        cmocka_unit_test(watcher_diff_test),
+        cmocka_unit_test(watcher_struct_test),
+#ifdef C_WATCHER_STATS
+        cmocka_unit_test(watcher_stats_test),
+#endif
+#ifdef C_WATCHER_TRACE
+        cmocka_unit_test(watcher_trace_test),
+#endif
+#ifdef C_WATCHER_CONCURRENT
+        cmocka_unit_test(watcher_concurrent_test),
+#endif
     };
 
     /* If setup and teardown functions are not